@@ -0,0 +1,217 @@
+#ifndef BLOCKING_POOL
+#define BLOCKING_POOL
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <exception>
+#include <optional>
+#include <memory>
+#include <type_traits>
+
+#include "fiber.h"
+#include "scheduler.h"
+#include "fiber_sync.h"
+
+/*
+    阻塞调用的卸载池
+    数据库查询、文件读写、stat这类调用会阻塞整个工作线程，线程上排队的其他协程也跟着停住；
+    offload(fn)把fn交给单独的线程执行，调用的协程挂起，fn返回（或者抛出异常）后唤醒它，拿到返回值（或者重新抛出异常）
+    线程按需增加，最多maxThreads个，空闲超过idleTimeout退出，至少保留minThreads个；
+    队列最多queueCapacity个，满了调用的协程挂起等空位（普通线程阻塞），阻塞的工作堆积时不会无限增长，也占不到IO工作线程
+    不在调度器的协程里调用时直接在当前线程执行
+    等待不会被打断：fn已经交出去了，结果总要交回来
+*/
+class BlockingPool {
+public:
+    struct Option {
+        size_t minThreads = 0;
+        size_t maxThreads = 64;
+        size_t queueCapacity = 1024;
+        std::chrono::milliseconds idleTimeout {10000};
+    };
+    // 运行状态，计数都是从创建开始累计的
+    struct Stats {
+        size_t threads = 0;     // 当前线程数
+        size_t peakThreads = 0;
+        size_t idle = 0;        // 空闲等待中的线程数
+        size_t queued = 0;      // 还没开始执行的
+        size_t running = 0;     // 正在执行的
+        uint64_t submitted = 0;
+        uint64_t completed = 0;
+        uint64_t fullWaits = 0; // 队列满了需要等空位的次数
+    };
+
+    BlockingPool():BlockingPool(Option()){}
+    explicit BlockingPool(const Option& option);
+    ~BlockingPool();
+    BlockingPool(const BlockingPool&) = delete;
+    BlockingPool& operator=(const BlockingPool&) = delete;
+
+    //--在池里执行fn并等它完成，返回fn的返回值，fn抛出的异常原样抛给调用方
+    template<typename F>
+    typename std::invoke_result<F>::type offload(F&& fn);
+    Stats stats();
+    //--offload默认用的池，第一次使用时创建
+    static BlockingPool& Default();
+
+private:
+    // fn的结果，void单独处理
+    template<typename R>
+    struct Outcome {
+        std::optional<R> value;
+        std::exception_ptr error;
+        template<typename F> void run(F& fn) {
+            try { value.emplace(fn()); }
+            catch (...) { error = std::current_exception(); }
+        }
+        R get() {
+            if (error) std::rethrow_exception(error);
+            return std::move(*value);
+        }
+    };
+    // 交给池的一次调用，放在堆上：共享栈协程挂起后栈上的内容会被别的协程覆盖
+    template<typename F, typename R>
+    struct Job {
+        explicit Job(F&& f):fn(std::forward<F>(f)){}
+        typename std::decay<F>::type fn;
+        Outcome<R> outcome;
+        fiber_sync_detail::Waiter waiter; // 构造时记下当前协程
+    };
+
+    void submit(std::function<void()> task);
+    void loop();
+
+    Option m_option;
+    FiberSemaphore m_slots; // 队列的空位
+    std::mutex m_mutex;
+    std::condition_variable m_cond;     // 有新任务或者要停止
+    std::condition_variable m_exitCond; // 线程全部退出
+    std::deque<std::function<void()>> m_queue;
+    size_t m_threads = 0;
+    size_t m_peakThreads = 0;
+    size_t m_idle = 0;
+    bool m_stop = false;
+    std::atomic<size_t> m_running {0};
+    std::atomic<uint64_t> m_submitted {0};
+    std::atomic<uint64_t> m_completed {0};
+    std::atomic<uint64_t> m_fullWaits {0};
+};
+
+template<>
+struct BlockingPool::Outcome<void> {
+    std::exception_ptr error;
+    template<typename F> void run(F& fn) {
+        try { fn(); }
+        catch (...) { error = std::current_exception(); }
+    }
+    void get() {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+BlockingPool::BlockingPool(const Option& option)
+    :m_option(option),m_slots(std::max<size_t>(option.queueCapacity, 1)){
+    m_option.maxThreads = std::max<size_t>(m_option.maxThreads, 1);
+    m_option.minThreads = std::min(m_option.minThreads, m_option.maxThreads);
+}
+
+// 队列里剩下的任务执行完才退出，等着结果的协程不会挂死
+BlockingPool::~BlockingPool(){
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stop = true;
+    m_cond.notify_all();
+    m_exitCond.wait(lock, [this]{ return m_threads == 0; });
+}
+
+BlockingPool& BlockingPool::Default(){
+    static BlockingPool pool;
+    return pool;
+}
+
+template<typename F>
+typename std::invoke_result<F>::type BlockingPool::offload(F&& fn){
+    using R = typename std::invoke_result<F>::type;
+    if (!Fiber::InFiber() || !IOScheduler::GetThis()) return fn();
+    std::unique_ptr<Job<F, R>> job(new Job<F, R>(std::forward<F>(fn)));
+    Job<F, R>* raw = job.get();
+    submit([raw]{
+        raw->outcome.run(raw->fn);
+        // 唤醒之后协程随时可能释放job，之后不能再碰它
+        raw->waiter.notify();
+    });
+    raw->waiter.wait();
+    return job->outcome.get();
+}
+
+void BlockingPool::submit(std::function<void()> task){
+    if (!m_slots.try_acquire()) {
+        m_fullWaits.fetch_add(1, std::memory_order_relaxed);
+        m_slots.acquire();
+    }
+    m_submitted.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.push_back(std::move(task));
+    // 空闲的线程不够分时再开一个
+    if (m_queue.size() > m_idle && m_threads < m_option.maxThreads) {
+        m_threads++;
+        m_peakThreads = std::max(m_peakThreads, m_threads);
+        std::thread(&BlockingPool::loop, this).detach();
+    }
+    else {
+        m_cond.notify_one();
+    }
+}
+
+void BlockingPool::loop(){
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        if (m_queue.empty()) {
+            if (m_stop) break;
+            m_idle++;
+            bool woken = m_cond.wait_for(lock, m_option.idleTimeout, [this]{ return m_stop || !m_queue.empty(); });
+            m_idle--;
+            if (!woken && m_threads > m_option.minThreads) break;
+            continue;
+        }
+        std::function<void()> task = std::move(m_queue.front());
+        m_queue.pop_front();
+        lock.unlock();
+        m_slots.release();
+        m_running.fetch_add(1, std::memory_order_relaxed);
+        task();
+        m_running.fetch_sub(1, std::memory_order_relaxed);
+        m_completed.fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
+    }
+    m_threads--;
+    if (m_threads == 0) m_exitCond.notify_all();
+}
+
+BlockingPool::Stats BlockingPool::stats(){
+    Stats s;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        s.threads = m_threads;
+        s.peakThreads = m_peakThreads;
+        s.idle = m_idle;
+        s.queued = m_queue.size();
+    }
+    s.running = m_running.load(std::memory_order_relaxed);
+    s.submitted = m_submitted.load(std::memory_order_relaxed);
+    s.completed = m_completed.load(std::memory_order_relaxed);
+    s.fullWaits = m_fullWaits.load(std::memory_order_relaxed);
+    return s;
+}
+
+//--在默认的卸载池里执行阻塞调用，调用的协程挂起等结果，见BlockingPool
+template<typename F>
+typename std::invoke_result<F>::type offload(F&& fn){
+    return BlockingPool::Default().offload(std::forward<F>(fn));
+}
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef CHANNEL
+#define CHANNEL
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "fiber_sync.h"
+#include "mpmc_ring.h"
+
+/*
+    协程之间（可以跨线程）传递消息的通道
+        Channel<T> ch(n)   有界通道，最多缓存n个元素，满了send挂起
+        Channel<T> ch      无界通道，send从不挂起
+    recv在通道为空时挂起当前协程；不在协程里调用时退化为阻塞线程，和fiber_sync里的原语一样
+    数据放在无锁的MPMC环形队列里，收发双方没有等待者时不碰任何锁；
+    无界通道环满了以后溢出到加锁的deque，溢出区不空时新元素都进溢出区，保证同一个发送方的顺序
+    close之后send返回false，recv把剩下的元素取完之后返回false；
+    挂起中的协程到了截止时间或被取消时也返回false，原因用Fiber::interrupted()区分
+*/
+
+class Select;
+
+template <typename T>
+class Channel {
+public:
+    typedef std::shared_ptr<Channel> ptr;
+    static const size_t UNBOUNDED = 0;
+    static const size_t UNBOUNDED_RING_SIZE = 1024; // 无界通道的无锁部分
+
+    explicit Channel(size_t capacity = UNBOUNDED)
+        :m_ring(capacity == UNBOUNDED ? UNBOUNDED_RING_SIZE : capacity)
+        ,m_bounded(capacity != UNBOUNDED){}
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    // 通道已关闭或者等待被打断时返回false，value不会被移走
+    bool send(T value) {
+        if (trySendImpl(value)) return true;
+        if (m_closed.load(std::memory_order_acquire)) return false;
+        // 重试在等待队列的锁下进行，唤醒对端要放到外面，否则收发两边互相等对方的队列锁
+        bool sent = false;
+        m_senders.parkUntil([&] {
+            if (m_closed.load(std::memory_order_acquire)) return true;
+            sent = tryPush(value);
+            return sent;
+        }, NO_DEADLINE);
+        if (sent) m_receivers.notifyOne();
+        return sent;
+    }
+    // 满了或者已关闭返回false
+    bool trySend(T& value) { return trySendImpl(value); }
+
+    // 通道已关闭并且取空了，或者等待被打断时返回false
+    bool recv(T& out) {
+        if (tryRecv(out)) return true;
+        bool got = false;
+        bool woken = m_receivers.parkUntil([&] {
+            got = tryPop(out);
+            return got || m_closed.load(std::memory_order_acquire);
+        }, NO_DEADLINE);
+        if (got) {
+            if (m_bounded) m_senders.notifyOne();
+            return true;
+        }
+        if (!woken) return false;
+        // 关闭前发出的元素可能和关闭的通知交错，最后再取一次
+        return tryRecv(out);
+    }
+    bool tryRecv(T& out) {
+        if (!tryPop(out)) return false;
+        if (m_bounded) m_senders.notifyOne();
+        return true;
+    }
+
+    // 唤醒所有等待者，重复关闭没有影响
+    void close() {
+        m_closed.store(true, std::memory_order_seq_cst);
+        m_senders.notifyAll();
+        m_receivers.notifyAll();
+    }
+    bool isClosed() const { return m_closed.load(std::memory_order_acquire); }
+
+    // 近似值，只用于观察
+    size_t size() const {
+        return m_ring.sizeApprox() + m_overflowCount.load(std::memory_order_relaxed);
+    }
+    size_t capacity() const { return m_bounded ? m_ring.capacity() : UNBOUNDED; }
+
+private:
+    friend class Select;
+    static constexpr std::chrono::steady_clock::time_point NO_DEADLINE = std::chrono::steady_clock::time_point::max();
+
+    bool trySendImpl(T& value) {
+        if (m_closed.load(std::memory_order_acquire)) return false;
+        if (!tryPush(value)) return false;
+        m_receivers.notifyOne();
+        return true;
+    }
+    bool tryPush(T& value) {
+        if (m_bounded) return m_ring.tryPush(value);
+        if (m_overflowCount.load(std::memory_order_acquire) == 0 && m_ring.tryPush(value)) return true;
+        std::lock_guard<std::mutex> lock(m_overflowMutex);
+        if (m_overflow.empty() && m_ring.tryPush(value)) return true;
+        m_overflow.push_back(std::move(value));
+        m_overflowCount.store(m_overflow.size(), std::memory_order_release);
+        return true;
+    }
+    bool tryPop(T& out) {
+        while (true) {
+            if (m_ring.tryPop(out)) return true;
+            if (m_bounded || m_overflowCount.load(std::memory_order_acquire) == 0) return false;
+            // 环空了，按顺序把溢出区搬进环里
+            std::lock_guard<std::mutex> lock(m_overflowMutex);
+            while (!m_overflow.empty() && m_ring.tryPush(m_overflow.front())) {
+                m_overflow.pop_front();
+            }
+            m_overflowCount.store(m_overflow.size(), std::memory_order_release);
+        }
+    }
+    // 给select用的近似判断
+    bool readyToRecv() const { return size() > 0 || isClosed(); }
+    bool readyToSend() const { return !m_bounded || m_ring.sizeApprox() < m_ring.capacity() || isClosed(); }
+
+    MPMCRing<T> m_ring;
+    const bool m_bounded;
+    std::atomic<bool> m_closed {false};
+    std::mutex m_overflowMutex;
+    std::deque<T> m_overflow;
+    std::atomic<size_t> m_overflowCount {0};
+    fiber_sync_detail::WaitQueue m_senders;
+    fiber_sync_detail::WaitQueue m_receivers;
+};
+
+/*
+    同时等待多个通道，哪个先就绪就执行哪个分支，和Go的select类似
+        int index = Select()
+            .recv(a, [](int v){ ... })
+            .send(b, msg, []{ ... })
+            .wait();
+    返回执行的分支下标；所有分支的通道都已关闭时返回NONE，等待被打断时返回INTERRUPTED；
+    tryWait不挂起，没有就绪的分支返回NONE
+    等待时把同一个等待者挂到每个通道的队列上，先挂再检查一遍，谁先唤醒算谁；
+    醒来后把节点全部摘掉，没被选中的通道如果也就绪了，把通知转给它的下一个等待者，避免唤醒被吞掉
+*/
+class Select {
+public:
+    static const int NONE = -1;        // 没有执行任何分支
+    static const int INTERRUPTED = -2; // 协程到了截止时间或被取消
+
+    Select() = default;
+    Select(const Select&) = delete;
+    Select& operator=(const Select&) = delete;
+
+    template <typename T, typename Fn>
+    Select& recv(Channel<T>& ch, Fn&& fn) {
+        m_cases.emplace_back(new RecvCase<T, typename std::decay<Fn>::type>(ch, std::forward<Fn>(fn)));
+        return *this;
+    }
+    template <typename T, typename Fn>
+    Select& send(Channel<T>& ch, T value, Fn&& fn) {
+        m_cases.emplace_back(new SendCase<T, typename std::decay<Fn>::type>(ch, std::move(value), std::forward<Fn>(fn)));
+        return *this;
+    }
+
+    int tryWait() {
+        bool allClosed = true;
+        int index = attempt(allClosed);
+        if (index >= 0) finish(index);
+        return index;
+    }
+
+    int wait() {
+        while (true) {
+            bool allClosed = true;
+            int index = attempt(allClosed);
+            if (index >= 0) {
+                finish(index);
+                return index;
+            }
+            if (allClosed) return NONE;
+
+            // 节点要比等待者活得久：唤醒方在放开等待者之前还会读节点
+            std::vector<fiber_sync_detail::WaitNode> nodes(m_cases.size());
+            fiber_sync_detail::WaiterHolder holder;
+            fiber_sync_detail::Waiter* waiter = holder.get();
+            for (size_t i = 0; i < m_cases.size(); ++i) {
+                nodes[i].waiter = waiter;
+                m_cases[i]->queue().enqueue(&nodes[i]);
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            index = attempt(allClosed);
+            bool interrupted = false;
+            if (index < 0 && !allClosed) {
+                interrupted = !waiter->waitUntil(std::chrono::steady_clock::time_point::max());
+            }
+            for (size_t i = 0; i < m_cases.size(); ++i) m_cases[i]->queue().remove(&nodes[i]);
+            // 唤醒方可能还拿着waiter，等它放手（holder析构时）之后才能返回
+            if (index >= 0) {
+                finish(index);
+                return index;
+            }
+            if (interrupted) {
+                // 可能同时被某个通道唤醒过，转给其他等待者
+                if (waiter->claimed.exchange(true, std::memory_order_acq_rel)) passOn(-1);
+                return INTERRUPTED;
+            }
+        }
+    }
+
+private:
+    struct Case {
+        virtual ~Case() {}
+        virtual bool attempt() = 0;   // 成功时数据已经收发完，分支函数还没执行
+        virtual bool closed() = 0;    // 这个分支再也不会就绪
+        virtual bool ready() = 0;
+        virtual void run() = 0;
+        virtual fiber_sync_detail::WaitQueue& queue() = 0;
+    };
+
+    template <typename T, typename Fn>
+    struct RecvCase : Case {
+        RecvCase(Channel<T>& c, Fn&& f):ch(c),fn(std::move(f)){}
+        RecvCase(Channel<T>& c, const Fn& f):ch(c),fn(f){}
+        bool attempt() override {
+            T tmp;
+            if (!ch.tryRecv(tmp)) return false;
+            value.emplace(std::move(tmp));
+            return true;
+        }
+        bool closed() override { return ch.isClosed() && ch.size() == 0; }
+        bool ready() override { return ch.readyToRecv(); }
+        void run() override { fn(std::move(*value)); }
+        fiber_sync_detail::WaitQueue& queue() override { return ch.m_receivers; }
+        Channel<T>& ch;
+        Fn fn;
+        std::optional<T> value;
+    };
+
+    template <typename T, typename Fn>
+    struct SendCase : Case {
+        SendCase(Channel<T>& c, T v, Fn&& f):ch(c),value(std::move(v)),fn(std::move(f)){}
+        SendCase(Channel<T>& c, T v, const Fn& f):ch(c),value(std::move(v)),fn(f){}
+        bool attempt() override { return ch.trySend(value); }
+        bool closed() override { return ch.isClosed(); }
+        bool ready() override { return ch.readyToSend(); }
+        void run() override { fn(); }
+        fiber_sync_detail::WaitQueue& queue() override { return ch.m_senders; }
+        Channel<T>& ch;
+        T value;
+        Fn fn;
+    };
+
+    // 从轮转的位置开始尝试，避免总是偏向前面的分支
+    int attempt(bool& allClosed) {
+        static thread_local size_t t_start = 0;
+        size_t n = m_cases.size();
+        size_t start = t_start++;
+        allClosed = true;
+        for (size_t k = 0; k < n; ++k) {
+            size_t i = (start + k) % n;
+            if (m_cases[i]->attempt()) return static_cast<int>(i);
+            if (!m_cases[i]->closed()) allClosed = false;
+        }
+        return NONE;
+    }
+
+    void finish(int index) {
+        passOn(index);
+        m_cases[index]->run();
+    }
+    void passOn(int index) {
+        for (size_t i = 0; i < m_cases.size(); ++i) {
+            if (static_cast<int>(i) != index && m_cases[i]->ready()) m_cases[i]->queue().notifyOne();
+        }
+    }
+
+    std::vector<std::unique_ptr<Case>> m_cases;
+};
+
+#endif
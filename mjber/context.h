@@ -24,9 +24,21 @@ linux约定
 #include <xmmintrin.h> // For __m128i
 
 // 上下文结构体（需严格匹配汇编偏移）
-// rbx、rbp、rsi、rdi r12-15 xmm6-15
 struct alignas(16) Context {
-#if defined(__x86_64__)
+#if defined(__x86_64__) && !defined(WIN32_)
+    // SysV: rbx、rbp、r12-15、MXCSR、x87控制字
+    void* rip;    // 00
+    void* rsp;    // 08
+    void* rbx;    // 10
+    void* rbp;    // 18
+    void* r12;    // 20 首次进入时为参数
+    void* r13;    // 28 首次进入时为入口函数
+    void* r14;    // 30
+    void* r15;    // 38
+    uint32_t mxcsr;  // 40
+    uint16_t fpucw;  // 44
+#elif defined(__x86_64__)
+    // Win64: rbx、rbp、rsi、rdi r12-15 xmm6-15
     void* rip;
     void* rsp;
     void* rbx;
@@ -205,137 +217,127 @@ void ctx_swap(Context* o_ctx,Context* t_ctx){
     );
 }
 #else
-void ctx_save(Context* ctx) {
-    asm volatile (
-        //rcx=&ctx
-        // 保存返回地址到rip字段
-        "movq 8(%rbp), %rax\n"      // 保存函数返回地址到rax
-        "movq %rax, 0x00(%rdi)\n"      // ctx->rip = return address
-        
-        // 保存原栈指针
-        "leaq 0x10(%rsp), %rax\n"
-        "movq %rax, 0x08(%rdi)\n"      // ctx->rsp
-        
-        // 保存Callee-saved寄存器
-        "movq %rbx, 0x10(%rdi)\n"
-
-        "movq 0(%rbp), %rax\n" //由于函数压入返回地址、rbp
-        "movq %rax, 0x18(%rdi)\n"
-
-        // "movq %rsi, 0x20(%rdi)\n"
-        // "movq %rdi, 0x28(%rdi)\n"
-        "movq %r12, 0x30(%rdi)\n"
-        "movq %r13, 0x38(%rdi)\n"
-        "movq %r14, 0x40(%rdi)\n"
-        "movq %r15, 0x48(%rdi)\n"
-        
-        // 保存XMM6-XMM15
-        "movdqu %xmm6, 0x50(%rdi)\n"
-        "movdqu %xmm7, 0x60(%rdi)\n"
-        "movdqu %xmm8, 0x70(%rdi)\n"
-        "movdqu %xmm9, 0x80(%rdi)\n"
-        "movdqu %xmm10, 0x90(%rdi)\n"
-        "movdqu %xmm11, 0xA0(%rdi)\n"
-        "movdqu %xmm12, 0xB0(%rdi)\n"
-        "movdqu %xmm13, 0xC0(%rdi)\n"
-        "movdqu %xmm14, 0xD0(%rdi)\n"
-        "movdqu %xmm15, 0xE0(%rdi)\n"
-    );
-}
-
-void ctx_swap(Context* o_ctx,Context* t_ctx){
-    asm(
-        // rcx=o_ctx, rdx=t_ctx
-        
-        // 保存当前上下文到o_ctx-------------------------------------------//
-        "movq 8(%rbp), %rax\n"      // 保存函数返回地址到rax
-        "movq %rax, 0x00(%rdi)\n"      // ctx->rip = return address
-        
-        // 保存原栈指针
-        "leaq 0x10(%rsp), %rax\n"
-        "movq %rax, 0x08(%rdi)\n"      // ctx->rsp
-        
-        // 保存Callee-saved寄存器
-        "movq %rbx, 0x10(%rdi)\n"
-
-        "movq 0(%rbp), %rax\n" //由于函数压入返回地址、rbp
-        "movq %rax, 0x18(%rdi)\n"
-
-        // "movq %rsi, 0x20(%rdi)\n"
-        // "movq %rdi, 0x28(%rdi)\n"
-        "movq %r12, 0x30(%rdi)\n"
-        "movq %r13, 0x38(%rdi)\n"
-        "movq %r14, 0x40(%rdi)\n"
-        "movq %r15, 0x48(%rdi)\n"
-        
-        // 保存XMM6-XMM15
-        "movdqu %xmm6, 0x50(%rdi)\n"
-        "movdqu %xmm7, 0x60(%rdi)\n"
-        "movdqu %xmm8, 0x70(%rdi)\n"
-        "movdqu %xmm9, 0x80(%rdi)\n"
-        "movdqu %xmm10, 0x90(%rdi)\n"
-        "movdqu %xmm11, 0xA0(%rdi)\n"
-        "movdqu %xmm12, 0xB0(%rdi)\n"
-        "movdqu %xmm13, 0xC0(%rdi)\n"
-        "movdqu %xmm14, 0xD0(%rdi)\n"
-        "movdqu %xmm15, 0xE0(%rdi)\n"
-        
-        // 恢复目标上下文t_ctx------------------------------------------//
-        // 恢复XMM寄存器
-        "movdqu 0x50(%rsi), %xmm6\n"
-        "movdqu 0x60(%rsi), %xmm7\n"
-        "movdqu 0x70(%rsi), %xmm8\n"
-        "movdqu 0x80(%rsi), %xmm9\n"
-        "movdqu 0x90(%rsi), %xmm10\n"
-        "movdqu 0xA0(%rsi), %xmm11\n"
-        "movdqu 0xB0(%rsi), %xmm12\n"
-        "movdqu 0xC0(%rsi), %xmm13\n"
-        "movdqu 0xD0(%rsi), %xmm14\n"
-        "movdqu 0xE0(%rsi), %xmm15\n"
-        
-        // 恢复通用寄存器
-        "movq 0x48(%rsi), %r15\n"
-        "movq 0x40(%rsi), %r14\n"
-        "movq 0x38(%rsi), %r13\n"
-        "movq 0x30(%rsi), %r12\n"
-        // "movq 0x28(%rsi), %rdi\n"
-        // "movq 0x20(%rsi), %rsi\n"
-        "movq 0x18(%rsi), %rbp\n"
-        "movq 0x10(%rsi), %rbx\n"
-        
-
-        //恢复执行流----------------------------------------//
-        "movq 0x100(%rsi), %rax\n"
-        "cmpq $1, %rax\n"
-        "jne .L1\n"// 如果不是第一次进入
-
-        // 第一次进入时，准备工作函数，参数放到rcx
-
-        "movq 0xF0(%rsi), %rdi\n" //准备好参数到rcx
-        "movq $0, 0x100(%rsi)\n" //下次进入不用重新进入函数
-        "movq 0xF8(%rsi), %rax\n"//准备好函数地址
-        "movq 0x08(%rsi), %rsp\n"
-        "jmp *%rax\n" //跳转到工作函数
+/*
+    SysV x86_64 (Linux)
+    SysV约定的callee-saved只有rbx/rbp/r12-r15，xmm寄存器全部是caller-saved，rsi/rdi是参数寄存器，
+    所以只需保存这些通用寄存器、rsp/rip，以及MXCSR和x87控制字（ABI要求跨调用保持）。
+    ctx_swap写成独立的汇编函数，不依赖编译器生成的栈帧，-O2下同样正确。
+    首次进入不再在每次切换时判断firstIn：ctx_make把rip设成ctx_entry，r12放参数，r13放函数地址，
+    第一次切入时由ctx_entry把参数放进rdi再调用入口函数。
+    ldmxcsr/fldcw会让流水线串行化，代价比其余的保存恢复加起来还高；两个协程的浮点环境几乎总是一样的，
+    所以恢复时先和刚保存的当前值比较，相同就跳过加载（见test/bench_context.cpp）。
+    MXCSR只比较控制位：低6位是异常标志，ABI不要求跨调用保持，算过浮点的一方总会带着PE，按整个值比较几乎每次都要加载。
+    确定程序不会修改浮点环境（fesetround等）时，可以定义MJBER_CTX_NO_FPU_STATE连保存也省掉。
+*/
+#ifndef MJBER_CTX_NO_FPU_STATE
+#define CTX_SAVE_FPU "    stmxcsr 0x40(%rdi)\n" "    fnstcw 0x44(%rdi)\n"
+#define CTX_LOAD_FPU \
+    "    movl 0x40(%rsi), %eax\n" \
+    "    xorl 0x40(%rdi), %eax\n" \
+    "    testl $-64, %eax\n" \
+    "    jz 1f\n" \
+    "    ldmxcsr 0x40(%rsi)\n" \
+    "1:\n" \
+    "    movzwl 0x44(%rsi), %eax\n" \
+    "    cmpw 0x44(%rdi), %ax\n" \
+    "    je 2f\n" \
+    "    fldcw 0x44(%rsi)\n" \
+    "2:\n"
+#else
+#define CTX_SAVE_FPU ""
+#define CTX_LOAD_FPU ""
+#endif
+__asm__(
+    ".pushsection .text\n"
+    ".globl ctx_swap\n"
+    ".type ctx_swap,@function\n"
+    ".p2align 4\n"
+    "ctx_swap:\n"
+    // rdi=o_ctx, rsi=t_ctx
+    // 保存当前上下文到o_ctx，rip为返回地址，rsp为返回后的栈顶
+    "    movq (%rsp), %rax\n"
+    "    leaq 8(%rsp), %rcx\n"
+    "    movq %rax, 0x00(%rdi)\n"
+    "    movq %rcx, 0x08(%rdi)\n"
+    "    movq %rbx, 0x10(%rdi)\n"
+    "    movq %rbp, 0x18(%rdi)\n"
+    "    movq %r12, 0x20(%rdi)\n"
+    "    movq %r13, 0x28(%rdi)\n"
+    "    movq %r14, 0x30(%rdi)\n"
+    "    movq %r15, 0x38(%rdi)\n"
+    CTX_SAVE_FPU
+    // 恢复目标上下文t_ctx
+    "    movq 0x10(%rsi), %rbx\n"
+    "    movq 0x18(%rsi), %rbp\n"
+    "    movq 0x20(%rsi), %r12\n"
+    "    movq 0x28(%rsi), %r13\n"
+    "    movq 0x30(%rsi), %r14\n"
+    "    movq 0x38(%rsi), %r15\n"
+    CTX_LOAD_FPU
+    "    movq 0x08(%rsi), %rsp\n"
+    "    jmpq *0x00(%rsi)\n"
+    ".size ctx_swap, .-ctx_swap\n"
+
+    // 保存上下文后直接返回，恢复时如同ctx_save刚返回
+    ".globl ctx_save\n"
+    ".type ctx_save,@function\n"
+    ".p2align 4\n"
+    "ctx_save:\n"
+    "    movq (%rsp), %rax\n"
+    "    leaq 8(%rsp), %rcx\n"
+    "    movq %rax, 0x00(%rdi)\n"
+    "    movq %rcx, 0x08(%rdi)\n"
+    "    movq %rbx, 0x10(%rdi)\n"
+    "    movq %rbp, 0x18(%rdi)\n"
+    "    movq %r12, 0x20(%rdi)\n"
+    "    movq %r13, 0x28(%rdi)\n"
+    "    movq %r14, 0x30(%rdi)\n"
+    "    movq %r15, 0x38(%rdi)\n"
+    CTX_SAVE_FPU
+    "    ret\n"
+    ".size ctx_save, .-ctx_save\n"
+
+    // 首次进入的跳板：r12=参数 r13=入口函数，入口函数不会返回
+    ".globl ctx_entry\n"
+    ".type ctx_entry,@function\n"
+    ".p2align 4\n"
+    "ctx_entry:\n"
+    "    movq %r12, %rdi\n"
+    "    callq *%r13\n"
+    "    ud2\n"
+    ".size ctx_entry, .-ctx_entry\n"
+    ".popsection\n"
+);
 
-        // 否则，恢复栈指针和跳转地址
-        ".L1:\n"
-        "movq 0x08(%rsi), %rsp\n"
-        "movq 0x00(%rsi), %rax\n"
-        "jmp *%rax\n"               // 跳转到保存的rip
-    );
-}
+extern "C" void ctx_entry();
 #endif
-int ctx_make(Context& ctx,void* func,void* ptr=0,size_t stack_size=1024*1024){
-    char* stack_bottom = new char[stack_size];
-    char* stack_top = stack_bottom + stack_size - 8;
-    ctx.rsp = (void*)stack_top;
+
+// 构建首次进入的上下文，stack_top为栈的最高地址
+// func的形式为 void func(void* ptr)，不能返回
+#ifdef WIN32_
+void ctx_make(Context& ctx,void* func,void* ptr,void* stack_top){
+    ctx.rsp = static_cast<char*>(stack_top) - sizeof(void*);
     ctx.rbp = ctx.rsp;
     ctx.firstIn = (void*)1;
     ctx.funcPtr = func;
     ctx.ptr = ptr;
-    return 0;
 }
-
+#else
+void ctx_make(Context& ctx,void* func,void* ptr,void* stack_top){
+    // 栈顶按16字节对齐，ctx_entry中的call压入返回地址后入口函数看到的rsp符合ABI
+    uintptr_t top = reinterpret_cast<uintptr_t>(stack_top) & ~static_cast<uintptr_t>(15);
+    ctx.rsp = reinterpret_cast<void*>(top);
+    ctx.rip = reinterpret_cast<void*>(&ctx_entry);
+    ctx.rbx = nullptr;
+    ctx.rbp = nullptr;
+    ctx.r12 = ptr;
+    ctx.r13 = func;
+    ctx.r14 = nullptr;
+    ctx.r15 = nullptr;
+    ctx.mxcsr = 0x1F80;  // 默认值：屏蔽所有异常，就近舍入
+    ctx.fpucw = 0x037F;
+}
+#endif
 #elif defined(__aarch64__)
 
 // ARM64实现
@@ -0,0 +1,159 @@
+#ifndef FD_REGISTRY
+#define FD_REGISTRY
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+
+#include "fiber.h"
+
+/*
+    按fd下标的等待表，代替调度器里用一把锁保护的哈希表
+    每个fd一个槽：等待的协程、它关心的事件、已经注册到内核的事件、没人等时到来的事件，全部是原子变量
+    槽按块懒分配，块指针数组按RLIMIT_NOFILE一次分配好，之后只增不减，查找不加锁
+    fd关闭时代数加一，注册到epoll的数据里带着代数，fd被复用后旧注册残留的事件能被认出来丢掉
+
+    读和写各有一个等待方（同一个连接上一个协程读、一个协程写），事件按各自关心的部分分别唤醒；
+    同一边又来一个等待方时先登记的被顶掉，交回给调用方唤醒，它重试读写时会再登记，不会一直挂着
+
+    等待和事件到来的握手（边沿触发，事件只来一次）：
+        等待方先放好interest和waiter，fence，再看ready里有没有已经来过的事件，有就自己唤醒自己
+        事件方先把事件记进ready，fence，再取waiter
+    两边至少有一边能看到对方，不会丢唤醒；偶尔会多唤醒一次，等待方本来就要重试读写
+*/
+class FdRegistry {
+public:
+    // 等待方分读写两边，只等EPOLLOUT的是写，其余的（包括读写一起等）是读
+    enum Side { READER = 0, WRITER = 1, SIDES = 2 };
+    struct Slot {
+        std::atomic<uint32_t> gen {0};
+        std::atomic<uint32_t> mask {0};     // 已经注册到内核的事件
+        std::atomic<uint32_t> ready {0};    // 到来时没有对应等待方的事件
+        std::atomic<uint32_t> interest[SIDES] {}; // 两边等待方关心的事件
+        std::atomic<Fiber*> waiter[SIDES] {};     // 持有一个引用
+    };
+    // 挂起、出错的事件，不管等的是什么都要唤醒
+    static const uint32_t ALWAYS = EPOLLERR | EPOLLHUP;
+
+    static Side SideOf(uint32_t events) {
+        return (events & EPOLLOUT) && !(events & (EPOLLIN | EPOLLPRI)) ? WRITER : READER;
+    }
+
+    FdRegistry() {
+        rlimit limit;
+        size_t maxFd = 65536;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_max != RLIM_INFINITY) {
+            maxFd = static_cast<size_t>(limit.rlim_max);
+        }
+        m_chunkCount = (maxFd + CHUNK - 1) / CHUNK;
+        m_chunks.reset(new std::atomic<Slot*>[m_chunkCount]);
+        for (size_t i = 0; i < m_chunkCount; i++) m_chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+    ~FdRegistry() {
+        for (size_t i = 0; i < m_chunkCount; i++) {
+            Slot* chunk = m_chunks[i].load(std::memory_order_relaxed);
+            if (!chunk) continue;
+            for (size_t j = 0; j < CHUNK; j++) {
+                for (auto& waiter : chunk[j].waiter) {
+                    Fiber* fiber = waiter.load(std::memory_order_relaxed);
+                    if (fiber) Fiber::ptr::Adopt(fiber);
+                }
+            }
+            delete[] chunk;
+        }
+    }
+    FdRegistry(const FdRegistry&) = delete;
+    FdRegistry& operator=(const FdRegistry&) = delete;
+
+    //--取fd的槽，块不存在时分配；fd超出范围返回空
+    Slot* get(int fd) {
+        if (fd < 0) return nullptr;
+        size_t index = static_cast<size_t>(fd) / CHUNK;
+        if (index >= m_chunkCount) return nullptr;
+        Slot* chunk = m_chunks[index].load(std::memory_order_acquire);
+        if (!chunk) {
+            Slot* fresh = new Slot[CHUNK];
+            if (m_chunks[index].compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel)) chunk = fresh;
+            else delete[] fresh; // 别的线程先分配了
+        }
+        return &chunk[fd % CHUNK];
+    }
+    //--只查找不分配
+    Slot* find(int fd) const {
+        if (fd < 0) return nullptr;
+        size_t index = static_cast<size_t>(fd) / CHUNK;
+        if (index >= m_chunkCount) return nullptr;
+        Slot* chunk = m_chunks[index].load(std::memory_order_acquire);
+        return chunk ? &chunk[fd % CHUNK] : nullptr;
+    }
+
+    // 注册到epoll的数据：高32位代数，低32位fd
+    static uint64_t Key(int fd, uint32_t gen) { return static_cast<uint64_t>(gen) << 32 | static_cast<uint32_t>(fd); }
+    static int KeyFd(uint64_t key) { return static_cast<int>(key & 0xffffffff); }
+    static uint32_t KeyGen(uint64_t key) { return static_cast<uint32_t>(key >> 32); }
+
+    // 下面几个函数把需要唤醒的协程交给wake(Fiber::ptr)，由调用方决定怎么唤醒
+
+    //--登记等待方：事件已经来过时交出它自己；同一边原来的等待方被顶掉，也交出去
+    template <typename Wake>
+    static void arm(Slot* slot, Fiber::ptr self, uint32_t events, Wake&& wake) {
+        Side side = SideOf(events);
+        Fiber* raw = self.get();
+        slot->interest[side].store(events, std::memory_order_relaxed);
+        Fiber::ptr old = Fiber::ptr::Adopt(slot->waiter[side].exchange(self.release(), std::memory_order_acq_rel));
+        if (old && old.get() != raw) wake(std::move(old));
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint32_t ready = slot->ready.fetch_and(~events, std::memory_order_acq_rel);
+        if (ready & (events | ALWAYS)) {
+            if (Fiber::ptr fiber = take(slot, side)) wake(std::move(fiber));
+        }
+    }
+    //--事件到来，两边各自看是不是自己关心的
+    template <typename Wake>
+    static void fire(Slot* slot, uint32_t events, Wake&& wake) {
+        slot->ready.fetch_or(events, std::memory_order_acq_rel);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (int side = 0; side < SIDES; side++) {
+            uint32_t interest = slot->interest[side].load(std::memory_order_relaxed);
+            if (!(events & (interest | ALWAYS))) continue;
+            Fiber::ptr fiber = take(slot, static_cast<Side>(side));
+            if (!fiber) continue;
+            // 交给了等待方的事件不再留在ready里，否则它下次等待会白白醒一次
+            slot->ready.fetch_and(~(events & interest), std::memory_order_acq_rel);
+            wake(std::move(fiber));
+        }
+    }
+    //--等待方不再等了（超时、取消），还在槽里就撤掉
+    static void disarm(Slot* slot, Fiber* self) {
+        for (auto& waiter : slot->waiter) {
+            Fiber* expect = self;
+            if (waiter.compare_exchange_strong(expect, nullptr, std::memory_order_acq_rel)) {
+                Fiber::ptr::Adopt(self);
+            }
+        }
+    }
+    //--fd关闭，代数加一并清空，交出还在等的协程
+    template <typename Wake>
+    static void reset(Slot* slot, Wake&& wake) {
+        slot->gen.fetch_add(1, std::memory_order_acq_rel);
+        slot->mask.store(0, std::memory_order_relaxed);
+        slot->ready.store(0, std::memory_order_relaxed);
+        for (int side = 0; side < SIDES; side++) {
+            slot->interest[side].store(0, std::memory_order_relaxed);
+            if (Fiber::ptr fiber = take(slot, static_cast<Side>(side))) wake(std::move(fiber));
+        }
+    }
+
+private:
+    static Fiber::ptr take(Slot* slot, Side side) {
+        return Fiber::ptr::Adopt(slot->waiter[side].exchange(nullptr, std::memory_order_acq_rel));
+    }
+
+    static const size_t CHUNK = 4096;
+    std::unique_ptr<std::atomic<Slot*>[]> m_chunks;
+    size_t m_chunkCount = 0;
+};
+
+#endif
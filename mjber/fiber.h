@@ -1,5 +1,7 @@
 #pragma once
 #include "context.h"
+#include "stack_allocator.h"
+#include "inline_task.h"
 
 #include <functional>
 #include <memory>
@@ -7,6 +9,14 @@
 #include <utility>
 #include <type_traits>
 #include <map>
+#include <vector>
+#include <cstring>
+#include <mutex>
+
+#include <typeinfo>
+#include <chrono>
+#include <thread>
+#include <cerrno>
 
 #include "logger.h"
 // 新建一个协程：使用构造函数传入函数
@@ -31,6 +41,47 @@ enum class FiberState {
     READY,   // 就绪
     ERROR    // 错误
 };
+// 协程栈的使用方式
+enum class StackMode {
+    DEDICATED,  // 独占一个栈
+    SHARED      // 运行在共享栈上，挂起时把用到的栈内容拷出
+};
+
+// 独占栈的大小档位，各档大小可以用Fiber::SetStackClassSize调整
+// 根据StackProfiler统计到的高水位给不同的任务选择档位
+enum class StackClass {
+    DEFAULT,  // Fiber::m_stack_size
+    SMALL,    // 64K，只做简单循环的任务，例如accepter
+    MEDIUM,   // 256K
+    LARGE     // 4M，调用链很深的任务，例如数据库、TLS
+};
+
+// 调度的优先级，调度器按权重在各级的队列之间轮流取（见SchedulerOption::priorityWeights），低的也能按比例运行
+enum class FiberPriority : uint8_t {
+    HIGH,    // 要求延迟的任务，例如接受连接、健康检查
+    NORMAL,
+    LOW      // 批量的任务，例如大文件传输、慢查询
+};
+
+// 创建协程时的选项
+struct FiberOption {
+    FiberOption() = default;
+    FiberOption(StackClass cls):stack_class(cls){}
+    FiberOption(FiberPriority p):priority(p){}
+
+    StackMode stack_mode = StackMode::DEDICATED;
+    StackClass stack_class = StackClass::DEFAULT;
+    FiberPriority priority = FiberPriority::NORMAL;
+    const char* name = nullptr; // 任务入口的名字，用于栈用量统计，需要是静态字符串；为空时使用函数类型名
+};
+
+// 可以作为addTask等第一个参数的选项类型
+template <typename T>
+using IsFiberOption = std::integral_constant<bool,
+    std::is_same<typename std::decay<T>::type, FiberOption>::value ||
+    std::is_same<typename std::decay<T>::type, StackClass>::value ||
+    std::is_same<typename std::decay<T>::type, FiberPriority>::value>;
+
 // start() init -> exec
 // resume() ready -> exec
 // yield() exec -> hold
@@ -40,119 +91,345 @@ enum class FiberState {
 
 
 
-class Fiber: public std::enable_shared_from_this<Fiber>{
+class Fiber;
+
+// 协程的侵入式引用计数指针
+// 计数直接放在Fiber对象里，不需要shared_ptr的控制块；计数归零时协程回到当前线程的对象池
+class FiberPtr {
 public:
-    using ptr = std::shared_ptr<Fiber>;
+    constexpr FiberPtr() = default;
+    constexpr FiberPtr(std::nullptr_t) {}
+    explicit FiberPtr(Fiber* fiber);
+    FiberPtr(const FiberPtr& other);
+    FiberPtr(FiberPtr&& other) noexcept : m_fiber(other.m_fiber) { other.m_fiber = nullptr; }
+    ~FiberPtr();
+    FiberPtr& operator=(FiberPtr other) noexcept {
+        std::swap(m_fiber, other.m_fiber);
+        return *this;
+    }
+
+    Fiber* get() const { return m_fiber; }
+    Fiber* operator->() const { return m_fiber; }
+    Fiber& operator*() const { return *m_fiber; }
+    explicit operator bool() const { return m_fiber != nullptr; }
+    void reset() { FiberPtr().swap(*this); }
+    void swap(FiberPtr& other) noexcept { std::swap(m_fiber, other.m_fiber); }
+    // 交出/接管一个引用而不改计数，给只能存裸指针的无锁队列用
+    Fiber* release() { Fiber* fiber = m_fiber; m_fiber = nullptr; return fiber; }
+    static FiberPtr Adopt(Fiber* fiber) { FiberPtr p; p.m_fiber = fiber; return p; }
+    bool operator==(const FiberPtr& other) const { return m_fiber == other.m_fiber; }
+    bool operator!=(const FiberPtr& other) const { return m_fiber != other.m_fiber; }
+
+private:
+    Fiber* m_fiber = nullptr;
+};
+
+class Fiber {
+public:
+    using ptr = FiberPtr;
     using Func = std::function<void()>;
+    // 任务和回调内联保存的大小，绑定的函数和参数超过这个大小才会分配堆内存
+    static const size_t TASK_INLINE_SIZE = 64;
 
     // 工厂函数
-    template <typename Fn, typename... Args>
+    template <typename Fn, typename... Args,
+              typename = typename std::enable_if<!IsFiberOption<Fn>::value>::type>
     static ptr Create(Fn&& task, Args&&... args);
     
-    //
     template <typename Fn, typename... Args>
+    static ptr Create(const FiberOption& option, Fn&& task, Args&&... args);
+    
+    //
+    template <typename Fn, typename... Args,
+              typename = typename std::enable_if<!IsFiberOption<Fn>::value>::type>
     Fiber(Fn&& task, Args&&... args); //子协程
+    template <typename Fn, typename... Args>
+    Fiber(const FiberOption& option, Fn&& task, Args&&... args); //指定选项的子协程
     Fiber(); // 主协程，也就是主要执行流
     // 析构函数
     ~Fiber();
 
     // 重用协程
-    template <typename Fn, typename... Args>
+    template <typename Fn, typename... Args,
+              typename = typename std::enable_if<!IsFiberOption<Fn>::value>::type>
     void reuse(Fn&& task, Args&&... args);
+    template <typename Fn, typename... Args>
+    void reuse(const FiberOption& option, Fn&& task, Args&&... args);
     // 启动协程
     void start();
     // 恢复协程执行
     void resume();
-    // 暂停协程执行
+    // 暂停协程执行，直接切换到nextfiber（对称切换），为空时回到主协程
     void yield(Fiber::ptr nextfiber);
 
     // 获取当前协程状态
     FiberState getState() const { return m_state; }
     uint64_t getID() const { return m_id; }
+    StackMode getStackMode() const { return m_shared ? StackMode::SHARED : StackMode::DEDICATED; }
     // 设置返回回调
     template <typename Fn, typename... Args>
     void setCallBack(Fn&& task, Args&&... args){
-        auto call_back_func = std::bind(
-            std::forward<Fn>(task), std::forward<Args>(args)...
-        );
-        call_back = call_back_func;
+        call_back.emplace(std::forward<Fn>(task), std::forward<Args>(args)...);
     }
 
+    // 每个线程对象池最多缓存的协程数量
+    static void SetPoolLimit(size_t limit) { s_pool_limit = limit; }
+    // 调整栈档位的大小，只影响之后创建或复用的协程
+    static void SetStackClassSize(StackClass cls, size_t size);
+    static size_t GetStackClassSize(StackClass cls);
+
     // 设置当前正在执行的协程
     static void SetThis(ptr co);
     static ptr GetThis();
+    // 当前是否运行在工作协程里（而不是线程的主执行流）
+    static bool InFiber();
+
+    // 调度器在工作线程上注册的钩子
+    struct Hooks {
+        void* arg = nullptr;
+        ptr (*pick_next)(void* arg) = nullptr;          // 协程结束时选择下一个要运行的协程
+        void (*on_hold)(void* arg, ptr fiber) = nullptr; // 挂起的协程完全切出之后调用
+        void (*on_term)(void* arg, ptr fiber) = nullptr; // 结束的协程切出之后调用，用于回收
+        void (*sleep_until)(void* arg, std::chrono::steady_clock::time_point t) = nullptr; // 挂起当前协程直到时间点
+        void (*on_busy)(void* arg, ptr fiber) = nullptr; // 共享栈被别的线程上的协程占着，没能切入，交回去稍后再运行
+    };
+    static void SetHooks(const Hooks& hooks);
+
+    // 睡眠：在调度器的工作协程里只挂起当前协程，由调度器的定时器唤醒；其他情况阻塞当前线程
+    static void sleepUntil(std::chrono::steady_clock::time_point t);
+    template <typename Rep, typename Period>
+    static void sleepFor(const std::chrono::duration<Rep, Period>& d) {
+        sleepUntil(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(d));
+    }
+
+    // 挂起/唤醒的握手，保证协程的上下文保存完之后才会被其他线程恢复
+    // park: 协程切出后调用，返回true表示切出之前已经被唤醒过，需要重新放入可运行队列
+    // notify: 唤醒方调用，返回true表示协程已经挂起，由唤醒方负责调度它
+    bool park();
+    bool notify();
+
+    // 截止时间和取消，挂起点（IOScheduler::wait、套接字读写、通道等）看到后提前返回
+    // 截止时间只由协程自己设置；取消可以在任意线程标记，唤醒由IOScheduler::interrupt负责
+    void setDeadline(std::chrono::steady_clock::time_point t) { m_deadline = t; }
+    void clearDeadline() { m_deadline = std::chrono::steady_clock::time_point::max(); }
+    std::chrono::steady_clock::time_point getDeadline() const { return m_deadline; }
+    void cancel() { m_cancelled.store(true, std::memory_order_release); }
+    bool isCancelled() const { return m_cancelled.load(std::memory_order_acquire); }
+    // 没有被打断返回0，否则返回ECANCELED或ETIMEDOUT
+    int interrupted() const;
+
+    // 调度器记录的所属工作线程，-1表示还没有分配；工作窃取模式下是下一次调度指定的线程，用过就清掉
+    int getWorker() const { return m_worker.load(std::memory_order_relaxed); }
+    void setWorker(int worker) { m_worker.store(worker, std::memory_order_relaxed); }
+    // 最近一次运行它的工作线程，-1表示还没有挂起过；调度器用来把唤醒的协程放回原来的线程
+    int getLastWorker() const { return m_last_worker.load(std::memory_order_relaxed); }
+    void setLastWorker(int worker) { m_last_worker.store(worker, std::memory_order_relaxed); }
+    // 调度的优先级，协程自己可以随时调整，下一次放入可运行队列时生效
+    FiberPriority getPriority() const { return m_priority.load(std::memory_order_relaxed); }
+    void setPriority(FiberPriority priority) { m_priority.store(priority, std::memory_order_relaxed); }
+    // 排在调度器的无锁收件箱（MpscQueue）里时指向下一个协程
+    Fiber* inboxNext = nullptr;
+    // 调度器记录的最近一次等待的fd，等待被打断时用来撤掉登记，只由协程自己读写
+    int getWaitFd() const { return m_wait_fd; }
+    void setWaitFd(int fd) { m_wait_fd = fd; }
 
 private:
+    friend class FiberPtr;
+    // 引用计数归零
+    static void Release(Fiber* fiber);
+    // 结束的协程清掉任务放回对象池，其余的直接释放
+    void recycle();
+    // 线程本地的对象池，线程退出时释放
+    // 协程常常在一个线程创建、在另一个线程结束，本地池满了就把一半整批交给全局池，本地池空了再整批取回
+    struct LocalPool {
+        std::vector<Fiber*> fibers;
+        LocalPool() { fibers.reserve(s_pool_limit); }
+        ~LocalPool();
+    };
+    struct GlobalPool {
+        std::mutex mutex;
+        std::vector<std::vector<Fiber*>> batches;
+    };
+    static LocalPool& GetLocalPool();
+    static GlobalPool& GetGlobalPool();
+    static size_t s_pool_limit;
+    static const size_t GLOBAL_POOL_BATCHES = 16; // 全局池最多缓存的批数
+
     // 协程入口函数,使用指针操作兼容C函数
     static void mainFunc(Fiber* fiber);
+    // 按选项准备栈
+    void setupStack(const FiberOption& option);
+    // 结束时记录这次运行的栈用量
+    void profileStack();
+    // 从主协程切换进来
+    void switchIn();
+    // 切换到next，不能直接切换时经由主协程
+    void transferTo(ptr next);
+    // 共享栈协程切入前占用共享栈并拷回保存的内容，共享栈被占用、协程交回调度器时返回false
+    bool acquireStack();
+    // 所有切换都经过这里：记录被切出的协程，切回来后处理它
+    static void switchContext(Fiber* from, ptr to);
+    static void afterSwitch();
+    char* stackTop() const { return m_shared ? m_shared->stack.top() : m_stack.top(); }
 
 private:
     uint64_t m_id = 0;
+    std::atomic<uint32_t> m_ref {0}; // 引用计数，由FiberPtr维护
     // =======内部执行相关=========
     // static size_t m_stack_size;
     static size_t m_stack_size;
     FiberState m_state = FiberState::INIT;
-    Context m_ctx;
-    char* m_stack = nullptr;
-    Func m_task;
+    enum ParkState : uint8_t { RUNNING, PARKED, NOTIFIED };
+    std::atomic<uint8_t> m_park {RUNNING};
+    std::chrono::steady_clock::time_point m_deadline = std::chrono::steady_clock::time_point::max();
+    std::atomic<bool> m_cancelled {false};
+    std::atomic<int> m_worker {-1}; // 可能由其他线程在唤醒前设置
+    std::atomic<int> m_last_worker {-1};
+    std::atomic<FiberPriority> m_priority {FiberPriority::NORMAL};
+    int m_wait_fd = -1;
+    Context m_ctx{};
+    FiberStack m_stack; // 由StackAllocator分配，带保护页
+    const char* m_entry = nullptr; // 任务入口，栈用量按它统计
+    bool m_painted = false;        // 栈上除了m_dirty以外都是统计用的图案
+    size_t m_dirty = 0;            // 从栈顶算起需要重涂的字节数
+    // =======共享栈相关=========
+    SharedStack* m_shared = nullptr; // 非空表示SHARED模式
+    std::vector<char> m_save_buf;    // 挂起时保存的栈内容
+    size_t m_save_size = 0;
+    InlineTask<TASK_INLINE_SIZE> m_task;
     // =======返回相关============
     std::string error_; // 错误信息
-    Func call_back; // 结束后的回调
+    InlineTask<TASK_INLINE_SIZE> call_back; // 结束后的回调
     
 };    
 
 static std::atomic<uint64_t> s_Fiber_id {0};
 size_t Fiber::m_stack_size = 1024*1024;
+size_t Fiber::s_pool_limit = 256;
+static size_t s_stack_class_size[] = {0, 64 * 1024, 256 * 1024, 4 * 1024 * 1024}; // DEFAULT使用m_stack_size
 
-thread_local std::shared_ptr<Fiber> currentFiber = nullptr;  // 代表当前正在执行的协程
-thread_local std::shared_ptr<Fiber> mainFiber = nullptr;
+void Fiber::SetStackClassSize(StackClass cls, size_t size) {
+    if (cls == StackClass::DEFAULT) m_stack_size = size;
+    else s_stack_class_size[static_cast<int>(cls)] = size;
+}
+
+size_t Fiber::GetStackClassSize(StackClass cls) {
+    if (cls == StackClass::DEFAULT) return m_stack_size;
+    return s_stack_class_size[static_cast<int>(cls)];
+}
+
+thread_local Fiber::ptr currentFiber = nullptr;  // 代表当前正在执行的协程
+thread_local Fiber::ptr mainFiber = nullptr;
+thread_local Fiber::ptr prevFiber = nullptr;     // 刚被切出的协程，切换期间保持它存活
+thread_local Fiber::ptr handoffFiber = nullptr;  // 需要主协程代为切入的协程（共享栈）
+thread_local Fiber::Hooks fiberHooks;
+// 线程局部对象池是否已经析构，线程退出时晚于它析构的协程直接释放
+static thread_local bool t_fiber_pool_dead = false;
+
+FiberPtr::FiberPtr(Fiber* fiber):m_fiber(fiber) {
+    if (m_fiber) m_fiber->m_ref.fetch_add(1, std::memory_order_relaxed);
+}
+
+FiberPtr::FiberPtr(const FiberPtr& other):m_fiber(other.m_fiber) {
+    if (m_fiber) m_fiber->m_ref.fetch_add(1, std::memory_order_relaxed);
+}
+
+FiberPtr::~FiberPtr() {
+    if (m_fiber) Fiber::Release(m_fiber);
+}
 
 // 主协程
 // 计数不加
-Fiber::Fiber(): m_stack(nullptr){
+Fiber::Fiber(){
     m_state = FiberState::EXEC;
-    m_ctx.firstIn = 0;
 }
 
 
 // 工作协程,接收工作函数和参数
+template <typename Fn, typename... Args, typename>
+Fiber::Fiber(Fn&& intask, Args&&... args)
+    :Fiber(FiberOption(), std::forward<Fn>(intask), std::forward<Args>(args)...){
+}
+
 template <typename Fn, typename... Args>
-Fiber::Fiber(Fn&& intask, Args&&... args):m_id(++s_Fiber_id){
+Fiber::Fiber(const FiberOption& option, Fn&& intask, Args&&... args):m_id(++s_Fiber_id){
     
-    m_stack = new char[m_stack_size]; //分配栈空间
+    setupStack(option); //分配栈空间
+    m_entry = option.name ? option.name : typeid(typename std::decay<Fn>::type).name();
 
-    // 包装工作函数
-    auto myfunc = std::bind(
-        std::forward<Fn>(intask), std::forward<Args>(args)...
-    );
-    m_task = myfunc;
+    // 工作函数和参数直接保存在协程对象里
+    m_task.emplace(std::forward<Fn>(intask), std::forward<Args>(args)...);
     // ctx_save(&m_ctx);
 
-    m_ctx.funcPtr = reinterpret_cast<void*>(&Fiber::mainFunc);
-    m_ctx.firstIn = (void*)1;
-    m_ctx.ptr = this;
-
-    m_ctx.rsp = m_stack + m_stack_size - sizeof(void*);
+    ctx_make(m_ctx, reinterpret_cast<void*>(&Fiber::mainFunc), this, stackTop());
     m_state = FiberState::READY; //就绪
 }
 
+// 独占栈从分配器取；共享栈绑定一个共享栈，之后一直在它上面运行
+void Fiber::setupStack(const FiberOption& option) {
+    m_park.store(RUNNING, std::memory_order_relaxed);
+    clearDeadline();
+    m_cancelled.store(false, std::memory_order_relaxed);
+    m_worker.store(-1, std::memory_order_relaxed);
+    m_last_worker.store(-1, std::memory_order_relaxed);
+    m_priority.store(option.priority, std::memory_order_relaxed);
+    m_wait_fd = -1;
+    if (option.stack_mode == StackMode::SHARED) {
+        if (m_stack) StackAllocator::Free(m_stack);
+        if (!m_shared) m_shared = SharedStackPool::Pick();
+    }
+    else {
+        m_shared = nullptr;
+        // 复用时档位不同就换一个栈
+        const size_t page = StackAllocator::PageSize();
+        size_t size = (GetStackClassSize(option.stack_class) + page - 1) / page * page;
+        if (m_stack && m_stack.size != size) StackAllocator::Free(m_stack);
+        if (!m_stack) {
+            m_stack = StackAllocator::Alloc(size);
+            m_painted = false;
+        }
+        #ifdef MJBER_ASAN
+        // 复用的栈上还留着上一次运行的栈帧标记
+        ASAN_UNPOISON_MEMORY_REGION(m_stack.base, m_stack.size);
+        #endif
+        if (StackProfiler::Enabled()) {
+            StackProfiler::Paint(m_stack, m_painted ? m_dirty : m_stack.size);
+            m_painted = true;
+            m_dirty = 0;
+        }
+        else {
+            m_painted = false;
+        }
+    }
+    m_save_size = 0;
+}
+
+void Fiber::profileStack() {
+    if (!m_painted || !m_stack) return;
+    size_t used = StackProfiler::Measure(m_stack);
+    m_dirty = used;
+    StackProfiler::Record(m_entry, used, m_stack.size);
+}
+
 Fiber::~Fiber() {
-    if(!m_stack) delete[] m_stack;
+    StackAllocator::Free(m_stack);
 }
 
-template <typename Fn, typename... Args>
+template <typename Fn, typename... Args, typename>
 void Fiber::reuse(Fn&& intask, Args&&... args) {
-    // 包装函数
-    auto myfunc = std::bind(
-        std::forward<Fn>(intask), std::forward<Args>(args)...
-    );
-    m_task = myfunc;
-
-    m_ctx.funcPtr = reinterpret_cast<void*>(&Fiber::mainFunc);
-    m_ctx.firstIn = (void*)1;
-    m_ctx.ptr = this;
+    reuse(FiberOption(), std::forward<Fn>(intask), std::forward<Args>(args)...);
+}
 
-    m_ctx.rsp = m_stack + m_stack_size - sizeof(void*);
+template <typename Fn, typename... Args>
+void Fiber::reuse(const FiberOption& option, Fn&& intask, Args&&... args) {
+    // 重新分配id，上一次运行残留的事件不会再对应到这个协程
+    m_id = ++s_Fiber_id;
+    setupStack(option);
+    m_entry = option.name ? option.name : typeid(typename std::decay<Fn>::type).name();
+    error_.clear();
+    m_task.emplace(std::forward<Fn>(intask), std::forward<Args>(args)...);
+
+    ctx_make(m_ctx, reinterpret_cast<void*>(&Fiber::mainFunc), this, stackTop());
     m_state = FiberState::READY; //就绪
 }
 
@@ -161,17 +438,86 @@ void Fiber::reuse(Fn&& intask, Args&&... args) {
 
 
 // 工厂函数
-template <typename Fn, typename... Args>
+template <typename Fn, typename... Args, typename>
 Fiber::ptr Fiber::Create(Fn&& intask, Args&&... args){
+    return Create(FiberOption(), std::forward<Fn>(intask), std::forward<Args>(args)...);
+}
 
+// 优先从当前线程的对象池取，池空时才新建
+template <typename Fn, typename... Args>
+Fiber::ptr Fiber::Create(const FiberOption& option, Fn&& intask, Args&&... args){
     // 主协程懒加载
     if (mainFiber==nullptr) {
-        mainFiber = std::make_shared<Fiber>();
-        // // 主协程首次需要保存上下文
-        // ctx_save(&(mainFiber->m_ctx));
+        mainFiber = ptr(new Fiber());
+    }
+    auto& pool = GetLocalPool();
+    if (pool.fibers.empty()) {
+        auto& global = GetGlobalPool();
+        std::lock_guard<std::mutex> lock(global.mutex);
+        if (!global.batches.empty()) {
+            pool.fibers.swap(global.batches.back());
+            global.batches.pop_back();
+        }
     }
-    auto temp = std::make_shared<Fiber>(std::forward<Fn>(intask), std::forward<Args>(args)...);
-    return temp;
+    if (!pool.fibers.empty()) {
+        ptr fiber(pool.fibers.back());
+        pool.fibers.pop_back();
+        fiber->reuse(option, std::forward<Fn>(intask), std::forward<Args>(args)...);
+        return fiber;
+    }
+    return ptr(new Fiber(option, std::forward<Fn>(intask), std::forward<Args>(args)...));
+}
+
+Fiber::LocalPool& Fiber::GetLocalPool() {
+    static thread_local LocalPool pool;
+    return pool;
+}
+
+Fiber::GlobalPool& Fiber::GetGlobalPool() {
+    static GlobalPool pool;
+    return pool;
+}
+
+Fiber::LocalPool::~LocalPool() {
+    t_fiber_pool_dead = true;
+    for (auto fiber : fibers) {
+        delete fiber;
+    }
+}
+
+void Fiber::Release(Fiber* fiber) {
+    if (fiber->m_ref.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        fiber->recycle();
+    }
+}
+
+// 挂起中被丢弃的协程栈上还有活着的栈帧，不能复用
+void Fiber::recycle() {
+    m_task.reset();
+    call_back.reset();
+    bool finished = m_state == FiberState::TERM || m_state == FiberState::ERROR;
+    if (finished && (m_stack || m_shared) && !t_fiber_pool_dead) {
+        auto& pool = GetLocalPool();
+        if (pool.fibers.size() >= s_pool_limit && s_pool_limit >= 2) {
+            // 后一半整批交给全局池
+            std::vector<Fiber*> batch(pool.fibers.begin() + s_pool_limit / 2, pool.fibers.end());
+            pool.fibers.resize(s_pool_limit / 2);
+            auto& global = GetGlobalPool();
+            std::unique_lock<std::mutex> lock(global.mutex);
+            if (global.batches.size() < GLOBAL_POOL_BATCHES) {
+                global.batches.push_back(std::move(batch));
+            }
+            else {
+                lock.unlock();
+                for (auto fiber : batch) delete fiber;
+            }
+        }
+        if (pool.fibers.size() < s_pool_limit) {
+            pool.fibers.push_back(this);
+            return;
+        }
+    }
+    delete this;
 }
 
 
@@ -179,29 +525,151 @@ Fiber::ptr Fiber::Create(Fn&& intask, Args&&... args){
 // 由主执行流执行
 void Fiber::start() {
     // 检查当前线程是否有对应的主协程
-    if(mainFiber==nullptr) mainFiber=std::make_shared<Fiber>(); 
-    m_state = FiberState::EXEC;
-    SetThis(shared_from_this());
+    if(mainFiber==nullptr) mainFiber=ptr(new Fiber()); 
     // 转到工作流
-    ctx_swap(&(mainFiber->m_ctx),&(m_ctx));
+    switchIn();
 }
 
-// 恢复工作协程执行
+// 恢复工作协程执行，就绪的协程也从这里启动
 // 由主执行流执行
 void Fiber::resume() {
     // 检查当前线程是否有对应的主协程
-    if(mainFiber==nullptr) mainFiber=std::make_shared<Fiber>(); 
-    if (m_state != FiberState::HOLD) {
+    if(mainFiber==nullptr) mainFiber=ptr(new Fiber()); 
+    if (m_state != FiberState::HOLD && m_state != FiberState::READY) {
         return;
     }
-    m_state = FiberState::EXEC;
 
     // 回到工作协程上下文
-    SetThis(shared_from_this());
-    ctx_swap(&(mainFiber->m_ctx),&(m_ctx));
+    switchIn();
+}
+
+// 共享栈被占用、协程已经交回调度器时不切入，状态保持不变
+void Fiber::switchIn() {
+    if (!acquireStack()) return;
+    m_state = FiberState::EXEC;
+    switchContext(mainFiber.get(), ptr(this));
+    // 回到主协程，代为切入需要经过主协程的协程
+    while (handoffFiber) {
+        ptr next = std::move(handoffFiber);
+        if (!next->acquireStack()) continue;
+        next->m_state = FiberState::EXEC;
+        switchContext(mainFiber.get(), std::move(next));
+    }
 }
 
-// 暂停工作协程执行,回到下一个协程
+// 共享栈：切入前占用共享栈并拷回上次保存的内容
+// 共享栈正被别的线程上的协程使用时，有调度器就通过on_busy把协程交回去并返回false，不在这里空等；
+// 没有调度器时只能等占用者挂起
+// 只能在不处于该共享栈上的执行流里调用
+bool Fiber::acquireStack() {
+    if (!m_shared) return true;
+    if (!m_shared->tryLock()) {
+        if (fiberHooks.on_busy) {
+            fiberHooks.on_busy(fiberHooks.arg, ptr(this));
+            return false;
+        }
+        m_shared->lock();
+    }
+    if (m_save_size > 0) {
+        #ifdef MJBER_ASAN
+        // 共享栈上还是上一个占用者栈帧的红区标记
+        ASAN_UNPOISON_MEMORY_REGION(stackTop() - m_save_size, m_save_size);
+        #endif
+        memcpy(stackTop() - m_save_size, m_save_buf.data(), m_save_size);
+    }
+    return true;
+}
+
+// 先让prevFiber接住被切出的协程，再把currentFiber换成目标
+// 结束的协程不会再回到自己的栈帧，栈上不能留引用，否则永远不会释放
+void Fiber::switchContext(Fiber* from, ptr to) {
+    prevFiber = ptr(from);
+    Fiber* target = to.get();
+    SetThis(std::move(to));
+    ctx_swap(&(from->m_ctx),&(target->m_ctx));
+    afterSwitch();
+}
+
+// 切换完成后，在新的执行流里处理被切出的协程
+// 共享栈协程挂起时把[rsp, top)拷到保存区再释放共享栈；结束的协程交给调度器回收
+void Fiber::afterSwitch() {
+    if (!prevFiber) return;
+    ptr prev = std::move(prevFiber);
+    if (prev->m_shared) {
+        if (prev->m_state == FiberState::HOLD) {
+            prev->m_save_size = prev->stackTop() - static_cast<char*>(prev->m_ctx.rsp);
+            // 保存区按实际用量分配，明显偏大时收缩
+            if (prev->m_save_buf.size() < prev->m_save_size || prev->m_save_buf.size() > 4 * prev->m_save_size + 4096) {
+                std::vector<char>(prev->m_save_size).swap(prev->m_save_buf);
+            }
+            #ifdef MJBER_ASAN
+            // 拷走的是整段栈帧，包括ASan的红区
+            ASAN_UNPOISON_MEMORY_REGION(prev->m_ctx.rsp, prev->m_save_size);
+            #endif
+            memcpy(prev->m_save_buf.data(), prev->m_ctx.rsp, prev->m_save_size);
+        }
+        else {
+            prev->m_save_size = 0;
+        }
+        prev->m_shared->unlock();
+    }
+    if (prev->m_state == FiberState::HOLD) {
+        if (fiberHooks.on_hold) fiberHooks.on_hold(fiberHooks.arg, std::move(prev));
+    }
+    else if (prev->m_state == FiberState::TERM || prev->m_state == FiberState::ERROR) {
+        prev->profileStack();
+        if (fiberHooks.on_term) fiberHooks.on_term(fiberHooks.arg, std::move(prev));
+    }
+}
+
+bool Fiber::park() {
+    uint8_t expect = RUNNING;
+    if (m_park.compare_exchange_strong(expect, PARKED, std::memory_order_acq_rel)) {
+        return false;
+    }
+    // 挂起之前已经被唤醒
+    m_park.store(RUNNING, std::memory_order_relaxed);
+    return true;
+}
+
+bool Fiber::notify() {
+    uint8_t cur = m_park.load(std::memory_order_acquire);
+    while (true) {
+        if (cur == PARKED) {
+            if (m_park.compare_exchange_weak(cur, RUNNING, std::memory_order_acq_rel)) return true;
+        }
+        else if (cur == RUNNING) {
+            if (m_park.compare_exchange_weak(cur, NOTIFIED, std::memory_order_acq_rel)) return false;
+        }
+        else {
+            return false;
+        }
+    }
+}
+
+int Fiber::interrupted() const {
+    if (isCancelled()) return ECANCELED;
+    if (m_deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= m_deadline) {
+        return ETIMEDOUT;
+    }
+    return 0;
+}
+
+// 切换到下一个协程
+// 目标在共享栈上时，当前执行流可能就在同一个共享栈上，交给主协程切入
+void Fiber::transferTo(ptr next) {
+    if (next && (next->m_state == FiberState::HOLD || next->m_state == FiberState::READY)) {
+        if (!next->m_shared) {
+            next->m_state = FiberState::EXEC;
+            switchContext(this, std::move(next));
+            return;
+        }
+        handoffFiber = std::move(next);
+    }
+    switchContext(this, mainFiber);
+}
+
+// 暂停工作协程执行,切到下一个协程
 // 如果没有则回到主协程
 // 由工作协程执行流执行
 void Fiber::yield(Fiber::ptr nextfiber=nullptr) {
@@ -209,17 +677,13 @@ void Fiber::yield(Fiber::ptr nextfiber=nullptr) {
         return;
     }
     m_state = FiberState::HOLD;
-    if(nextfiber){
-        ctx_swap(&m_ctx,&(nextfiber->m_ctx));
-    }
-    else{
-        SetThis(mainFiber);
-        ctx_swap(&m_ctx,&(mainFiber->m_ctx));
-    }
+    transferTo(std::move(nextfiber));
 }
 
 // 协程的工作函数，添加出错处理
+// 出错和正常结束都会执行回调，然后切到调度器给出的下一个协程
 void Fiber::mainFunc(Fiber* fiber) {
+    afterSwitch();
     try
     {
         if (fiber->m_task) {
@@ -231,20 +695,36 @@ void Fiber::mainFunc(Fiber* fiber) {
         LOG_STREAM<<"Fiber " <<std::to_string(fiber->m_id)<< "failed: "<<e.what()<<ERRORLOG;
         fiber->m_state = FiberState::ERROR;
         fiber->error_ = e.what();
-        ctx_swap(&(fiber->m_ctx),&(mainFiber->m_ctx));
     }
     
     if (fiber->call_back){
         fiber->call_back();
     }
-    fiber->m_state = FiberState::TERM;
-    ctx_swap(&(fiber->m_ctx),&(mainFiber->m_ctx));
+    if (fiber->m_state != FiberState::ERROR) fiber->m_state = FiberState::TERM;
+    ptr next = fiberHooks.pick_next ? fiberHooks.pick_next(fiberHooks.arg) : nullptr;
+    fiber->transferTo(std::move(next));
+}
+
+void Fiber::SetHooks(const Hooks& hooks) {
+    fiberHooks = hooks;
+}
+
+void Fiber::sleepUntil(std::chrono::steady_clock::time_point t) {
+    if (InFiber() && fiberHooks.sleep_until) {
+        fiberHooks.sleep_until(fiberHooks.arg, t);
+    }
+    else {
+        std::this_thread::sleep_until(t);
+    }
 }
 
 // 设置当前线程的工作协程
 void Fiber::SetThis(ptr co) {
     currentFiber = co;
 }
+bool Fiber::InFiber() {
+    return currentFiber && currentFiber != mainFiber;
+}
 // 得到当前线程的工作协程
 Fiber::ptr Fiber::GetThis(){
     if(currentFiber) return currentFiber;
@@ -0,0 +1,499 @@
+#ifndef FIBER_SYNC
+#define FIBER_SYNC
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <thread>
+#include <chrono>
+
+#include "fiber.h"
+#include "scheduler.h"
+
+/*
+    协程同步原语
+    std::mutex、RWMutex在等待时会阻塞整个工作线程，线程上排队的其他协程也跟着停住；
+    这里的原语等待时只挂起当前协程，把线程还给调度器，被唤醒时重新放回可运行队列
+        FiberMutex              互斥锁
+        FiberConditionVariable  条件变量
+        FiberSemaphore          计数信号量
+        FiberRWMutex            读写锁，写者优先
+    加锁先用原子操作尝试并自旋一小段时间，拿不到再挂起
+    不在协程里（普通线程、工作线程的主执行流）调用时退化为阻塞线程，所以可以在协程和普通线程之间共用
+    lock/acquire/wait不会被打断；带超时的版本（try_lock_for、wait_for等）也受协程的截止时间和取消影响
+*/
+
+namespace fiber_sync_detail {
+
+using ::cpuRelax;
+
+static const int SPIN_COUNT = 64;
+
+struct Waiter;
+
+// 等待队列里的一个节点；普通等待者只有一个节点，select同时挂在多个队列上，每个队列一个节点
+struct WaitNode {
+    Waiter* waiter = nullptr;
+    WaitNode* prev = nullptr;
+    WaitNode* next = nullptr;
+    bool queued = false; // 受所在队列的锁保护
+};
+
+/*
+    一个等待者
+    协程等待者记下协程和它的调度器，唤醒时交给调度器；线程等待者用条件变量阻塞
+    等待者放在等待方的栈上；共享栈协程挂起时栈内容会被拷走，所以改为堆上分配
+    claimed保证只被唤醒一次（挂在多个队列上时谁先抢到谁唤醒）；
+    pending是已经出队、还没有用完这个等待者的唤醒方，析构前要等它归零
+*/
+struct Waiter {
+    Fiber::ptr fiber;
+    IOScheduler* scheduler = nullptr;
+    bool inFiber = false; // fiber会被唤醒方移走，等待方只看这个
+    std::atomic<bool> signaled {false};
+    std::atomic<bool> claimed {false};
+    std::atomic<int> pending {0};
+    std::mutex mutex;
+    std::condition_variable cond;
+    WaitNode node;
+
+    Waiter() {
+        node.waiter = this;
+        if (Fiber::InFiber()) {
+            scheduler = IOScheduler::GetThis();
+            if (scheduler) fiber = Fiber::GetThis();
+        }
+        inFiber = static_cast<bool>(fiber);
+    }
+    ~Waiter() {
+        for (int i = 0; pending.load(std::memory_order_acquire) != 0; ++i) {
+            if (i < SPIN_COUNT) cpuRelax();
+            else std::this_thread::yield();
+        }
+    }
+
+    // 等到被唤醒，协程可能被无关的IO事件提前唤醒，所以要循环检查
+    void wait() {
+        if (inFiber) {
+            while (!signaled.load(std::memory_order_acquire)) {
+                scheduler->suspend();
+            }
+        }
+        else {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return signaled.load(std::memory_order_acquire); });
+        }
+    }
+    // 可打断的等待：到期，或者协程到了截止时间、被取消时返回false
+    bool waitUntil(std::chrono::steady_clock::time_point deadline) {
+        if (inFiber) {
+            while (!signaled.load(std::memory_order_acquire)) {
+                if (!scheduler->waitUntil(deadline)) return signaled.load(std::memory_order_acquire);
+            }
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        return cond.wait_until(lock, deadline, [this] { return signaled.load(std::memory_order_acquire); });
+    }
+
+    // 返回false表示已经被别人唤醒过
+    // 唤醒之后等待方随时可能返回，所以先把要用的东西取出来
+    bool notify() {
+        if (claimed.exchange(true, std::memory_order_acq_rel)) return false;
+        if (inFiber) {
+            Fiber::ptr f = std::move(fiber);
+            IOScheduler* s = scheduler;
+            signaled.store(true, std::memory_order_release);
+            s->wakeup(std::move(f));
+        }
+        else {
+            std::lock_guard<std::mutex> lock(mutex);
+            signaled.store(true, std::memory_order_release);
+            cond.notify_one();
+        }
+        return true;
+    }
+};
+
+// 在当前执行流里放一个等待者
+class WaiterHolder {
+public:
+    WaiterHolder() {
+        if (Fiber::InFiber() && Fiber::GetThis()->getStackMode() == StackMode::SHARED) {
+            m_heap.reset(new Waiter());
+            m_waiter = m_heap.get();
+        }
+        else {
+            m_waiter = &m_local;
+        }
+    }
+    Waiter* get() { return m_waiter; }
+private:
+    Waiter m_local;
+    std::unique_ptr<Waiter> m_heap;
+    Waiter* m_waiter;
+};
+
+/*
+    等待队列
+    parkUntil(try_acquire)：在队列锁下先尝试一次，失败才入队挂起，被唤醒后重试；
+    try_acquire在队列锁下执行，里面不能再去碰别的等待队列
+    waiting_计数在尝试之前就加上，唤醒方先改状态再看计数，两边之间都有seq_cst栅栏，
+    所以唤醒方要么看到等待者，要么等待者的尝试能看到新状态，不会丢失唤醒；没有等待者时唤醒不用加锁
+*/
+class WaitQueue {
+public:
+    template <typename TryFn>
+    void parkUntil(TryFn&& try_acquire) {
+        while (true) {
+            WaiterHolder holder;
+            Waiter* waiter = holder.get();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                waiting_.fetch_add(1, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (try_acquire()) {
+                    waiting_.fetch_sub(1, std::memory_order_relaxed);
+                    return;
+                }
+                push(&waiter->node);
+            }
+            waiter->wait();
+        }
+    }
+    // 可打断的版本：到期，或者协程到了截止时间、被取消时返回false
+    template <typename TryFn>
+    bool parkUntil(TryFn&& try_acquire, std::chrono::steady_clock::time_point deadline) {
+        while (true) {
+            WaiterHolder holder;
+            Waiter* waiter = holder.get();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                waiting_.fetch_add(1, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (try_acquire()) {
+                    waiting_.fetch_sub(1, std::memory_order_relaxed);
+                    return true;
+                }
+                push(&waiter->node);
+            }
+            if (!waiter->waitUntil(deadline)) {
+                abandon(waiter);
+                return false;
+            }
+        }
+    }
+    // 返回是否唤醒了等待者；已经被别的队列唤醒的等待者跳过
+    bool notifyOne() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting_.load(std::memory_order_seq_cst) == 0) return false;
+        while (true) {
+            Waiter* waiter;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                WaitNode* node = pop();
+                if (!node) return false;
+                waiter = node->waiter;
+                waiter->pending.fetch_add(1, std::memory_order_relaxed);
+            }
+            bool woken = waiter->notify();
+            waiter->pending.fetch_sub(1, std::memory_order_release);
+            if (woken) return true;
+        }
+    }
+    void notifyAll() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting_.load(std::memory_order_seq_cst) == 0) return;
+        WaitNode* list;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            list = head_;
+            for (WaitNode* n = head_; n; n = n->next) {
+                n->queued = false;
+                n->waiter->pending.fetch_add(1, std::memory_order_relaxed);
+                waiting_.fetch_sub(1, std::memory_order_relaxed);
+            }
+            head_ = tail_ = nullptr;
+        }
+        while (list) {
+            WaitNode* next = list->next; // notify之后节点可能失效
+            Waiter* waiter = list->waiter;
+            waiter->notify();
+            waiter->pending.fetch_sub(1, std::memory_order_release);
+            list = next;
+        }
+    }
+    // 入队但不在这里挂起，给条件变量和select用：入队之后再检查条件或释放外面的锁
+    void enqueue(WaitNode* node) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        waiting_.fetch_add(1, std::memory_order_seq_cst);
+        push(node);
+    }
+    void enqueue(Waiter* waiter) { enqueue(&waiter->node); }
+    // 等待被打断后放弃：摘掉节点；如果同时已经被唤醒，把这次唤醒转给下一个等待者
+    void abandon(Waiter* waiter) {
+        remove(&waiter->node);
+        if (waiter->claimed.exchange(true, std::memory_order_acq_rel)) notifyOne();
+    }
+    // 把还没被唤醒的节点摘掉，已经出队的不用管
+    void remove(WaitNode* node) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!node->queued) return;
+        if (node->prev) node->prev->next = node->next;
+        else head_ = node->next;
+        if (node->next) node->next->prev = node->prev;
+        else tail_ = node->prev;
+        node->queued = false;
+        waiting_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+private:
+    void push(WaitNode* node) {
+        node->next = nullptr;
+        node->prev = tail_;
+        node->queued = true;
+        if (tail_) tail_->next = node;
+        else head_ = node;
+        tail_ = node;
+    }
+    WaitNode* pop() {
+        WaitNode* node = head_;
+        if (node) {
+            head_ = node->next;
+            if (head_) head_->prev = nullptr;
+            else tail_ = nullptr;
+            node->queued = false;
+            waiting_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return node;
+    }
+
+    std::mutex mutex_; // 只保护队列本身，持有时间很短
+    std::atomic<size_t> waiting_ {0};
+    WaitNode* head_ = nullptr;
+    WaitNode* tail_ = nullptr;
+};
+
+} // namespace fiber_sync_detail
+
+
+// 互斥锁，满足BasicLockable，可以配合std::lock_guard/std::unique_lock使用
+class FiberMutex {
+public:
+    FiberMutex() = default;
+    FiberMutex(const FiberMutex&) = delete;
+    FiberMutex& operator=(const FiberMutex&) = delete;
+
+    bool try_lock() {
+        bool expect = false;
+        return m_locked.compare_exchange_strong(expect, true, std::memory_order_seq_cst);
+    }
+    void lock() {
+        if (try_lock()) return;
+        for (int i = 0; i < fiber_sync_detail::SPIN_COUNT; ++i) {
+            fiber_sync_detail::cpuRelax();
+            if (!m_locked.load(std::memory_order_relaxed) && try_lock()) return;
+        }
+        m_waiters.parkUntil([this] { return try_lock(); });
+    }
+    // 到期、协程到了截止时间或被取消时返回false
+    bool try_lock_until(std::chrono::steady_clock::time_point deadline) {
+        if (try_lock()) return true;
+        return m_waiters.parkUntil([this] { return try_lock(); }, deadline);
+    }
+    template <typename Rep, typename Period>
+    bool try_lock_for(const std::chrono::duration<Rep, Period>& timeout) {
+        return try_lock_until(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+    }
+    void unlock() {
+        m_locked.store(false, std::memory_order_seq_cst);
+        m_waiters.notifyOne();
+    }
+
+private:
+    std::atomic<bool> m_locked {false};
+    fiber_sync_detail::WaitQueue m_waiters;
+};
+
+// 条件变量，配合FiberMutex（或者std::unique_lock<FiberMutex>）使用
+class FiberConditionVariable {
+public:
+    FiberConditionVariable() = default;
+    FiberConditionVariable(const FiberConditionVariable&) = delete;
+    FiberConditionVariable& operator=(const FiberConditionVariable&) = delete;
+
+    // 先入队再释放锁，notify不会落在释放锁和挂起之间
+    template <typename Lock>
+    void wait(Lock& lock) {
+        fiber_sync_detail::WaiterHolder holder;
+        m_waiters.enqueue(holder.get());
+        lock.unlock();
+        holder.get()->wait();
+        lock.lock();
+    }
+    template <typename Lock, typename Predicate>
+    void wait(Lock& lock, Predicate pred) {
+        while (!pred()) wait(lock);
+    }
+    // 到期、协程到了截止时间或被取消时返回timeout
+    template <typename Lock>
+    std::cv_status wait_until(Lock& lock, std::chrono::steady_clock::time_point deadline) {
+        fiber_sync_detail::WaiterHolder holder;
+        m_waiters.enqueue(holder.get());
+        lock.unlock();
+        bool woken = holder.get()->waitUntil(deadline);
+        if (!woken) m_waiters.abandon(holder.get());
+        lock.lock();
+        return woken ? std::cv_status::no_timeout : std::cv_status::timeout;
+    }
+    template <typename Lock, typename Predicate>
+    bool wait_until(Lock& lock, std::chrono::steady_clock::time_point deadline, Predicate pred) {
+        while (!pred()) {
+            if (wait_until(lock, deadline) == std::cv_status::timeout) return pred();
+        }
+        return true;
+    }
+    template <typename Lock, typename Rep, typename Period>
+    std::cv_status wait_for(Lock& lock, const std::chrono::duration<Rep, Period>& timeout) {
+        return wait_until(lock, std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+    }
+    template <typename Lock, typename Rep, typename Period, typename Predicate>
+    bool wait_for(Lock& lock, const std::chrono::duration<Rep, Period>& timeout, Predicate pred) {
+        return wait_until(lock, std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout), std::move(pred));
+    }
+    void notify_one() { m_waiters.notifyOne(); }
+    void notify_all() { m_waiters.notifyAll(); }
+
+private:
+    fiber_sync_detail::WaitQueue m_waiters;
+};
+
+// 计数信号量
+class FiberSemaphore {
+public:
+    explicit FiberSemaphore(size_t count = 0):m_count(static_cast<long>(count)){}
+    FiberSemaphore(const FiberSemaphore&) = delete;
+    FiberSemaphore& operator=(const FiberSemaphore&) = delete;
+
+    bool try_acquire() {
+        long count = m_count.load(std::memory_order_relaxed);
+        while (count > 0) {
+            if (m_count.compare_exchange_weak(count, count - 1, std::memory_order_seq_cst)) return true;
+        }
+        return false;
+    }
+    void acquire() {
+        if (try_acquire()) return;
+        for (int i = 0; i < fiber_sync_detail::SPIN_COUNT; ++i) {
+            fiber_sync_detail::cpuRelax();
+            if (m_count.load(std::memory_order_relaxed) > 0 && try_acquire()) return;
+        }
+        m_waiters.parkUntil([this] { return try_acquire(); });
+    }
+    // 到期、协程到了截止时间或被取消时返回false
+    bool try_acquire_until(std::chrono::steady_clock::time_point deadline) {
+        if (try_acquire()) return true;
+        return m_waiters.parkUntil([this] { return try_acquire(); }, deadline);
+    }
+    template <typename Rep, typename Period>
+    bool try_acquire_for(const std::chrono::duration<Rep, Period>& timeout) {
+        return try_acquire_until(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+    }
+    void release(size_t n = 1) {
+        m_count.fetch_add(static_cast<long>(n), std::memory_order_seq_cst);
+        for (size_t i = 0; i < n; ++i) {
+            if (!m_waiters.notifyOne()) break;
+        }
+    }
+
+private:
+    std::atomic<long> m_count;
+    fiber_sync_detail::WaitQueue m_waiters;
+};
+
+/*
+    读写锁，写者优先：有写者在等时新的读者不再进入，避免写者饿死
+    m_state: -1表示写者持有，>=0表示读者数
+*/
+class FiberRWMutex {
+public:
+    // 守卫和RWMutex保持一致
+    class ReadLockGuard {
+    public:
+        explicit ReadLockGuard(FiberRWMutex& mtx) : mtx_(mtx) { mtx_.ReadLock(); }
+        ~ReadLockGuard() { mtx_.ReadUnlock(); }
+        ReadLockGuard(const ReadLockGuard&) = delete;
+        ReadLockGuard& operator=(const ReadLockGuard&) = delete;
+    private:
+        FiberRWMutex& mtx_;
+    };
+    class WriteLockGuard {
+    public:
+        explicit WriteLockGuard(FiberRWMutex& mtx) : mtx_(mtx) { mtx_.WriteLock(); }
+        ~WriteLockGuard() { mtx_.WriteUnlock(); }
+        WriteLockGuard(const WriteLockGuard&) = delete;
+        WriteLockGuard& operator=(const WriteLockGuard&) = delete;
+    private:
+        FiberRWMutex& mtx_;
+    };
+
+    FiberRWMutex() = default;
+    FiberRWMutex(const FiberRWMutex&) = delete;
+    FiberRWMutex& operator=(const FiberRWMutex&) = delete;
+
+    bool TryReadLock() {
+        long state = m_state.load(std::memory_order_relaxed);
+        while (state >= 0 && m_writersWaiting.load(std::memory_order_seq_cst) == 0) {
+            if (m_state.compare_exchange_weak(state, state + 1, std::memory_order_seq_cst)) return true;
+        }
+        return false;
+    }
+    bool TryWriteLock() {
+        long expect = 0;
+        return m_state.compare_exchange_strong(expect, WRITER, std::memory_order_seq_cst);
+    }
+
+    void ReadLock() {
+        for (int i = 0; i < fiber_sync_detail::SPIN_COUNT; ++i) {
+            if (TryReadLock()) return;
+            fiber_sync_detail::cpuRelax();
+        }
+        m_readers.parkUntil([this] { return TryReadLock(); });
+    }
+    void ReadUnlock() {
+        // 最后一个读者唤醒一个写者
+        if (m_state.fetch_sub(1, std::memory_order_seq_cst) == 1) {
+            m_writers.notifyOne();
+        }
+    }
+    void WriteLock() {
+        if (TryWriteLock()) return;
+        m_writersWaiting.fetch_add(1, std::memory_order_seq_cst);
+        for (int i = 0; i < fiber_sync_detail::SPIN_COUNT; ++i) {
+            fiber_sync_detail::cpuRelax();
+            if (TryWriteLock()) {
+                m_writersWaiting.fetch_sub(1, std::memory_order_seq_cst);
+                return;
+            }
+        }
+        m_writers.parkUntil([this] { return TryWriteLock(); });
+        m_writersWaiting.fetch_sub(1, std::memory_order_seq_cst);
+    }
+    // 优先交给下一个写者，没有写者等待时放行所有读者
+    void WriteUnlock() {
+        m_state.store(0, std::memory_order_seq_cst);
+        if (!m_writers.notifyOne()) {
+            m_readers.notifyAll();
+        }
+    }
+
+private:
+    static const long WRITER = -1;
+    std::atomic<long> m_state {0};
+    std::atomic<long> m_writersWaiting {0}; // 正在等待的写者，读者看到它就让路
+    fiber_sync_detail::WaitQueue m_writers;
+    fiber_sync_detail::WaitQueue m_readers;
+};
+
+#endif
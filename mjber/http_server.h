@@ -7,6 +7,9 @@
 #include <unordered_map>
 #include <map>
 #include <utility>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 
 #include "scheduler.h"
 #include "socket_wrapper.h"
@@ -144,23 +147,80 @@ class HttpServer{
 public:
     
     HttpServer(const std::string& addr,uint16_t port,int thread_num);
+    // 按选项创建调度器，例如多reactor模式、线程绑定CPU或NUMA节点；threads为0时不使用协程
+    // local为true时是单线程模式：setup()在调用线程上运行调度器，监听套接字带SO_REUSEPORT，可以多开几个进程监听同一个端口
+    HttpServer(const std::string& addr,uint16_t port,const SchedulerOption& option);
     ~HttpServer(){};
+    // 优雅停止的结果
+    struct DrainReport {
+        size_t drained = 0; // 开始停止时正在处理、之后正常写回了响应的请求
+        size_t aborted = 0; // 到期还没处理完、被取消的请求
+    };
     // 接口
-    int setup(); //启动
+    int setup(); //启动，协程模式下一直运行到shutdown完成才返回
     int setRoute(std::vector<std::pair<std::string,RouteHandler>> url_handlers); //设置路由
     void setDefaultHandler(RouteHandler);
+    // 处理连接的协程使用的栈档位，路由里有调用很深的处理（数据库、TLS等）时调大
+    void setWorkerStackClass(StackClass cls){ workerStack = cls; }
+    // 每个请求的截止时间，从开始等待请求算起，包括读请求、处理和写回；超时的连接直接断开，0表示不限
+    void setRequestTimeout(std::chrono::milliseconds timeout){ requestTimeout = timeout; }
+    // 处理连接的协程的优先级，每个请求开始时恢复成这个值；
+    // 路由里可以用Fiber::GetThis()->setPriority调整当前请求（包括写回响应）的优先级，例如大文件降成LOW
+    void setWorkerPriority(FiberPriority priority){ workerPriority = priority; }
+    // 优雅停止（只支持协程模式），在调度器以外的线程调用一次，例如等信号的线程：
+    // 关闭监听套接字不再接受连接，空闲的连接直接断开，正在处理的请求写回响应后断开；
+    // timeout到期还没处理完的请求被取消，然后停掉调度器的所有线程，setup()返回
+    DrainReport shutdown(std::chrono::milliseconds timeout);
 private:
+    // 处理中的连接，停止时按状态断开
+    struct Connection {
+        CancelToken token;
+        bool busy = false;    // 正在处理请求
+        bool aborted = false; // 停止时到期被取消
+    };
+    // worker在整个生命周期里持有，登记和注销连接
+    class ConnectionGuard {
+    public:
+        explicit ConnectionGuard(HttpServer* server);
+        ~ConnectionGuard();
+        bool accepted() const { return m_accepted; }
+    private:
+        HttpServer* m_server;
+        bool m_accepted = false;
+    };
+    bool beginRequest(); // 收到了完整的请求，停止中返回false
+    bool endRequest();   // 响应写完，停止中返回false，连接需要断开
 
     std::vector<SocketWrapper> clients; //用户的连接
     std::shared_ptr<SocketWrapper> serverSocket; 
     // std::shared_ptr<IOScheduler> scheduler;
     RouteHandler defaultHandler; //默认路由的处理
     RouteTree  routeTable; //路由表
+    // 栈档位，依据StackProfiler的统计：worker处理静态页面最深约8K，accepter只循环accept
+    StackClass workerStack = StackClass::MEDIUM;
+    StackClass accepterStack = StackClass::SMALL;
+    // 接受连接的协程优先运行，传输大文件时新连接也能马上被接受
+    FiberPriority workerPriority = FiberPriority::NORMAL;
+    FiberPriority accepterPriority = FiberPriority::HIGH;
+    std::chrono::milliseconds requestTimeout {0};
+    // 停止，connMutex保护
+    std::mutex connMutex;
+    std::condition_variable connCond; // 连接全部断开、accepter退出
+    std::unordered_map<Fiber*, Connection> connections;
+    CancelToken accepterToken;
+    bool accepting = false;
+    bool draining = false;
+    size_t drained = 0;
+    bool stopped = false;             // 调度器已经停掉，setup()可以返回
     static void worker(HttpServer* p, std::shared_ptr<SocketWrapper> socket); //消息处理流程
     static std::shared_ptr<SocketWrapper> accepter(HttpServer* p); // 接收连接流程
 };
 
-HttpServer::HttpServer(const std::string& addr,uint16_t port,int thread_num=-1):routeTable(){
+HttpServer::HttpServer(const std::string& addr,uint16_t port,int thread_num=-1)
+    :HttpServer(addr,port,SchedulerOption(thread_num>1 ? thread_num : 0)){
+}
+
+HttpServer::HttpServer(const std::string& addr,uint16_t port,const SchedulerOption& option):routeTable(){
     // 1. 构建缺省路由处理
     defaultHandler = [](std::shared_ptr<HttpRequest> request)->std::shared_ptr<HttpResponse>{
         auto res = std::make_shared<HttpResponse>();
@@ -176,10 +236,10 @@ HttpServer::HttpServer(const std::string& addr,uint16_t port,int thread_num=-1):
     routeTable.setDefaultHandler(defaultHandler);
 
     // 2. 构建socket
-    serverSocket = SocketWrapper::Create(SocketWrapper::Type::TCP,addr,port);
+    serverSocket = SocketWrapper::Create(SocketWrapper::Type::TCP,addr,port,option.local);
     LOG_STREAM<<"http server create  socket on "<<addr<<":"<<port<<INFOLOG;
     // 3. 初始化调度器
-    if(thread_num>1) globalScheduler = std::make_shared<FiberScheduler>(thread_num);
+    if(option.threads>0 || option.local) globalScheduler = IOScheduler::getIOScheduler(option);
     
 }
 
@@ -193,13 +253,23 @@ int HttpServer::setRoute(std::vector<std::pair<std::string,RouteHandler>> url_ha
 void HttpServer::worker(HttpServer* p, std::shared_ptr<SocketWrapper> c_socket){
       
     try{
+        ConnectionGuard guard(p);
+        if(!guard.accepted()) return;
         std::shared_ptr<HttpSocket> httpsocket = std::make_shared<HttpSocket>(c_socket);
+        bool timed = p->requestTimeout.count() > 0 && Fiber::InFiber();
         while(true){
-            
+            // 0.每个请求重新计时，空闲的长连接超时后也会被释放
+            if(timed) Fiber::GetThis()->setDeadline(std::chrono::steady_clock::now() + p->requestTimeout);
+            if(Fiber::InFiber()) Fiber::GetThis()->setPriority(p->workerPriority);
+
             // 1.先接收消息
             std::shared_ptr<HttpRequest> request = std::make_shared<HttpRequest>();
             int r = httpsocket->readRequest(request);
             if(r == -1){
+                if(timed && Fiber::GetThis()->interrupted()){
+                    LOG_STREAM<<"request timeout disconnect from: "<<c_socket->getIP()<<INFOLOG;
+                    return;
+                }
                 LOG_STREAM<<"error in reed disconnect from: "<<c_socket->getIP()<<ERRORLOG;
                 return;
             }
@@ -208,10 +278,13 @@ void HttpServer::worker(HttpServer* p, std::shared_ptr<SocketWrapper> c_socket){
                 return;
             }
             LOG_STREAM<<"fiber"<<std::to_string(Fiber::GetThis()->getID())<<"get url:"<<request->url<<"from "<<c_socket->getIP()<<INFOLOG;
+            if(!p->beginRequest()) return;
 
             // 2.根据路由进行下一步的操作
             RouteHandler handler = p->routeTable.find(request->url);
             auto res = handler(request);
+            // 停止时到期被取消，不再写回
+            if(Fiber::InFiber() && Fiber::GetThis()->isCancelled()) return;
 
             // 3.返回响应
             r = httpsocket->writeResponse(res);
@@ -220,6 +293,7 @@ void HttpServer::worker(HttpServer* p, std::shared_ptr<SocketWrapper> c_socket){
                 return;
             }
             LOG_STREAM<<std::to_string(Fiber::GetThis()->getID())<<"return "<<res->m_reason<<" to "<<c_socket->getIP()<<INFOLOG;
+            if(!p->endRequest()) return;
         }
     }catch(const std::exception& e){
         LOG_STREAM<<"in http work catch "<<e.what()<<" with "<<c_socket->getIP()<<ERRORLOG;
@@ -229,13 +303,32 @@ void HttpServer::worker(HttpServer* p, std::shared_ptr<SocketWrapper> c_socket){
 // server对连接的处理流程
 // 每当得到连接就唤起协程处理
 std::shared_ptr<SocketWrapper> HttpServer::accepter(HttpServer* p){ 
+    {
+        std::lock_guard<std::mutex> lock(p->connMutex);
+        if(p->draining) return nullptr;
+        p->accepterToken = globalScheduler->cancelToken();
+        p->accepting = true;
+    }
     // 对于每一个到来的连接分配一个协程去执行对应操作
     while(true){
         auto newClient =  p->serverSocket->accept();
         if(newClient==nullptr){
-            throw std::runtime_error("Failed to accept");
+            std::lock_guard<std::mutex> lock(p->connMutex);
+            if(!p->draining) throw std::runtime_error("Failed to accept");
+            // 停止：关闭监听套接字，内核不再把新连接排给这个进程
+            p->serverSocket.reset();
+            p->accepting = false;
+            p->accepterToken = CancelToken();
+            p->connCond.notify_all();
+            return nullptr;
         }
-        globalScheduler->addTask(worker,p,newClient);
+        FiberOption option(p->workerStack);
+        option.name = "HttpServer::worker";
+        option.priority = p->workerPriority;
+        // 按NUMA节点绑定了线程时交给本节点上的线程，连接的缓冲区和协程栈都在这个节点上分配
+        int target = globalScheduler->nextNodeWorker();
+        if(target >= 0) globalScheduler->addTaskOn(target,option,worker,p,newClient);
+        else globalScheduler->addTask(option,worker,p,newClient);
     }
 }
 
@@ -246,11 +339,20 @@ int HttpServer::setup(){
     // 2.接收连接
     if(globalScheduler){  // 对于协程注册一个任务用来接收
         LOG_STREAM<<"Server setup with fibers"<<INFOLOG;
-        globalScheduler->addTask(accepter,this);
-        std::string command;
-        while(std::cin>>command){
-            
+        FiberOption option(accepterStack);
+        option.name = "HttpServer::accepter";
+        option.priority = accepterPriority;
+        globalScheduler->addTask(option,accepter,this);
+        #ifndef _WIN32
+        // 单线程模式：事件循环和所有协程都在这个线程上运行
+        if(auto local = std::dynamic_pointer_cast<LocalScheduler>(globalScheduler)){
+            local->run();
+            return 0;
         }
+        #endif
+        // 等shutdown停掉调度器
+        std::unique_lock<std::mutex> lock(connMutex);
+        connCond.wait(lock, [this]{ return stopped; });
     }
     else{                 // 否则以阻塞形式等待
         while(true){
@@ -272,6 +374,85 @@ int HttpServer::setup(){
 
 
 
+HttpServer::ConnectionGuard::ConnectionGuard(HttpServer* server):m_server(server){
+    if(!Fiber::InFiber() || !globalScheduler){
+        m_accepted = true;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(server->connMutex);
+    if(server->draining) return;
+    server->connections[Fiber::GetThis().get()].token = globalScheduler->cancelToken();
+    m_accepted = true;
+}
+
+HttpServer::ConnectionGuard::~ConnectionGuard(){
+    if(!m_accepted || !Fiber::InFiber() || !globalScheduler) return;
+    std::lock_guard<std::mutex> lock(m_server->connMutex);
+    m_server->connections.erase(Fiber::GetThis().get());
+    if(m_server->draining && m_server->connections.empty()) m_server->connCond.notify_all();
+}
+
+// 停止时空闲的连接已经被取消，收到的请求不再处理
+bool HttpServer::beginRequest(){
+    if(!Fiber::InFiber() || !globalScheduler) return true;
+    std::lock_guard<std::mutex> lock(connMutex);
+    if(draining) return false;
+    connections[Fiber::GetThis().get()].busy = true;
+    return true;
+}
+
+bool HttpServer::endRequest(){
+    if(!Fiber::InFiber() || !globalScheduler) return true;
+    std::lock_guard<std::mutex> lock(connMutex);
+    Connection& connection = connections[Fiber::GetThis().get()];
+    connection.busy = false;
+    if(!draining) return true;
+    if(!connection.aborted) drained++;
+    return false;
+}
+
+HttpServer::DrainReport HttpServer::shutdown(std::chrono::milliseconds timeout){
+    if(!globalScheduler){
+        throw std::runtime_error("shutdown is only supported with fibers");
+    }
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    DrainReport report;
+    std::unique_lock<std::mutex> lock(connMutex);
+    if(draining){
+        throw std::runtime_error("http server already shutting down");
+    }
+    draining = true;
+    accepterToken.cancel();
+    size_t inflight = 0;
+    for(auto& connection : connections){
+        if(connection.second.busy) inflight++;
+        else connection.second.token.cancel();
+    }
+    LOG_STREAM<<"http server draining "<<std::to_string(inflight)<<" requests, "
+              <<std::to_string(connections.size() - inflight)<<" idle connections"<<INFOLOG;
+    connCond.wait_until(lock, deadline, [this]{ return connections.empty() && !accepting; });
+    for(auto& connection : connections){
+        if(connection.second.busy && !connection.second.aborted){
+            connection.second.aborted = true;
+            report.aborted++;
+        }
+        connection.second.token.cancel();
+    }
+    report.drained = drained;
+    lock.unlock();
+
+    // 被取消的协程退出后停掉调度器的线程，setup()返回
+    auto stats = globalScheduler->shutdown(std::chrono::steady_clock::now());
+    LOG_STREAM<<"http server stopped: drained "<<std::to_string(report.drained)<<", aborted "<<std::to_string(report.aborted)
+              <<", fibers cancelled "<<std::to_string(stats.cancelled)<<", abandoned "<<std::to_string(stats.abandoned)<<INFOLOG;
+    lock.lock();
+    connections.clear();
+    accepterToken = CancelToken();
+    stopped = true;
+    connCond.notify_all();
+    return report;
+}
+
 void HttpServer::setDefaultHandler(RouteHandler h){
     defaultHandler = h;
     routeTable.setDefaultHandler(defaultHandler);
@@ -236,7 +236,7 @@ int HttpSocket::readRequest(std::shared_ptr<HttpRequest> request){
 
 
     while(true){
-        size_t mlen;
+        ssize_t mlen; // 读失败（包括超时、取消）返回-1，不能用无符号数接
         try
         {
             mlen = socket->read(buf,1024);
@@ -263,7 +263,7 @@ int HttpSocket::readRequest(std::shared_ptr<HttpRequest> request){
                 size_t content_len = stoi(request->getHeader("Content-Length"));
                 std::string context = m.substr(m_head.size(),m.size()-m_head.size()); //存消息体
                 while(content_len>0){
-                    size_t mlen = socket->read(buf,1024);
+                    ssize_t mlen = socket->read(buf,1024);
                     if(mlen<=0) break;
                     else{
                         context.append(buf,mlen);
@@ -0,0 +1,114 @@
+#ifndef INLINE_TASK
+#define INLINE_TASK
+
+#include <cstddef>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+
+/*
+    小缓冲区优化的任务对象
+    把可调用对象和绑定的参数直接构造在对象内部的缓冲区里，代替std::bind + std::function，
+    放得下时不需要任何堆分配，放不下时才退回到堆上
+    参数按值保存，调用时以左值传入，和std::bind的行为一致
+    可以移动（放进队列的槽位里）：缓冲区里的对象移动构造过去，堆上的只转交指针；移动构造可能抛异常的类型放在堆上
+*/
+template <size_t Capacity = 64>
+class InlineTask {
+public:
+    InlineTask() = default;
+    ~InlineTask() { reset(); }
+    InlineTask(const InlineTask&) = delete;
+    InlineTask& operator=(const InlineTask&) = delete;
+    InlineTask(InlineTask&& other) noexcept { take(other); }
+    InlineTask& operator=(InlineTask&& other) noexcept {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    // 绑定函数和参数，原有的任务先析构
+    template <typename Fn, typename... Args>
+    void emplace(Fn&& fn, Args&&... args) {
+        using BoundT = Bound<typename std::decay<Fn>::type, typename std::decay<Args>::type...>;
+        reset();
+        if constexpr (sizeof(BoundT) <= Capacity && alignof(BoundT) <= alignof(std::max_align_t)
+                      && std::is_nothrow_move_constructible<BoundT>::value) {
+            m_obj = new (m_buf) BoundT(std::forward<Fn>(fn), std::forward<Args>(args)...);
+            m_heap = false;
+        }
+        else {
+            m_obj = new BoundT(std::forward<Fn>(fn), std::forward<Args>(args)...);
+            m_heap = true;
+        }
+        m_ops = &OpsFor<BoundT>::ops;
+    }
+
+    void operator()() { m_ops->invoke(m_obj); }
+    explicit operator bool() const { return m_ops != nullptr; }
+
+    // 析构保存的可调用对象（连同绑定的参数）
+    void reset() {
+        if (!m_ops) return;
+        const Ops* ops = m_ops;
+        void* obj = m_obj;
+        m_ops = nullptr;
+        m_obj = nullptr;
+        ops->destroy(obj, m_heap);
+    }
+
+private:
+    void take(InlineTask& other) noexcept {
+        if (!other.m_ops) return;
+        m_ops = other.m_ops;
+        m_heap = other.m_heap;
+        m_obj = m_heap ? other.m_obj : m_ops->relocate(other.m_obj, m_buf);
+        other.m_ops = nullptr;
+        other.m_obj = nullptr;
+    }
+
+    template <typename Fn, typename... Args>
+    struct Bound {
+        template <typename F, typename... A>
+        Bound(F&& f, A&&... a):fn(std::forward<F>(f)),args(std::forward<A>(a)...){}
+        void operator()() { std::apply(fn, args); }
+        Fn fn;
+        std::tuple<Args...> args;
+    };
+
+    struct Ops {
+        void (*invoke)(void* obj);
+        void (*destroy)(void* obj, bool heap);
+        void* (*relocate)(void* from, void* to); // 只用于缓冲区里的对象
+    };
+    template <typename T>
+    struct OpsFor {
+        static void invoke(void* obj) { (*static_cast<T*>(obj))(); }
+        static void destroy(void* obj, bool heap) {
+            if (heap) delete static_cast<T*>(obj);
+            else static_cast<T*>(obj)->~T();
+        }
+        static void* relocate(void* from, void* to) {
+            if constexpr (std::is_nothrow_move_constructible<T>::value) {
+                T* src = static_cast<T*>(from);
+                T* dst = new (to) T(std::move(*src));
+                src->~T();
+                return dst;
+            }
+            else {
+                return nullptr; // 这样的类型不会放在缓冲区里
+            }
+        }
+        static constexpr Ops ops {&OpsFor::invoke, &OpsFor::destroy, &OpsFor::relocate};
+    };
+
+    alignas(std::max_align_t) unsigned char m_buf[Capacity];
+    void* m_obj = nullptr;
+    const Ops* m_ops = nullptr;
+    bool m_heap = false;
+};
+
+#endif
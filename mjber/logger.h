@@ -302,8 +302,10 @@ public:
         LOG.log(level,res);
     }
 
+    // 每个线程一个，多个工作线程同时写日志时不会互相踩
+    // 一条LOG_STREAM语句中间不会切换协程，所以协程换线程也没有影响
     static LogStream& getLogStream(){
-        static LogStream log_stream;
+        static thread_local LogStream log_stream;
         return log_stream;
     }
     
@@ -0,0 +1,114 @@
+#ifndef MPMC_RING
+#define MPMC_RING
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+/*
+    有界多生产者多消费者无锁环形队列（Vyukov的算法）
+    每个槽位带一个序号：序号等于入队位置说明槽位空闲，等于位置+1说明有数据可取，
+    生产者和消费者各自用一次CAS抢位置，抢到之后只和这个槽位打交道，互不阻塞
+    容量不要求是2的幂，满了tryPush返回false，空了tryPop返回false，由调用方决定是等待还是另找地方
+    只有一个槽位时，写入后的序号（位置+1）正好是下一次入队等的序号，会覆盖还没取走的元素，
+    所以至少分配两个槽位；容量为1时入队另外比较一次出队位置，保证最多放一个
+*/
+template <typename T>
+class MPMCRing {
+public:
+    explicit MPMCRing(size_t capacity)
+        :m_capacity(capacity), m_cellCount(capacity < 2 ? 2 : capacity) {
+        if (capacity == 0) throw std::runtime_error("MPMCRing capacity must be positive");
+        m_cells.reset(new Cell[m_cellCount]);
+        for (size_t i = 0; i < m_cellCount; ++i) m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+    // 析构时没有并发，直接析构剩下的元素
+    ~MPMCRing() {
+        size_t end = m_enqueuePos.load(std::memory_order_relaxed);
+        for (size_t pos = m_dequeuePos.load(std::memory_order_relaxed); pos != end; ++pos) {
+            reinterpret_cast<T*>(m_cells[pos % m_cellCount].storage)->~T();
+        }
+    }
+    MPMCRing(const MPMCRing&) = delete;
+    MPMCRing& operator=(const MPMCRing&) = delete;
+
+    // 成功时才从value移走
+    bool tryPush(T& value) {
+        Cell* cell;
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &m_cells[pos % m_cellCount];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                // 槽位比容量多时槽位空闲不代表没满；读到旧的出队位置只会多报满，不会多放
+                if (m_capacity < m_cellCount &&
+                    static_cast<intptr_t>(pos - m_dequeuePos.load(std::memory_order_acquire)) >= static_cast<intptr_t>(m_capacity)) {
+                    return false;
+                }
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                return false; // 满了
+            }
+            else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        new (cell->storage) T(std::move(value));
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    bool tryPush(T&& value) { return tryPush(value); }
+
+    bool tryPop(T& out) {
+        Cell* cell;
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &m_cells[pos % m_cellCount];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                return false; // 空的
+            }
+            else {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        T* item = reinterpret_cast<T*>(cell->storage);
+        out = std::move(*item);
+        item->~T();
+        cell->seq.store(pos + m_cellCount, std::memory_order_release);
+        return true;
+    }
+
+    // 只是一个近似值，并发时可能已经过期
+    size_t sizeApprox() const {
+        size_t enq = m_enqueuePos.load(std::memory_order_relaxed);
+        size_t deq = m_dequeuePos.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+    bool emptyApprox() const { return sizeApprox() == 0; }
+    size_t capacity() const { return m_capacity; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    const size_t m_capacity;
+    const size_t m_cellCount; // 实际分配的槽位，至少两个
+    std::unique_ptr<Cell[]> m_cells;
+    alignas(64) std::atomic<size_t> m_enqueuePos {0}; // 生产者和消费者的位置分开放，避免伪共享
+    alignas(64) std::atomic<size_t> m_dequeuePos {0};
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef MPSC_QUEUE
+#define MPSC_QUEUE
+
+#include <atomic>
+
+/*
+    多生产者单消费者的无锁队列，侵入式：节点自己带next指针（Next指定是哪个成员），入队不分配内存
+    生产者用CAS把节点压到共享链表头上；消费者一次把整条链表取走，反转成先进先出放在本地，之后从本地逐个取
+    push可以在任意线程调用，pop和emptyApprox只能在消费者线程调用
+    队列不拥有节点，析构前由使用者取空
+*/
+template<typename T, T* T::*Next>
+class MpscQueue {
+public:
+    MpscQueue() = default;
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    //--入队，返回入队前共享链表是否为空，调用方可以据此只在第一次入队时叫醒消费者
+    bool push(T* node) { return pushChain(node, node); }
+    //--一次入队一串节点：newest是最后入队的，沿Next连到最早入队的oldest（和共享链表的方向一致）
+    bool pushChain(T* newest, T* oldest) {
+        T* head = m_head.load(std::memory_order_relaxed);
+        do {
+            oldest->*Next = head;
+        } while (!m_head.compare_exchange_weak(head, newest, std::memory_order_release, std::memory_order_relaxed));
+        return head == nullptr;
+    }
+    //--出队，空时返回nullptr
+    T* pop() {
+        if (!m_local) {
+            if (!m_head.load(std::memory_order_relaxed)) return nullptr;
+            T* list = m_head.exchange(nullptr, std::memory_order_acquire);
+            // 共享链表是后进先出的，反转过来
+            T* prev = nullptr;
+            while (list) {
+                T* next = list->*Next;
+                list->*Next = prev;
+                prev = list;
+                list = next;
+            }
+            m_local = prev;
+        }
+        T* node = m_local;
+        m_local = node->*Next;
+        node->*Next = nullptr;
+        return node;
+    }
+    bool emptyApprox() const {
+        return !m_local && !m_head.load(std::memory_order_acquire);
+    }
+
+private:
+    alignas(64) std::atomic<T*> m_head {nullptr}; // 生产者竞争的共享链表
+    alignas(64) T* m_local = nullptr;             // 消费者已经取下来的部分，只有消费者访问
+};
+
+#endif
@@ -7,22 +7,36 @@
 #include <unordered_map>
 #include <thread>
 #include <utility>
+#include <deque>
+#include <chrono>
+#include <climits>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <array>
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
 
 
-#include "thread_pool.h"
 #include "fiber.h"
+#include "work_stealing_deque.h"
+#include "mpsc_queue.h"
+#include "topology.h"
 #include "logger.h"
 
-// 线程池可以不断压入任务
-
 
 
 /*  IO协程调度器
-    每当进行io操作时先addEvent，然后阻塞自己，线程会空闲，由线程池继续分配任务
+    每当进行io操作时先addEvent，然后阻塞自己，线程会空闲，由工作线程继续运行其他协程
     接口：
         addTask() //加入任务
         addEvent() //注册事件并阻塞自己
-    需要一个表维护fd和fiber的对应关系
+    需要一个表维护fd和fiber的对应关系（Linux上是按fd下标的FdRegistry）
     
 */
 
@@ -34,12 +48,12 @@
 class FiberDes{
 public:
     #ifdef _WIN32
-    FiberDes(std::shared_ptr<Fiber> fiber):fiber_(fiber),type_(IOType::NONE),fd_(-1),io_res_(0){}
+    FiberDes(Fiber::ptr fiber):fiber_(std::move(fiber)),type_(IOType::NONE),fd_(-1),io_res_(0){}
     #else
-    FiberDes(std::shared_ptr<Fiber> fiber):fiber_(fiber),type_(IOType::NONE),fd_(-1){}
+    FiberDes(Fiber::ptr fiber):fiber_(std::move(fiber)),type_(IOType::NONE),fd_(-1){}
     #endif
 
-    std::shared_ptr<Fiber> fiber_;
+    Fiber::ptr fiber_;
     //NONE表示没等待事件
     enum IOType{
         READ,WRITE,NONE
@@ -54,12 +68,112 @@ public:
 };
 
 
+class IOScheduler;
+class TimerHeap;
+
+/*
+    定时器节点，由等待方持有（协程栈或堆上），调度器的小顶堆里只放指针
+    到期回调在定时器锁下执行，不能在回调里再增删定时器；cancelTimer返回之后回调不会再执行
+*/
+struct TimerNode {
+    static const size_t NPOS = static_cast<size_t>(-1);
+    std::chrono::steady_clock::time_point when;
+    void (*fn)(IOScheduler* scheduler, TimerNode* node) = nullptr;
+    void* arg = nullptr;
+    size_t index = NPOS; // 在堆里的位置，NPOS表示不在堆里
+    TimerHeap* heap = nullptr; // 所在的堆
+};
+
+// 按到期时间排列的小顶堆，自带锁
+class TimerHeap {
+public:
+    //--加入定时器，返回true表示成了最早到期的
+    bool add(TimerNode* node);
+    //--取消定时器，返回false表示已经到期执行过
+    bool cancel(TimerNode* node);
+    //--执行到期的定时器，返回离下一个到期还有多少毫秒，没有定时器时返回-1
+    int process(IOScheduler* scheduler);
+private:
+    void siftUp(size_t i);
+    void siftDown(size_t i);
+    void removeAt(size_t i);
+    std::mutex mutex;
+    std::vector<TimerNode*> timers;
+};
+
+/*
+    调度器的选项
+    multiReactor：每个工作线程有自己的epoll、运行队列和定时器，协程创建时轮流分配给各线程，之后一直在这个线程上运行，
+                  唤醒也回到这个线程（不再偷取），连接和它的协程不会在核之间来回迁移；
+                  默认是一个事件线程加上工作窃取的工作线程
+    ioUring：用io_uring（每个工作线程一个环，总是多reactor的布局），套接字读写直接提交给内核；
+             通过IOScheduler::getIOScheduler创建时内核不支持会退回epoll
+    spinUs：空闲的工作线程和事件线程先自旋这么多微秒再停下来（条件变量或者阻塞的epoll_wait），
+            自旋时用不等待的epoll_wait收事件、用pause让出流水线；拿CPU换延迟，0表示不自旋
+    busyPollUs：给等待过的套接字设置SO_BUSY_POLL（微秒），读的时候内核先轮询网卡队列；
+                超过net.core.busy_read的值需要CAP_NET_ADMIN，设置失败时忽略；0表示不设置
+    affinityLimit：工作窃取模式下被唤醒的协程放回上次运行它的线程，它的栈和连接的数据多半还在那个核的缓存里；
+                   那个线程积压的可运行协程达到这个数时才照常调度，由空闲的线程取走（迁移）；
+                   0表示不启用，唤醒的协程放进唤醒方的LIFO槽或者全局队列，迁移次数见IOScheduler::migrationCount
+    cpus：第i个工作线程绑定到cpus[i % cpus.size()]这一个CPU上，事件线程可以在其中任意一个上运行
+    numaNodes：没有指定cpus时，工作线程按顺序分成连续的几段，分别绑定到这些节点的全部CPU上，事件线程绑定到第一个节点；
+               两种绑定方式下，工作窃取先偷同一个节点上的线程，HttpServer把新连接交给接受它的线程所在节点上的线程；
+               内存不单独按节点分配，靠内核的首次访问策略落在本节点，见CpuTopology
+    priorityWeights：HIGH/NORMAL/LOW三级协程（FiberOption::priority）的权重，各级都有协程可运行时按这个比例轮流取，
+                     某一级没有时取更高的一级；权重为0按1算，低优先级的协程总能分到一份，不会饿死
+    local：单线程模式（LocalScheduler），不创建任何线程，事件循环和协程都在调用run()的线程上运行，threads/multiReactor/ioUring不起作用；
+           HttpServer在setup()里运行它，监听的套接字带SO_REUSEPORT，多开几个进程监听同一个端口
+*/
+struct SchedulerOption {
+    SchedulerOption() = default;
+    SchedulerOption(size_t threads):threads(threads){}
+
+    size_t threads = 1;
+    bool multiReactor = false;
+    bool ioUring = false;
+    uint32_t spinUs = 0;
+    uint32_t busyPollUs = 0;
+    uint32_t affinityLimit = 0;
+    std::vector<int> cpus;
+    std::vector<int> numaNodes;
+    std::array<uint32_t, 3> priorityWeights {{8, 4, 1}};
+    bool local = false;
+};
+
+// 自旋时给CPU的提示
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+/*
+    取消令牌，在协程里用IOScheduler::cancelToken()取得，可以交给任意线程
+    cancel()标记协程并把它从挂起点唤醒，之后它的挂起点都返回ECANCELED
+    令牌持有协程的引用，协程结束后不会被复用，cancel也就不会落到别的任务上
+*/
+class CancelToken {
+public:
+    CancelToken() = default;
+    void cancel();
+    explicit operator bool() const { return static_cast<bool>(fiber_); }
+private:
+    friend class IOScheduler;
+    CancelToken(IOScheduler* scheduler,Fiber::ptr fiber):scheduler_(scheduler),fiber_(std::move(fiber)){}
+    IOScheduler* scheduler_ = nullptr;
+    Fiber::ptr fiber_;
+};
+
 // 单例模式
 class IOScheduler {
 public:
-    IOScheduler(size_t threadCount = 1):threadPool(threadCount){};
+    IOScheduler(const SchedulerOption& option = SchedulerOption());
 
-    virtual ~IOScheduler() = default;
+    virtual ~IOScheduler();
     /*
         协程内调用的方法
     */
@@ -67,20 +181,48 @@ public:
     virtual void addEvent(int fd, uint32_t events) = 0;
     //--销毁事件，表示不需要再维护
     virtual void rmEvent(int fd) = 0;
+    #ifndef _WIN32
+    /*
+        完成式IO（io_uring）：操作直接交给内核，完成后唤醒协程，不用先等就绪再调一次系统调用
+        只有支持的调度器上、在工作线程里运行的协程（不是共享栈）能用，completionIO()返回false时走addEvent+wait
+        返回值同对应的系统调用，失败返回-1并设置errno；等待被打断时errno为ETIMEDOUT/ECANCELED，打断前已经完成的结果照常返回
+    */
+    virtual bool completionIO(){ return false; }
+    virtual ssize_t ioRead(int /*fd*/, void* /*buf*/, size_t /*len*/){ errno = ENOSYS; return -1; }
+    virtual ssize_t ioWrite(int /*fd*/, const void* /*buf*/, size_t /*len*/){ errno = ENOSYS; return -1; }
+    //--接受连接，addr可以为空
+    virtual int ioAccept(int /*fd*/, sockaddr* /*addr*/, socklen_t* /*len*/){ errno = ENOSYS; return -1; }
+    virtual int ioConnect(int /*fd*/, const sockaddr* /*addr*/, socklen_t /*len*/){ errno = ENOSYS; return -1; }
+    #endif
     //--主动让出，调用的协程会阻塞自己来让线程进行其他工作
-    void wait(){
-        Fiber::GetThis()->yield();
+    //  本线程还有可运行的协程时直接切换过去，不经过主协程
+    //  设置了截止时间的协程最多等到截止时间；返回false表示被打断，原因见Fiber::interrupted()
+    bool wait(){
+        return waitUntil(std::chrono::steady_clock::time_point::max());
+    }
+    //--挂起直到被唤醒，不受截止时间和取消影响，给同步原语这类自己处理打断的地方用
+    void suspend(){
+        Fiber::GetThis()->yield(pickNext());
+    }
+    //--让出执行权但保持可运行，切出后排到全局队列，先让本线程和其他线程积压的协程运行
+    void yield(){
+        t_yielding = true;
+        Fiber::GetThis()->notify();
+        suspend();
     }
     //--销毁退出
+    //  协程此时还在自己的栈上运行，切出后最后一个引用释放时才回到对象池
     void exit(){
         auto fid = Fiber::GetThis()->getID();
         {
-        std::lock_guard<std::mutex> lock(registryMutex);
+        auto lock = lockRegistry();
         // 状态表
-        if(Registry.find(fid)!=Registry.end())
-            Registry.erase(Registry.find(fid));
-        // 压入空闲列表
-        freeFibers.emplace_back(Fiber::GetThis());
+        auto term = Registry.find(fid);
+        if(term!=Registry.end()){
+            Registry.erase(term);
+            live_.fetch_sub(1, std::memory_order_relaxed);
+            exited_.fetch_add(1, std::memory_order_relaxed);
+        }
         }
         LOG_STREAM<<"Fiber "<< std::to_string(fid)<<" end"<<DEBUGLOG;
     }
@@ -88,72 +230,1049 @@ public:
         协程的管理
     */
     //--添加任务
-    template<typename F,typename... Args>
+    template<typename F,typename... Args,
+             typename = typename std::enable_if<!IsFiberOption<F>::value>::type>
     void addTask(F&& f,Args&&... args);
+    //--按选项添加任务，例如大量空闲长连接可以使用共享栈
+    template<typename F,typename... Args>
+    void addTask(const FiberOption& option,F&& f,Args&&... args);
     //--检查协程是否有效
     bool checkFiber(int64_t fid){
-        std::lock_guard<std::mutex> lock(registryMutex);
+        auto lock = lockRegistry();
         return Registry.find(fid)!=Registry.end();
     }
     bool checkFiber(){
-        std::lock_guard<std::mutex> lock(registryMutex);
+        auto lock = lockRegistry();
         auto fid = Fiber::GetThis()->getID();
         return Registry.find(fid)!=Registry.end();
     }
 
 
-    //获取下一个需要执行的
-    static std::shared_ptr<IOScheduler> getIOScheduler(size_t threadCount);
+    //--唤醒挂起的协程，协程还没完全切出时由它切出后自己重新调度
+    //  可以在任意线程调用，用于实现协程的同步原语
+    void wakeup(Fiber::ptr fiber){
+        if(fiber->notify()) schedule(std::move(fiber), WOKEN);
+    }
+    //--当前工作线程所属的调度器，不在调度器的工作线程上时为空
+    static IOScheduler* GetThis(){ return t_scheduler; }
+
+    /*
+        定时
+        由事件线程（多reactor时是各工作线程）的epoll_wait超时驱动，睡眠的协程不占线程也不需要轮询
+    */
+    //--带超时的等待，被唤醒返回true，到期、到了协程的截止时间或被取消返回false
+    //  返回false时清掉协程等待中的IO事件，之后来的事件不会再唤醒它
+    bool waitUntil(std::chrono::steady_clock::time_point deadline);
+    template<typename Rep,typename Period>
+    bool waitFor(const std::chrono::duration<Rep,Period>& timeout){
+        return waitUntil(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+    }
+    //--睡到指定时间，提前被唤醒时继续睡，被打断时提前返回；不在协程里时阻塞线程
+    void sleepUntil(std::chrono::steady_clock::time_point t);
+    template<typename Rep,typename Period>
+    void sleepFor(const std::chrono::duration<Rep,Period>& d){
+        sleepUntil(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(d));
+    }
+    //--注册/取消定时器，取消时返回false表示已经到期执行过
+    void addTimer(TimerNode* node);
+    bool cancelTimer(TimerNode* node);
+
+    //--取得当前协程的取消令牌
+    CancelToken cancelToken();
+    //--打断挂起中的协程：唤醒它，它的等待返回false并清掉等待中的IO事件；没有挂起时下一次挂起立即返回
+    void interrupt(Fiber::ptr fiber);
+
+    /*
+        指定线程运行
+        工作线程的下标是0到workerCount()-1；交过去的协程放进那个线程的无锁收件箱，只由它自己取，它在等待时叫醒一次
+        默认的工作窃取模式下只保证这一次在那个线程上运行，之后的唤醒照常调度；多reactor模式下协程之后一直属于那个线程，
+        可以用来把连接交给指定的分片
+    */
+    size_t workerCount() const { return workers.size(); }
+    //--当前所在工作线程的下标，不在这个调度器的工作线程上时返回-1
+    int currentWorker() const { return t_scheduler == this && t_worker ? static_cast<int>(t_worker->index) : -1; }
+    //--在指定工作线程上新建协程，下标超出范围时抛出异常
+    template<typename F,typename... Args,
+             typename = typename std::enable_if<!IsFiberOption<F>::value>::type>
+    void addTaskOn(size_t worker,F&& f,Args&&... args);
+    template<typename F,typename... Args>
+    void addTaskOn(size_t worker,const FiberOption& option,F&& f,Args&&... args);
+    //--唤醒挂起的协程，让它在指定工作线程上继续；还没完全切出时由它切出后自己交过去
+    void wakeupOn(size_t worker, Fiber::ptr fiber);
+    //--工作线程绑定的NUMA节点，没有绑定时返回-1
+    int workerNode(size_t worker) const { return worker < workers.size() ? workers[worker]->node : -1; }
+    //--当前工作线程所在节点上的工作线程（包括自己），每次调用轮到下一个；没有绑定或者不在工作线程上时返回-1
+    int nextNodeWorker();
+
+    //--空闲的线程在自旋中等到了活的次数、真正停下来的次数，用来调整SchedulerOption::spinUs
+    uint64_t spinHitCount() const { return spinHits_.load(std::memory_order_relaxed); }
+    uint64_t parkCount() const { return parks_.load(std::memory_order_relaxed); }
+    //--协程挂起时发现和上次挂起不在同一个线程上的次数，用来调整SchedulerOption::affinityLimit
+    uint64_t migrationCount() const { return migrations_.load(std::memory_order_relaxed); }
+    //--SHARED协程要切入时共享栈被别的线程占着、只好排回队列的次数，偏高时用SharedStackPool::Config多开几个共享栈
+    uint64_t sharedBusyCount() const { return sharedBusy_.load(std::memory_order_relaxed); }
+
+    /*
+        停止
+        先等协程在deadline之前自己结束；到期后取消剩下的协程（挂起点返回ECANCELED），再等它们最多grace；
+        然后停掉并join所有工作线程和事件线程，还没结束的协程从注册表里丢掉，其余引用在调度器析构时释放，栈随之归还
+        之后调度器不再运行任何协程，只能调用一次；不能在这个调度器的线程上调用，LocalScheduler的run()随之返回
+    */
+    struct ShutdownReport {
+        size_t finished = 0;  // 到期之前自己结束的协程
+        size_t cancelled = 0; // 到期后被取消的
+        size_t abandoned = 0; // 取消之后grace内还没结束、被丢掉的
+    };
+    ShutdownReport shutdown(std::chrono::steady_clock::time_point deadline,
+                            std::chrono::milliseconds grace = std::chrono::milliseconds(100));
+    //--还没结束的协程数
+    size_t liveCount() const { return live_.load(std::memory_order_relaxed); }
+
+    //--按选项创建调度器，要求io_uring但内核不支持时退回epoll；local时是LocalScheduler，需要自己调用run()
+    static std::shared_ptr<IOScheduler> getIOScheduler(const SchedulerOption& option);
     static std::shared_ptr<IOScheduler> gloabalIOScheduler;
 
 protected:
-    ThreadPool threadPool;
+    /*
+        可运行协程的分发（工作窃取）
+        每个工作线程每个优先级有一个Chase-Lev双端队列，在工作线程上新建的协程放进自己的队列，空闲的线程随机挑别的线程从另一端偷；
+        在工作线程上唤醒的协程放进该线程的LIFO槽，当前协程挂起后马上运行它（唤醒方刚写过的数据还在缓存里），
+        连续从LIFO槽取超过LIFO_BUDGET次就放回队列，避免两个协程来回唤醒把队列里其他协程饿死；
+        其他线程（事件线程等）唤醒的协程和主动yield的协程放进全局队列；
+        没有活干的线程登记为空闲后停在自己的条件变量上，放入新协程时没有线程在偷才叫醒一个
+        多reactor模式（pinned_）下协程只在所属线程运行：别的线程唤醒的协程放进所属线程的收件箱，
+        线程空闲时在park里等事件（Linux上是它自己的epoll），忙的时候每GLOBAL_INTERVAL次调度收一次事件和定时器
+        收件箱是无锁的多生产者单消费者队列，工作窃取模式下用来放addTaskOn/wakeupOn指定给这个线程的协程
+        以及开启affinityLimit时放回上次运行它的线程的协程；收件箱里的协程不会被偷，线程积压时就不再往里放
+        优先级：全局队列也分级，收件箱取出来后按级别放进本线程不会被偷的队列（held）；
+        取协程时按priorityOrder_轮到的级别先取（本线程的队列、held、全局队列），没有时从高到低，最后才去偷；
+        LOW的协程不进LIFO槽，大文件传输这类协程不会插到刚被唤醒的短请求前面
+    */
+    enum ScheduleHint { SPAWNED, WOKEN, YIELDED };
+    static const size_t PRIORITIES = 3;
+    static const size_t LOW_LEVEL = static_cast<size_t>(FiberPriority::LOW);
+    struct Worker {
+        size_t index = 0;
+        WorkStealingDeque<Fiber*> queues[PRIORITIES]; // 每级一个，存的是交出来的引用
+        std::deque<Fiber::ptr> held[PRIORITIES];      // 从收件箱取出来的，只在本线程运行，只有所属线程访问
+        Fiber::ptr lifo;                 // 只有所属线程访问
+        uint32_t lifoRun = 0;            // 连续从LIFO槽取的次数
+        uint32_t tick = 0;
+        uint32_t turn = 0;               // 轮到priorityOrder_的哪一项
+        uint32_t rng;
+        std::mutex parkMutex;
+        std::condition_variable parkCond;
+        bool notified = false;
+        std::thread thread;
+        MpscQueue<Fiber, &Fiber::inboxNext> inbox; // 指定给这个线程的协程（存的是交出来的引用），只有所属线程取
+        std::atomic<size_t> inboxed {0};            // 工作窃取模式下收件箱里的协程数，判断线程是否积压
+        // 多reactor模式
+        std::atomic<bool> sleeping {false}; // 正在park里等待，交协程过来的线程需要叫醒它
+        TimerHeap timers;
+        // 绑定，见SchedulerOption::cpus/numaNodes
+        std::vector<int> cpus;     // 线程启动时绑定到这些CPU上，空表示不绑定
+        int node = -1;
+        std::vector<size_t> peers; // 同一个节点上的工作线程，没有绑定时为空
+        size_t peerNext = 0;       // nextNodeWorker轮到哪个，只有所属线程访问
+
+        bool queuesEmpty() const {
+            for(auto& queue : queues){
+                if(!queue.emptyApprox()) return false;
+            }
+            return true;
+        }
+        size_t queuedApprox() const {
+            size_t n = 0;
+            for(auto& queue : queues) n += queue.sizeApprox();
+            return n;
+        }
+        bool heldEmpty() const {
+            for(auto& queue : held){
+                if(!queue.empty()) return false;
+            }
+            return true;
+        }
+    };
+    static size_t Level(const Fiber* fiber){ return static_cast<size_t>(fiber->getPriority()); }
+    //--按SchedulerOption::cpus/numaNodes决定每个工作线程绑定的CPU和节点
+    void placeWorkers(const SchedulerOption& option);
+    //--启动/停止工作线程，由派生类在构造完成后/析构开始时调用，工作线程会调用派生类的park和unpark
+    void startWorkers();
+    void stopWorkers();
+    //--停掉并join调度器的所有线程，派生类有自己的线程（事件线程）时一起停掉
+    virtual void stopThreads(){ stopWorkers(); }
+    //--取消所有还没结束的协程，返回取消的个数
+    virtual size_t cancelAll();
+    //--等到没有还没结束的协程或者到了deadline，返回是否都结束了
+    bool waitLive(std::chrono::steady_clock::time_point deadline);
+    //--创建协程并登记到注册表，还没有交给调度
+    template<typename F,typename... Args>
+    Fiber::ptr createTask(const FiberOption& option,F&& f,Args&&... args);
+    //--让协程进入可运行状态
+    void schedule(Fiber::ptr fiber, ScheduleHint hint = SPAWNED);
+    //--一批被唤醒的协程一起放入：每个队列加一次锁，每个线程最多叫醒一次，用于事件循环一次收到的所有事件
+    void scheduleBatch(std::vector<Fiber::ptr>& fibers);
+    //--取下一个可运行的协程，没有时返回空
+    Fiber::ptr pickNext();
+    //--工作线程，在主协程上运行可运行的协程，没有时停下来等待
+    void workerLoop(Worker* w);
+    //--从全局队列取，不指定级别时从高到低
+    Fiber::ptr popGlobal();
+    Fiber::ptr popGlobal(size_t level);
+    //--取本线程某一级的协程：自己的队列、held，工作窃取模式下再看全局队列
+    Fiber::ptr popLevel(Worker* w, size_t level);
+    //--把收件箱里的协程按级别放进held
+    void takeInbox(Worker* w);
+    Fiber::ptr steal(Worker* w);
+    //--有没有w能运行的协程：全局队列、各线程的队列和w自己的收件箱
+    bool hasWork(Worker* w);
+    //--把协程放进指定线程的收件箱，需要时叫醒它
+    void deliver(Worker* target, Fiber::ptr fiber);
+    void wakeWorker(Worker* target);
+    //--工作窃取模式下唤醒的协程应该放回的线程，不需要时返回空
+    Worker* stickyHome(Fiber* fiber, Worker* w);
+    //--放入了n个别的线程能取到的协程，需要时叫醒最多n个空闲线程
+    void notifyIdle(size_t n = 1);
+    void idleWait(Worker* w);
+    //--空闲后先自旋spinUs_微秒，等到了可运行的协程返回true
+    bool spin(Worker* w);
+    //--多reactor：执行本线程到期的定时器并收一次事件，timeoutMs为0时不等待
+    void pollWorker(Worker* w, int timeoutMs);
+    //--工作线程没活干时停下来，最多等timeoutMs毫秒（-1表示一直等），unpark叫醒；默认用条件变量
+    virtual void park(Worker* w, int timeoutMs);
+    virtual void unpark(Worker* w);
+    static Fiber::ptr PickNext(void* arg);
+    static void OnHold(void* arg,Fiber::ptr fiber);
+    static void SleepUntil(void* arg,std::chrono::steady_clock::time_point t);
+    static void OnBusy(void* arg,Fiber::ptr fiber);
+    static void OnWaitTimeout(IOScheduler* scheduler,TimerNode* node);
+    //--撤掉协程等待中的IO事件，只由协程自己调用
+    virtual void clearInterest(Fiber* fiber);
+
+    //--执行到期的定时器，返回离下一个到期还有多少毫秒，没有定时器时返回-1，给epoll_wait做超时
+    int processTimers(){ return timerHeap.process(this); }
+    //--最早的到期时间提前了，叫醒事件线程重新计算超时
+    virtual void tickle(){}
+
+    static const uint32_t LIFO_BUDGET = 3;
+    static const int SPIN_PAUSES = 32; // 自旋时每查一次之间pause的次数
+    static const uint32_t GLOBAL_INTERVAL = 61; // 每隔多少次调度先看一眼全局队列和自己队列的另一端，防止饿死
+    static thread_local IOScheduler* t_scheduler; // 当前工作线程所属的调度器
+    static thread_local Worker* t_worker;
+    static thread_local bool t_yielding;
+    std::vector<std::unique_ptr<Worker>> workers;
+    bool pinned_;
+    uint32_t spinUs_;                    // 空闲后自旋多久，见SchedulerOption::spinUs
+    uint32_t affinityLimit_;             // 见SchedulerOption::affinityLimit
+    std::atomic<uint64_t> migrations_ {0};
+    std::atomic<uint64_t> sharedBusy_ {0};
+    std::atomic<size_t> live_ {0};       // 注册表里的协程数，其他线程不用加锁就能读
+    std::atomic<uint64_t> exited_ {0};   // 结束了的协程数
+    std::atomic<bool> shutdown_ {false};
+    std::vector<int> eventCpus_;         // 事件线程绑定的CPU，空表示不绑定
+    std::vector<uint8_t> priorityOrder_; // 按权重交错排开的级别，见SchedulerOption::priorityWeights
+    std::atomic<uint64_t> spinHits_ {0};
+    std::atomic<uint64_t> parks_ {0};
+    std::atomic<size_t> nextWorker_ {0}; // 多reactor模式下轮流分配新协程
+    std::mutex readyMutex;
+    std::deque<Fiber::ptr> readyQueue[PRIORITIES]; // 全局队列，每级一个
+    std::atomic<size_t> readySize_[PRIORITIES] {};
+    std::mutex idleMutex;
+    std::vector<Worker*> idleWorkers; // 由idleMutex保护
+    std::atomic<size_t> idle_ {0};
+    std::atomic<size_t> searching_ {0}; // 正在偷的线程数
+    std::atomic<bool> stop_ {false};
+
     std::mutex registryMutex; //为了维护注册表的访问
-    std::unordered_map<uint64_t,std::shared_ptr<FiberDes>> Registry; //记录fiber的注册表
-    std::vector<std::shared_ptr<Fiber>> freeFibers; //空闲fiber列表
+    std::unordered_map<uint64_t,FiberDes> Registry; //记录fiber的注册表
+    bool local_;              // 单线程模式，注册表只有运行它的线程访问，不加锁
+    std::unique_lock<std::mutex> lockRegistry(){
+        return local_ ? std::unique_lock<std::mutex>() : std::unique_lock<std::mutex>(registryMutex);
+    }
+
+    TimerHeap timerHeap; // 事件线程处理的定时器，多reactor模式下由0号工作线程处理
 };
 
 // std::shared_ptr<IOScheduler> IOScheduler::gloabalIOScheduler = std::make_shared<IOScheduler>(4);
 
+thread_local IOScheduler* IOScheduler::t_scheduler = nullptr;
+thread_local IOScheduler::Worker* IOScheduler::t_worker = nullptr;
+thread_local bool IOScheduler::t_yielding = false;
 
-//添加一个任务,线程池已经保证线程安全
-template<typename F,typename... Args>
-void IOScheduler::addTask(F&& f,Args&&... args){
-    // 1. 创建fiber
-    bool hit = false;
-    std::shared_ptr<Fiber> work_fiber;
-    {
-        std::lock_guard<std::mutex> lock(registryMutex);
-        if(!freeFibers.empty()){
-            work_fiber = freeFibers.back();
-            freeFibers.pop_back();
-            hit = true;
+IOScheduler::IOScheduler(const SchedulerOption& option):pinned_(option.multiReactor || option.local),spinUs_(option.spinUs),affinityLimit_(option.affinityLimit),local_(option.local){
+    size_t threadCount = option.local ? 1 : std::max<size_t>(option.threads, 1);
+    // 先建好所有队列再启动线程，偷取时会访问其他线程的队列
+    for(size_t i=0;i<threadCount;i++){
+        workers.emplace_back(new Worker());
+        workers.back()->index = i;
+        workers.back()->rng = static_cast<uint32_t>(i) * 2654435761u + 1;
+    }
+    placeWorkers(option);
+    // 平滑加权轮转：每一轮各级加上自己的权重，取当前值最大的一级再减去总权重，同一级不会扎堆
+    uint32_t total = 0;
+    int64_t current[PRIORITIES] = {};
+    for(uint32_t weight : option.priorityWeights) total += std::max<uint32_t>(weight, 1);
+    for(uint32_t i=0;i<total;i++){
+        size_t best = 0;
+        for(size_t level=0;level<PRIORITIES;level++){
+            current[level] += std::max<uint32_t>(option.priorityWeights[level], 1);
+            if(current[level] > current[best]) best = level;
         }
+        current[best] -= total;
+        priorityOrder_.push_back(static_cast<uint8_t>(best));
     }
-    if(hit){
-        work_fiber->reuse(f,args...);
+}
+
+void IOScheduler::placeWorkers(const SchedulerOption& option){
+    size_t n = workers.size();
+    if(!option.cpus.empty()){
+        for(size_t i=0;i<n;i++){
+            int cpu = option.cpus[i % option.cpus.size()];
+            workers[i]->cpus = {cpu};
+            workers[i]->node = CpuTopology::NodeOf(cpu);
+        }
+        eventCpus_ = option.cpus;
     }
-    if(!hit){
-        work_fiber = Fiber::Create(f,args...);
+    else if(!option.numaNodes.empty()){
+        size_t k = option.numaNodes.size();
+        for(size_t i=0;i<n;i++){
+            int node = option.numaNodes[i * k / n];
+            workers[i]->cpus = CpuTopology::NodeCpus(node);
+            if(workers[i]->cpus.empty()){
+                throw std::runtime_error("numa node " + std::to_string(node) + " has no cpus");
+            }
+            workers[i]->node = node;
+        }
+        eventCpus_ = workers[0]->cpus;
     }
-    
-    auto rtask = [this](std::shared_ptr<Fiber> fiber){
-        LOG_STREAM<<"Fiber "<< std::to_string(fiber->getID())<<" start"<<DEBUGLOG;
-        fiber->start();
+    else return;
+    for(auto& w : workers){
+        for(auto& other : workers){
+            if(other->node == w->node) w->peers.push_back(other->index);
+        }
+    }
+}
+
+IOScheduler::~IOScheduler(){
+    stopWorkers();
+}
+
+void IOScheduler::startWorkers(){
+    for(auto& w : workers){
+        Worker* worker = w.get();
+        worker->thread = std::thread([this, worker](){ this->workerLoop(worker); });
+    }
+}
+
+void IOScheduler::stopWorkers(){
+    stop_.store(true);
+    for(auto& w : workers) unpark(w.get());
+    for(auto& w : workers){
+        if(w->thread.joinable()) w->thread.join();
+    }
+    // 还没运行的协程直接丢弃
+    for(auto& w : workers){
+        Fiber* raw;
+        for(auto& queue : w->queues){
+            while(queue.pop(raw)) Fiber::ptr::Adopt(raw);
+        }
+        for(auto& queue : w->held) queue.clear();
+        while((raw = w->inbox.pop())) Fiber::ptr::Adopt(raw);
+    }
+}
+
+void IOScheduler::schedule(Fiber::ptr fiber, ScheduleHint hint){
+    Worker* w = t_scheduler == this ? t_worker : nullptr;
+    if(pinned_){
+        int home = fiber->getWorker();
+        if(home < 0){
+            home = static_cast<int>(nextWorker_.fetch_add(1, std::memory_order_relaxed) % workers.size());
+            fiber->setWorker(home);
+        }
+        Worker* target = workers[home].get();
+        if(target == w && hint != YIELDED){
+            if(hint == WOKEN && Level(fiber.get()) != LOW_LEVEL) w->lifo.swap(fiber);
+            if(fiber) w->queues[Level(fiber.get())].push(fiber.release());
+            return;
+        }
+        deliver(target, std::move(fiber));
+        return;
+    }
+    int target = fiber->getWorker();
+    if(target >= 0){
+        // 指定的线程只管这一次
+        fiber->setWorker(-1);
+        deliver(workers[target].get(), std::move(fiber));
+        return;
+    }
+    if(hint == WOKEN){
+        if(Worker* home = stickyHome(fiber.get(), w)){
+            deliver(home, std::move(fiber));
+            return;
+        }
+    }
+    if(w && hint != YIELDED){
+        if(hint == WOKEN && Level(fiber.get()) != LOW_LEVEL){
+            // 顶替LIFO槽里原来的协程，原来的放进队列让别的线程也能偷到
+            w->lifo.swap(fiber);
+            if(!fiber) return;
+        }
+        w->queues[Level(fiber.get())].push(fiber.release());
+    }
+    else{
+        size_t level = Level(fiber.get());
+        std::lock_guard<std::mutex> lock(readyMutex);
+        readyQueue[level].push_back(std::move(fiber));
+        readySize_[level].fetch_add(1, std::memory_order_release);
+    }
+    notifyIdle();
+}
+
+void IOScheduler::scheduleBatch(std::vector<Fiber::ptr>& fibers){
+    if(fibers.empty()) return;
+    if(fibers.size() == 1){
+        schedule(std::move(fibers[0]), WOKEN);
+        fibers.clear();
+        return;
+    }
+    Worker* w = t_scheduler == this ? t_worker : nullptr;
+    if(pinned_){
+        // 本线程的直接放进自己的队列，其他的按所属线程排好，每个收件箱一次入队一串、最多叫醒一次
+        size_t others = 0;
+        for(auto& fiber : fibers){
+            int home = fiber->getWorker();
+            if(home < 0){
+                home = static_cast<int>(nextWorker_.fetch_add(1, std::memory_order_relaxed) % workers.size());
+                fiber->setWorker(home);
+            }
+            if(workers[home].get() == w) w->queues[Level(fiber.get())].push(fiber.release());
+            else fibers[others++] = std::move(fiber);
+        }
+        fibers.resize(others);
+        std::sort(fibers.begin(), fibers.end(), [](const Fiber::ptr& a, const Fiber::ptr& b){
+            return a->getWorker() < b->getWorker();
+        });
+        for(size_t begin = 0, end; begin < fibers.size(); begin = end){
+            int home = fibers[begin]->getWorker();
+            Worker* target = workers[home].get();
+            end = begin + 1;
+            while(end < fibers.size() && fibers[end]->getWorker() == home) end++;
+            // 串成后入队的指向先入队的
+            Fiber* oldest = fibers[begin].release();
+            Fiber* newest = oldest;
+            for(size_t i = begin + 1; i < end; i++){
+                Fiber* next = fibers[i].release();
+                next->inboxNext = newest;
+                newest = next;
+            }
+            if(target->inbox.pushChain(newest, oldest)) wakeWorker(target);
+        }
+    }
+    else{
+        // 指定了线程的和要放回原来线程的单独交过去
+        size_t n = 0;
+        for(auto& fiber : fibers){
+            if(fiber->getWorker() >= 0 || stickyHome(fiber.get(), w)) schedule(std::move(fiber), WOKEN);
+            else fibers[n++] = std::move(fiber);
+        }
+        fibers.resize(n);
+        if(n == 0) return;
+        if(w){
+            for(auto& fiber : fibers) w->queues[Level(fiber.get())].push(fiber.release());
+        }
+        else{
+            std::lock_guard<std::mutex> lock(readyMutex);
+            for(auto& fiber : fibers){
+                size_t level = Level(fiber.get());
+                readyQueue[level].push_back(std::move(fiber));
+                readySize_[level].fetch_add(1, std::memory_order_release);
+            }
+        }
+        notifyIdle(n);
+    }
+    fibers.clear();
+}
+
+Fiber::ptr IOScheduler::pickNext(){
+    Worker* w = t_scheduler == this ? t_worker : nullptr;
+    if(!w) return popGlobal();
+    Fiber* raw;
+    takeInbox(w);
+    if(++w->tick % GLOBAL_INTERVAL == 0){
+        w->lifoRun = 0;
+        // 一直有协程可运行时也要收事件和到期的定时器
+        if(pinned_){
+            pollWorker(w, 0);
+            takeInbox(w);
+        }
+        else if(auto fiber = popGlobal()) return fiber;
+        for(auto& queue : w->queues){
+            if(queue.steal(raw)) return Fiber::ptr::Adopt(raw);
+        }
+    }
+    if(w->lifo){
+        if(w->lifoRun < LIFO_BUDGET){
+            ++w->lifoRun;
+            return std::move(w->lifo);
+        }
+        // 预算用完，放回队列，从最早放进去的那一端取
+        w->lifoRun = 0;
+        auto& queue = w->queues[Level(w->lifo.get())];
+        queue.push(w->lifo.release());
+        if(!pinned_) notifyIdle();
+        if(queue.steal(raw)) return Fiber::ptr::Adopt(raw);
+    }
+    w->lifoRun = 0;
+    // 按权重轮到的级别先取，没有时从高到低
+    size_t first = priorityOrder_[w->turn++ % priorityOrder_.size()];
+    if(auto fiber = popLevel(w, first)) return fiber;
+    for(size_t level=0;level<PRIORITIES;level++){
+        if(level == first) continue;
+        if(auto fiber = popLevel(w, level)) return fiber;
+    }
+    if(pinned_) return nullptr;
+    return steal(w);
+}
+
+Fiber::ptr IOScheduler::popGlobal(){
+    for(size_t level=0;level<PRIORITIES;level++){
+        if(auto fiber = popGlobal(level)) return fiber;
+    }
+    return nullptr;
+}
+
+Fiber::ptr IOScheduler::popGlobal(size_t level){
+    if(readySize_[level].load(std::memory_order_acquire) == 0) return nullptr;
+    std::lock_guard<std::mutex> lock(readyMutex);
+    if(readyQueue[level].empty()) return nullptr;
+    Fiber::ptr fiber = std::move(readyQueue[level].front());
+    readyQueue[level].pop_front();
+    readySize_[level].fetch_sub(1, std::memory_order_relaxed);
+    return fiber;
+}
+
+Fiber::ptr IOScheduler::popLevel(Worker* w, size_t level){
+    Fiber* raw;
+    if(w->queues[level].pop(raw)) return Fiber::ptr::Adopt(raw);
+    if(!w->held[level].empty()){
+        Fiber::ptr fiber = std::move(w->held[level].front());
+        w->held[level].pop_front();
+        if(!pinned_) w->inboxed.fetch_sub(1, std::memory_order_relaxed);
+        return fiber;
+    }
+    return pinned_ ? nullptr : popGlobal(level);
+}
+
+void IOScheduler::takeInbox(Worker* w){
+    while(Fiber* raw = w->inbox.pop()){
+        w->held[Level(raw)].push_back(Fiber::ptr::Adopt(raw));
+    }
+}
+
+// 从随机的一个线程开始依次试一遍
+Fiber::ptr IOScheduler::steal(Worker* w){
+    size_t n = workers.size();
+    if(n < 2) return nullptr;
+    searching_.fetch_add(1);
+    w->rng ^= w->rng << 13;
+    w->rng ^= w->rng >> 17;
+    w->rng ^= w->rng << 5;
+    size_t start = w->rng % n;
+    Fiber* raw = nullptr;
+    bool found = false;
+    // 每个线程从高到低偷一级
+    auto stealFrom = [&](Worker* victim){
+        for(auto& queue : victim->queues){
+            if(queue.steal(raw)) return true;
+        }
+        return false;
     };
-    auto call_back_task = [this](){
+    // 绑定了节点时先偷同一个节点上的，协程的栈和连接的内存在那个节点上
+    size_t peers = w->peers.size();
+    for(size_t i=0;i<peers && !found;i++){
+        Worker* victim = workers[w->peers[(start + i) % peers]].get();
+        if(victim != w) found = stealFrom(victim);
+    }
+    for(size_t i=0;i<n && !found;i++){
+        Worker* victim = workers[(start + i) % n].get();
+        if(victim != w && (peers == 0 || victim->node != w->node)) found = stealFrom(victim);
+    }
+    // 最后一个在偷的线程找到了活，可能还有剩下的，交给下一个线程接着偷
+    if(searching_.fetch_sub(1) == 1 && found) notifyIdle();
+    return found ? Fiber::ptr::Adopt(raw) : nullptr;
+}
+
+bool IOScheduler::hasWork(Worker* w){
+    if(!w->inbox.emptyApprox() || !w->heldEmpty()) return true;
+    for(auto& size : readySize_){
+        if(size.load() != 0) return true;
+    }
+    for(auto& other : workers){
+        if(!other->queuesEmpty()) return true;
+    }
+    return false;
+}
+
+// 只有收件箱从空变成非空时才需要叫醒，之前入队的已经叫过了，目标线程取空之前会看到后来的
+void IOScheduler::deliver(Worker* target, Fiber::ptr fiber){
+    if(!pinned_) target->inboxed.fetch_add(1, std::memory_order_relaxed);
+    if(target->inbox.push(fiber.release())) wakeWorker(target);
+}
+
+// 已经在上次运行它的线程上时照常进LIFO槽；那个线程积压到affinityLimit_时不放回，让它迁移
+IOScheduler::Worker* IOScheduler::stickyHome(Fiber* fiber, Worker* w){
+    if(affinityLimit_ == 0 || pinned_) return nullptr;
+    int last = fiber->getLastWorker();
+    if(last < 0) return nullptr;
+    Worker* home = workers[last].get();
+    if(home == w) return nullptr;
+    size_t backlog = home->queuedApprox() + home->inboxed.load(std::memory_order_relaxed);
+    return backlog < affinityLimit_ ? home : nullptr;
+}
+
+// 和idleWait里设置sleeping、登记空闲之后的fence配对
+void IOScheduler::wakeWorker(Worker* target){
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(t_scheduler == this && t_worker == target) return;
+    if(pinned_){
+        if(target->sleeping.load()) unpark(target);
+        return;
+    }
+    if(idle_.load() == 0) return;
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        auto it = std::find(idleWorkers.begin(), idleWorkers.end(), target);
+        // 不在空闲列表里：还在运行，或者已经被别的线程取走、通知马上就到
+        if(it == idleWorkers.end()) return;
+        idleWorkers.erase(it);
+        idle_.fetch_sub(1);
+    }
+    unpark(target);
+}
+
+// 放入协程和这里的fence，与idleWait里登记空闲和fence之后的检查配对，两边至少有一边能看到对方
+// 有线程正在偷时它会拿走一个
+void IOScheduler::notifyIdle(size_t n){
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(idle_.load() == 0) return;
+    if(searching_.load() != 0 && --n == 0) return;
+    for(; n > 0; n--){
+        Worker* w = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            if(idleWorkers.empty()) return;
+            w = idleWorkers.back();
+            idleWorkers.pop_back();
+            idle_.fetch_sub(1);
+        }
+        unpark(w);
+    }
+}
+
+void IOScheduler::idleWait(Worker* w){
+    if(spin(w)){
+        spinHits_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if(pinned_){
+        // 先执行到期的定时器，它们可能唤醒本线程的协程
+        int timeout = w->timers.process(this);
+        if(w->index == 0){
+            int global = timerHeap.process(this);
+            if(global >= 0 && (timeout < 0 || global < timeout)) timeout = global;
+        }
+        w->sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool empty = !w->lifo && w->queuesEmpty() && w->heldEmpty() && w->inbox.emptyApprox();
+        if(empty && !stop_.load()) parks_.fetch_add(1, std::memory_order_relaxed);
+        park(w, empty && !stop_.load() ? timeout : 0);
+        w->sleeping.store(false);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        idleWorkers.push_back(w);
+        idle_.fetch_add(1);
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(hasWork(w) || stop_.load()){
+        std::lock_guard<std::mutex> lock(idleMutex);
+        auto it = std::find(idleWorkers.begin(), idleWorkers.end(), w);
+        if(it != idleWorkers.end()){
+            idleWorkers.erase(it);
+            idle_.fetch_sub(1);
+            return;
+        }
+        // 已经被别的线程取走，通知马上就到
+    }
+    parks_.fetch_add(1, std::memory_order_relaxed);
+    park(w, -1);
+}
+
+// 多reactor模式下自旋时顺带收本线程的事件和到期的定时器（不等待的park，Linux上是timeout为0的epoll_wait）
+bool IOScheduler::spin(Worker* w){
+    if(spinUs_ == 0) return false;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(spinUs_);
+    do{
+        if(pinned_){
+            pollWorker(w, 0);
+            if(w->lifo || !w->queuesEmpty() || !w->heldEmpty() || !w->inbox.emptyApprox()) return true;
+        }
+        else if(hasWork(w)) return true;
+        if(stop_.load(std::memory_order_relaxed)) return false;
+        for(int i=0;i<SPIN_PAUSES;i++) cpuRelax();
+    }while(std::chrono::steady_clock::now() < deadline);
+    return false;
+}
+
+void IOScheduler::pollWorker(Worker* w, int timeoutMs){
+    w->timers.process(this);
+    if(w->index == 0) timerHeap.process(this);
+    park(w, timeoutMs);
+}
+
+void IOScheduler::park(Worker* w, int timeoutMs){
+    std::unique_lock<std::mutex> lock(w->parkMutex);
+    auto ready = [&](){ return w->notified || stop_.load(); };
+    if(timeoutMs < 0) w->parkCond.wait(lock, ready);
+    else w->parkCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), ready);
+    w->notified = false;
+}
+
+void IOScheduler::unpark(Worker* w){
+    {
+        std::lock_guard<std::mutex> lock(w->parkMutex);
+        w->notified = true;
+    }
+    w->parkCond.notify_one();
+}
+
+void IOScheduler::workerLoop(Worker* w){
+    // 在分配任何东西之前绑定，之后这个线程首次访问的内存都在本节点
+    CpuTopology::PinSelf(w->cpus);
+    t_scheduler = this;
+    t_worker = w;
+    Fiber::Hooks hooks;
+    hooks.arg = this;
+    hooks.pick_next = &IOScheduler::PickNext;
+    hooks.on_hold = &IOScheduler::OnHold;
+    hooks.sleep_until = &IOScheduler::SleepUntil;
+    hooks.on_busy = &IOScheduler::OnBusy;
+    Fiber::SetHooks(hooks);
+    while(!stop_.load(std::memory_order_relaxed)){
+        if(auto fiber = pickNext()){
+            fiber->resume();
+            continue;
+        }
+        idleWait(w);
+    }
+}
+
+Fiber::ptr IOScheduler::PickNext(void* arg){
+    return static_cast<IOScheduler*>(arg)->pickNext();
+}
+
+// 协程已经完全切出，之后才允许被唤醒
+// 切出之前就被唤醒的协程多半是在等刚切过去的协程，放进LIFO槽
+// 同时记下协程在哪个线程上运行过，和上次不同就是迁移了
+void IOScheduler::OnHold(void* arg,Fiber::ptr fiber){
+    IOScheduler* scheduler = static_cast<IOScheduler*>(arg);
+    ScheduleHint hint = t_yielding ? YIELDED : WOKEN;
+    t_yielding = false;
+    int index = static_cast<int>(t_worker->index);
+    int last = fiber->getLastWorker();
+    if(last != index){
+        if(last >= 0) scheduler->migrations_.fetch_add(1, std::memory_order_relaxed);
+        fiber->setLastWorker(index);
+    }
+    if(fiber->park()){
+        scheduler->schedule(std::move(fiber), hint);
+    }
+}
+
+// 共享栈被别的线程上的协程占着：协程没有切入过，按让出处理，排到后面，线程先跑别的协程
+void IOScheduler::OnBusy(void* arg,Fiber::ptr fiber){
+    IOScheduler* scheduler = static_cast<IOScheduler*>(arg);
+    scheduler->sharedBusy_.fetch_add(1, std::memory_order_relaxed);
+    scheduler->schedule(std::move(fiber), YIELDED);
+}
+
+void IOScheduler::SleepUntil(void* arg,std::chrono::steady_clock::time_point t){
+    static_cast<IOScheduler*>(arg)->sleepUntil(t);
+}
+
+bool IOScheduler::waitUntil(std::chrono::steady_clock::time_point deadline){
+    Fiber::ptr self = Fiber::GetThis();
+    if(!Fiber::InFiber() || t_scheduler != this){
+        throw std::runtime_error("waitUntil must be called in a fiber of this scheduler");
+    }
+    deadline = std::min(deadline, self->getDeadline());
+    if(self->interrupted() || deadline <= std::chrono::steady_clock::now()){
+        clearInterest(self.get());
+        return false;
+    }
+    if(deadline == std::chrono::steady_clock::time_point::max()){
+        self.reset();
+        suspend();
+        self = Fiber::GetThis();
+        if(!self->interrupted()) return true;
+        clearInterest(self.get());
+        return false;
+    }
+    // 共享栈协程挂起后栈会被别的协程覆盖，节点放到堆上
+    TimerNode local;
+    std::unique_ptr<TimerNode> heap;
+    TimerNode* node = &local;
+    if(self->getStackMode() == StackMode::SHARED){
+        heap.reset(new TimerNode());
+        node = heap.get();
+    }
+    node->when = deadline;
+    node->fn = &IOScheduler::OnWaitTimeout;
+    node->arg = self.get();
+    addTimer(node);
+    self.reset();
+    suspend();
+    self = Fiber::GetThis();
+    if(!cancelTimer(node)){
+        clearInterest(self.get());
+        return false;
+    }
+    if(!self->interrupted()) return true;
+    clearInterest(self.get());
+    return false;
+}
+
+void IOScheduler::sleepUntil(std::chrono::steady_clock::time_point t){
+    if(!Fiber::InFiber() || t_scheduler != this){
+        std::this_thread::sleep_until(t);
+        return;
+    }
+    while(std::chrono::steady_clock::now() < t){
+        if(!waitUntil(t) && Fiber::GetThis()->interrupted()) return;
+    }
+}
+
+// 等待的协程还在挂起，不会被回收
+void IOScheduler::OnWaitTimeout(IOScheduler* scheduler,TimerNode* node){
+    scheduler->interrupt(Fiber::ptr(static_cast<Fiber*>(node->arg)));
+}
+
+void IOScheduler::clearInterest(Fiber* fiber){
+    auto lock = lockRegistry();
+    auto term = Registry.find(fiber->getID());
+    if(term != Registry.end()) term->second.type_ = FiberDes::NONE;
+}
+
+// 被打断的协程醒来后在waitUntil里自己撤掉IO事件的登记
+void IOScheduler::interrupt(Fiber::ptr fiber){
+    wakeup(std::move(fiber));
+}
+
+int IOScheduler::nextNodeWorker(){
+    Worker* w = t_scheduler == this ? t_worker : nullptr;
+    if(!w || w->peers.empty()) return -1;
+    return static_cast<int>(w->peers[w->peerNext++ % w->peers.size()]);
+}
+
+IOScheduler::ShutdownReport IOScheduler::shutdown(std::chrono::steady_clock::time_point deadline, std::chrono::milliseconds grace){
+    if(t_scheduler == this){
+        throw std::runtime_error("shutdown must not be called on a thread of this scheduler");
+    }
+    if(shutdown_.exchange(true)){
+        throw std::runtime_error("scheduler already shut down");
+    }
+    ShutdownReport report;
+    uint64_t before = exited_.load();
+    bool all = waitLive(deadline);
+    report.finished = static_cast<size_t>(exited_.load() - before);
+    if(!all){
+        report.cancelled = cancelAll();
+        LOG_STREAM<<"shutdown cancel "<<std::to_string(report.cancelled)<<" fibers"<<INFOLOG;
+        waitLive(std::chrono::steady_clock::now() + grace);
+    }
+    stopThreads();
+    // 线程都停了，剩下的协程不会再运行
+    {
+        auto lock = lockRegistry();
+        report.abandoned = Registry.size();
+        Registry.clear();
+        live_.store(0);
+    }
+    return report;
+}
+
+// 协程结束时不通知，停止时才用，隔一毫秒看一次
+bool IOScheduler::waitLive(std::chrono::steady_clock::time_point deadline){
+    while(live_.load() != 0){
+        if(std::chrono::steady_clock::now() >= deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// 先在锁里取出来再取消，唤醒时不持有注册表的锁
+size_t IOScheduler::cancelAll(){
+    std::vector<Fiber::ptr> fibers;
+    {
+        auto lock = lockRegistry();
+        fibers.reserve(Registry.size());
+        for(auto& term : Registry) fibers.push_back(term.second.fiber_);
+    }
+    for(auto& fiber : fibers){
+        fiber->cancel();
+        interrupt(fiber);
+    }
+    return fibers.size();
+}
+
+void IOScheduler::wakeupOn(size_t worker, Fiber::ptr fiber){
+    if(worker >= workers.size()){
+        throw std::runtime_error("worker out of range when wakeupOn");
+    }
+    fiber->setWorker(static_cast<int>(worker));
+    if(fiber->notify()) schedule(std::move(fiber), WOKEN);
+}
+
+CancelToken IOScheduler::cancelToken(){
+    if(!Fiber::InFiber()){
+        throw std::runtime_error("cancelToken must be called in a fiber");
+    }
+    return CancelToken(this, Fiber::GetThis());
+}
+
+void CancelToken::cancel(){
+    if(!fiber_) return;
+    fiber_->cancel();
+    // 已经结束的协程不会再挂起，唤醒只是改一下状态
+    scheduler_->interrupt(fiber_);
+}
+
+// 多reactor模式下定时器放在当前工作线程自己的堆里，由它在epoll_wait前处理，不需要叫醒别的线程
+void IOScheduler::addTimer(TimerNode* node){
+    Worker* w = t_scheduler == this ? t_worker : nullptr;
+    TimerHeap* heap = pinned_ && w ? &w->timers : &timerHeap;
+    if(heap->add(node) && heap == &timerHeap) tickle();
+}
+
+bool IOScheduler::cancelTimer(TimerNode* node){
+    return node->heap ? node->heap->cancel(node) : false;
+}
+
+bool TimerHeap::add(TimerNode* node){
+    std::lock_guard<std::mutex> lock(mutex);
+    node->heap = this;
+    node->index = timers.size();
+    timers.push_back(node);
+    siftUp(node->index);
+    return node->index == 0;
+}
+
+bool TimerHeap::cancel(TimerNode* node){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(node->index == TimerNode::NPOS) return false;
+    removeAt(node->index);
+    return true;
+}
+
+int TimerHeap::process(IOScheduler* scheduler){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(timers.empty()) return -1;
+    auto now = std::chrono::steady_clock::now();
+    while(!timers.empty() && timers.front()->when <= now){
+        TimerNode* node = timers.front();
+        removeAt(0);
+        node->fn(scheduler,node);
+    }
+    if(timers.empty()) return -1;
+    // 向上取整，不会提前醒来
+    auto ms = std::chrono::ceil<std::chrono::milliseconds>(timers.front()->when - now).count();
+    return ms > INT_MAX ? INT_MAX : static_cast<int>(ms);
+}
+
+void TimerHeap::siftUp(size_t i){
+    TimerNode* node = timers[i];
+    while(i > 0){
+        size_t parent = (i - 1) / 2;
+        if(timers[parent]->when <= node->when) break;
+        timers[i] = timers[parent];
+        timers[i]->index = i;
+        i = parent;
+    }
+    timers[i] = node;
+    node->index = i;
+}
+
+void TimerHeap::siftDown(size_t i){
+    TimerNode* node = timers[i];
+    size_t n = timers.size();
+    while(true){
+        size_t child = 2 * i + 1;
+        if(child >= n) break;
+        if(child + 1 < n && timers[child + 1]->when < timers[child]->when) ++child;
+        if(node->when <= timers[child]->when) break;
+        timers[i] = timers[child];
+        timers[i]->index = i;
+        i = child;
+    }
+    timers[i] = node;
+    node->index = i;
+}
+
+void TimerHeap::removeAt(size_t i){
+    timers[i]->index = TimerNode::NPOS;
+    TimerNode* last = timers.back();
+    timers.pop_back();
+    if(i == timers.size()) return;
+    timers[i] = last;
+    last->index = i;
+    siftDown(i);
+    siftUp(last->index);
+}
+
+//添加一个任务,调度队列已经保证线程安全
+template<typename F,typename... Args,typename>
+void IOScheduler::addTask(F&& f,Args&&... args){
+    addTask(FiberOption(),std::forward<F>(f),std::forward<Args>(args)...);
+}
+
+template<typename F,typename... Args>
+void IOScheduler::addTask(const FiberOption& option,F&& f,Args&&... args){
+    schedule(createTask(option,std::forward<F>(f),std::forward<Args>(args)...));
+}
+
+template<typename F,typename... Args,typename>
+void IOScheduler::addTaskOn(size_t worker,F&& f,Args&&... args){
+    addTaskOn(worker,FiberOption(),std::forward<F>(f),std::forward<Args>(args)...);
+}
+
+template<typename F,typename... Args>
+void IOScheduler::addTaskOn(size_t worker,const FiberOption& option,F&& f,Args&&... args){
+    if(worker >= workers.size()){
+        throw std::runtime_error("worker out of range when addTaskOn");
+    }
+    Fiber::ptr work_fiber = createTask(option,std::forward<F>(f),std::forward<Args>(args)...);
+    work_fiber->setWorker(static_cast<int>(worker));
+    schedule(std::move(work_fiber));
+}
+
+template<typename F,typename... Args>
+Fiber::ptr IOScheduler::createTask(const FiberOption& option,F&& f,Args&&... args){
+    // 1. 创建fiber，结束的协程会回到线程本地的对象池，这里优先复用
+    Fiber::ptr work_fiber = Fiber::Create(option,std::forward<F>(f),std::forward<Args>(args)...);
+    work_fiber->setCallBack([this](){
         this->exit();
-    };
-    work_fiber->setCallBack(call_back_task);
+    });
     
     // 2. 维护记录
     {
         auto f_id = work_fiber->getID();
-        std::lock_guard<std::mutex> lock(registryMutex);
-        Registry[f_id] = std::make_shared<FiberDes>(work_fiber);
+        auto lock = lockRegistry();
+        Registry.emplace(f_id,FiberDes(work_fiber));
+        live_.fetch_add(1, std::memory_order_relaxed);
     }
-    // 3. 推入线程池
-    threadPool.enqueue(rtask,work_fiber);
+    LOG_STREAM<<"Fiber "<< std::to_string(work_fiber->getID())<<" start"<<DEBUGLOG;
+    return work_fiber;
 }
 
 static std::shared_ptr<IOScheduler> globalScheduler = nullptr;
@@ -172,20 +1291,22 @@ static std::shared_ptr<IOScheduler> globalScheduler = nullptr;
 // CreateIoCompletionPort用于创建一个端口
 class WinIOScheduler : public IOScheduler {
 public:
-    WinIOScheduler(size_t threadCount = 1) :IOScheduler(threadCount){
+    WinIOScheduler(const SchedulerOption& option = SchedulerOption()) :IOScheduler(option){
         iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
         if (iocp == NULL) {
             throw std::runtime_error("Failed to create IO Completion Port");
         }
+        startWorkers();
         //  启动一个调度线程
         worker = std::thread(&WinIOScheduler::run, this);
     }
 
     ~WinIOScheduler() {
+        stopWorkers();
         CloseHandle(iocp);
     }
 
-    void addEvent(int fd, uint32_t events, std::shared_ptr<Fiber> fiber) override {
+    void addEvent(int fd, uint32_t events, Fiber::ptr fiber) override {
         
 
         std::lock_guard<std::mutex> lock(registryMutex);
@@ -217,10 +1338,7 @@ private:
                 if (fiber) {
                     LOG_STREAM<<"fiber "<<std::to_string(fiber->getID())<<"get event"<<std::to_string(bytesTransferred)<<DEBUGLOG;
                     fiber->setIORes(bytesTransferred);
-                    auto rtask = [](Fiber* fiber){
-                        fiber->resume();
-                    };
-                    threadPool.enqueue(rtask,fiber);
+                    wakeup(Fiber::ptr(fiber));
                 }
             }
         }
@@ -228,113 +1346,797 @@ private:
 
     std::thread worker;
     HANDLE iocp;
-    std::unordered_map<int, std::shared_ptr<Fiber>> fdRegistry; // 注册表
+    std::unordered_map<int, Fiber::ptr> fdRegistry; // 注册表
     std::mutex registryMutex; // 保护注册表的互斥锁
 };
 
 #else
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
+#include "fd_registry.h"
+#include "uring.h"
+
 // Linux 平台的 IO 协程调度器
+// 默认一个事件线程收集所有fd的事件；多reactor模式下每个工作线程一个epoll，fd注册在调用addEvent的线程上，
+// 由这个线程自己在空闲时或者每隔一段调度收事件，唤醒的协程直接放进本线程的队列
 class LinuxIOScheduler : public IOScheduler {
 public:
-    LinuxIOScheduler(size_t threadCount = 1):IOScheduler(threadCount),epollFd(epoll_create1(0)){
-        if (epollFd == -1) {
-            throw std::runtime_error("Failed to create epoll instance");
-        }
-        worker = std::thread(&LinuxIOScheduler::run, this);
-    }
+    LinuxIOScheduler(const SchedulerOption& option = SchedulerOption()):LinuxIOScheduler(option, true){}
 
+    // 先停掉所有线程再关闭epoll
     ~LinuxIOScheduler() {
-        close(epollFd);
+        LinuxIOScheduler::stopThreads();
+        for (auto& reactor : reactors) {
+            close(reactor.epollFd);
+            close(reactor.wakeFd);
+            // 还没执行的任务直接丢弃
+            while (ReactorTask* task = reactor.tasks.pop()) delete task;
+        }
     }
 
-    // 使用一个表来防止重复注册
+    // 等待fd上的事件，之后调用wait挂起
+    // fd第一次等待时按边沿触发一次注册读写和对端关闭（REGISTER_MASK），之后不管等读还是等写都只改登记表，不再调用epoll_ctl；
+    // 只有要等REGISTER_MASK以外的事件（比如EPOLLPRI）时才EPOLL_CTL_MOD一次。传进来的EPOLLET/EPOLLONESHOT等标志不起作用，总是边沿触发
+    // 同一个fd上可以一个协程等读、一个协程等写；fd关闭前需要调用rmEvent，否则fd被复用后会以为已经注册过
     void addEvent(int fd, uint32_t events) override {
-        // 检查协程
-        if(!checkFiber()){
-            throw std::runtime_error("Fiber has been deleted when addEvent");
+        Fiber::ptr self = Fiber::GetThis();
+        if(!Fiber::InFiber()){
+            throw std::runtime_error("addEvent must be called in a fiber");
         }
-        std::lock_guard<std::mutex> lock(registryMutex);
-        auto f_id = Fiber::GetThis()->getID();
-        auto term = Registry.find(f_id);
-        auto fiber_des = term->second;
-        auto fd_state = EpollRegitry.find(fd);
-        // 查询是否注册过epoll
-        if(fd_state != EpollRegitry.end() && (fd_state->second)&events != 0){ // 注册过就直接修改描述符
-            if(events&EPOLLIN != 0) fiber_des->type_ = FiberDes::READ;
-            if(events&EPOLLOUT != 0) fiber_des->type_ = FiberDes::WRITE;
-            return; 
-        }
-        else{       // 否则进入注册流程
-            // 1.注册到epoll
+        FdRegistry::Slot* slot = fds.get(fd);
+        if(!slot){
+            throw std::runtime_error("fd out of range when addEvent");
+        }
+        uint32_t interest = events & ~(EPOLLET | EPOLLONESHOT | EPOLLEXCLUSIVE);
+        // 对端关闭写端时读也要醒
+        if(interest & EPOLLIN) interest |= EPOLLRDHUP;
+        uint32_t mask = slot->mask.load(std::memory_order_acquire);
+        uint32_t need = interest & ~FdRegistry::ALWAYS;
+        if(!mask || (mask & need) != need){
+            registerFd(currentReactor(), fd, slot, mask | need | REGISTER_MASK);
+        }
+        self->setWaitFd(fd);
+        // 事件在登记之前已经到了，或者同一边原来的等待方被顶掉，都要唤醒
+        FdRegistry::arm(slot, std::move(self), interest, [this](Fiber::ptr fiber){ wakeup(std::move(fiber)); });
+    }
+    // fd关闭前调用，还在等这个fd的协程会被唤醒，之后旧注册残留的事件都被丢掉
+    void rmEvent(int fd) override{
+        FdRegistry::Slot* slot = fds.find(fd);
+        if(!slot) return;
+        FdRegistry::reset(slot, [this](Fiber::ptr fiber){ wakeup(std::move(fiber)); });
+    }
+    //--在指定reactor的线程上执行fn：默认只有一个reactor，是事件线程；多reactor模式下下标和工作线程一致
+    //  无锁入队，队列从空变成非空时写一次eventfd叫醒它；fn在那个线程收完一轮事件时运行，不能挂起
+    //  下标超出范围时抛出异常
+    void runInReactor(size_t reactor, std::function<void()> fn) {
+        if (reactor >= reactors.size()) {
+            throw std::runtime_error("reactor out of range when runInReactor");
+        }
+        ReactorTask* task = new ReactorTask();
+        task->fn = std::move(fn);
+        if (reactors[reactor].tasks.push(task)) wake(reactors[reactor]);
+    }
+    size_t reactorCount() const { return reactors.size(); }
+    //--调用过的epoll_ctl次数（不算构造时注册eventfd的）
+    uint64_t ctlCount() const { return ctlCalls.load(std::memory_order_relaxed); }
+    //--epoll_wait的调用次数和一共收到的事件数（包括打断等待的eventfd），相除就是平均每次收到多少事件
+    uint64_t waitCount() const {
+        uint64_t total = 0;
+        for (auto& reactor : reactors) total += reactor.waits.load(std::memory_order_relaxed);
+        return total;
+    }
+    uint64_t eventCount() const {
+        uint64_t total = 0;
+        for (auto& reactor : reactors) total += reactor.harvested.load(std::memory_order_relaxed);
+        return total;
+    }
+
+protected:
+    //--threads为false时不启动工作线程和事件线程，由派生类在自己的线程上运行
+    LinuxIOScheduler(const SchedulerOption& option, bool threads):IOScheduler(option),reactors(pinned_ ? workers.size() : 1),busyPollUs_(option.busyPollUs){
+        for (auto& reactor : reactors) {
+            reactor.events.resize(MIN_EVENTS);
+            reactor.epollFd = epoll_create1(EPOLL_CLOEXEC);
+            if (reactor.epollFd == -1) {
+                throw std::runtime_error("Failed to create epoll instance");
+            }
+            // 定时器提前、其他线程交来协程或者任务时用eventfd打断epoll_wait
+            reactor.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (reactor.wakeFd == -1) {
+                throw std::runtime_error("Failed to create eventfd");
+            }
             epoll_event ev;
-            ev.events = events;
-            ev.data.ptr = reinterpret_cast<void*>(f_id);
-            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            ev.events = EPOLLIN;
+            ev.data.ptr = reinterpret_cast<void*>(TICKLE_ID);
+            if (epoll_ctl(reactor.epollFd, EPOLL_CTL_ADD, reactor.wakeFd, &ev) == -1) {
+                throw std::runtime_error("Failed to add eventfd to epoll");
+            }
+        }
+        if (!threads) return;
+        startWorkers();
+        if (!pinned_) worker = std::thread(&LinuxIOScheduler::run, this);
+    }
+
+    void tickle() override {
+        wake(reactors[0]);
+    }
+
+    void stopThreads() override {
+        stopWorkers();
+        wake(reactors[0]);
+        if (worker.joinable()) worker.join();
+    }
+
+    void clearInterest(Fiber* fiber) override {
+        FdRegistry::Slot* slot = fds.find(fiber->getWaitFd());
+        if(slot) FdRegistry::disarm(slot, fiber);
+        fiber->setWaitFd(-1);
+    }
+
+    // 多reactor模式下工作线程空闲时阻塞在自己的epoll_wait上
+    void park(Worker* w, int timeoutMs) override {
+        if (!pinned_) {
+            IOScheduler::park(w, timeoutMs);
+            return;
+        }
+        poll(reactors[w->index], timeoutMs);
+    }
+
+    void unpark(Worker* w) override {
+        if (!pinned_) IOScheduler::unpark(w);
+        else wake(reactors[w->index]);
+    }
+
+private:
+    static const uint64_t TICKLE_ID = UINT64_MAX; // FdRegistry::Key不会产生这个值
+    // 一次epoll_wait最多收的事件数在这个范围里随负载调整
+    static const size_t MIN_EVENTS = 16;
+    static const size_t MAX_EVENTS = 256;
+    static const int SHRINK_AFTER = 8; // 连续这么多次收到的不到四分之一才缩小
+    // fd第一次等待时一次注册好的事件
+    static const uint32_t REGISTER_MASK = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+
+    struct ReactorTask {
+        ReactorTask* next = nullptr;
+        std::function<void()> fn;
+    };
+
+    // 只由所属线程（事件线程或者工作线程）等待和分发，计数给其他线程读
+    struct alignas(64) Reactor {
+        int epollFd = -1;
+        int wakeFd = -1;
+        std::vector<epoll_event> events;
+        int lowWaits = 0;              // 连续收得很少的次数
+        std::vector<Fiber::ptr> woken; // 一次收到的事件唤醒的协程，攒起来一起交给调度
+        MpscQueue<ReactorTask, &ReactorTask::next> tasks; // runInReactor交来的任务，其他线程入队
+        std::atomic<uint64_t> waits {0};
+        std::atomic<uint64_t> harvested {0};
+    };
+
+    // 注册或者扩大fd的事件；多reactor模式下fd注册在另一个线程的epoll上时再注册到当前线程的epoll
+    void registerFd(Reactor& reactor, int fd, FdRegistry::Slot* slot, uint32_t mask) {
+        epoll_event ev;
+        ev.events = mask;
+        ev.data.u64 = FdRegistry::Key(fd, slot->gen.load(std::memory_order_acquire));
+        int op = slot->mask.load(std::memory_order_acquire) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        if (op == EPOLL_CTL_ADD && busyPollUs_) setBusyPoll(fd);
+        ctlCalls.fetch_add(1, std::memory_order_relaxed);
+        if (epoll_ctl(reactor.epollFd, op, fd, &ev) == -1) {
+            // 别的线程刚注册过，或者注册在另一个epoll上
+            op = errno == EEXIST ? EPOLL_CTL_MOD : errno == ENOENT ? EPOLL_CTL_ADD : -1;
+            if (op != -1) ctlCalls.fetch_add(1, std::memory_order_relaxed);
+            if (op == -1 || epoll_ctl(reactor.epollFd, op, fd, &ev) == -1) {
                 LOG_STREAM<<"epoll add error "<<errno<<ERRORLOG;
                 throw std::runtime_error("Failed to add event to epoll");
             }
-            // 2.维护注册表
-            if(fd_state == EpollRegitry.end()) EpollRegitry[fd] = events;
-            else EpollRegitry[fd] = EpollRegitry[fd] | events;
-            if(events&EPOLLIN != 0) fiber_des->type_ = FiberDes::READ;
-            if(events&EPOLLOUT != 0) fiber_des->type_ = FiberDes::WRITE;
         }
+        slot->mask.fetch_or(mask, std::memory_order_acq_rel);
     }
-    // 销毁持有的套接字
-    void rmEvent(int fd) override{
-        std::lock_guard<std::mutex> lock(registryMutex);
-        auto fd_state = EpollRegitry.find(fd);
-        if(fd_state != EpollRegitry.end()){
-            EpollRegitry.erase(fd); 
+
+    // 不是套接字或者没有权限时失败，忽略
+    void setBusyPoll(int fd) {
+#ifdef SO_BUSY_POLL
+        int us = static_cast<int>(busyPollUs_);
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) == -1) {
+            LOG_STREAM<<"fd "<<std::to_string(fd)<<" SO_BUSY_POLL failed "<<std::to_string(errno)<<DEBUGLOG;
         }
+#else
+        (void)fd;
+#endif
+    }
+
+    Reactor& currentReactor() {
+        if (!pinned_) return reactors[0];
+        if (t_scheduler != this || !t_worker) {
+            throw std::runtime_error("addEvent must be called in a fiber of this scheduler");
+        }
+        return reactors[t_worker->index];
+    }
+
+    static void wake(Reactor& reactor) {
+        uint64_t one = 1;
+        ssize_t n = write(reactor.wakeFd, &one, sizeof(one));
+        (void)n; // 计数满了也照样能打断epoll_wait
     }
 
-private:
     void run() {
-        epoll_event events[10];
-        while (true) {
-            int nfds = epoll_wait(epollFd, events, 10, -1);
-            if (nfds == -1) {
-                LOG_STREAM<<"epoll_wait error "<<errno<<ERRORLOG;
-                continue;
+        CpuTopology::PinSelf(eventCpus_);
+        while (!stop_.load(std::memory_order_relaxed)) {
+            int timeout = processTimers();
+            if (timeout != 0 && spinPoll(reactors[0])) continue;
+            if (timeout != 0) parks_.fetch_add(1, std::memory_order_relaxed);
+            poll(reactors[0], timeout);
+        }
+    }
+
+    // 事件线程阻塞之前先用不等待的epoll_wait自旋spinUs_微秒，收到事件返回true
+    bool spinPoll(Reactor& reactor) {
+        if (spinUs_ == 0) return false;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(spinUs_);
+        do {
+            if (poll(reactor, 0) > 0) {
+                spinHits_.fetch_add(1, std::memory_order_relaxed);
+                return true;
             }
-            else{
-                for (int i = 0; i < nfds; ++i) {
-                    uint64_t f_id = reinterpret_cast<uint64_t>(events[i].data.ptr);
-                    auto fiber_events = events[i].events;
-                    if(!checkFiber(f_id)){
-                        throw std::runtime_error("Fiber has been deleted when resume");
-                    }
-                    auto term = Registry.find(f_id);
-                    auto fiber_des = term->second;
-                    // 确认是同类型的事件才唤醒
-                    if(
-                        (fiber_events&EPOLLIN != 0 && fiber_des->type_ == FiberDes::READ)
-                        ||
-                        (fiber_events&EPOLLOUT != 0 && fiber_des->type_ == FiberDes::WRITE)
-                        ||
-                        (fiber_events&EPOLLHUP || fiber_events&EPOLLERR)
-                    ) {
-                        fiber_des->type_ = FiberDes::NONE;
-                        LOG_STREAM<<"fiber "<<std::to_string(f_id)<<" get event "<<std::to_string(fiber_events)<<DEBUGLOG;
-                        auto rtask = [](Fiber* fiber){
-                            fiber->resume();
-                        };
-                        threadPool.enqueue(rtask,fiber_des->fiber_.get());
-                    }
-                }
+            for (int i = 0; i < SPIN_PAUSES; i++) cpuRelax();
+        } while (std::chrono::steady_clock::now() < deadline);
+        return false;
+    }
+
+    // 等一次事件并分发，返回收到的事件数；收满了就把数组加倍，连续SHRINK_AFTER次收到的不到四分之一就减半
+    int poll(Reactor& reactor, int timeoutMs) {
+        size_t size = reactor.events.size();
+        int nfds = epoll_wait(reactor.epollFd, reactor.events.data(), static_cast<int>(size), timeoutMs);
+        if (nfds == -1) {
+            if (errno != EINTR) LOG_STREAM<<"epoll_wait error "<<errno<<ERRORLOG;
+            return 0;
+        }
+        reactor.waits.fetch_add(1, std::memory_order_relaxed);
+        reactor.harvested.fetch_add(nfds, std::memory_order_relaxed);
+        dispatch(reactor, reactor.events.data(), nfds);
+        if (static_cast<size_t>(nfds) == size && size < MAX_EVENTS) {
+            reactor.events.resize(size * 2);
+            reactor.lowWaits = 0;
+        }
+        else if (static_cast<size_t>(nfds) < size / 4 && size > MIN_EVENTS) {
+            if (++reactor.lowWaits >= SHRINK_AFTER) {
+                reactor.events.resize(size / 2);
+                reactor.events.shrink_to_fit();
+                reactor.lowWaits = 0;
+            }
+        }
+        else reactor.lowWaits = 0;
+        return nfds;
+    }
+
+    // 唤醒的协程攒到最后一次交给调度，每个队列只加一次锁、每个线程只叫醒一次
+    // eventfd先读掉再取任务，取空之后再交来的任务会重新写eventfd
+    void dispatch(Reactor& reactor, epoll_event* events, int nfds) {
+        bool tickled = false;
+        for (int i = 0; i < nfds; ++i) {
+            uint64_t key = events[i].data.u64;
+            if(key == TICKLE_ID){
+                uint64_t count;
+                ssize_t n = read(reactor.wakeFd, &count, sizeof(count));
+                (void)n;
+                tickled = true;
+                continue;
             }
+            // fd已经关闭（可能又被复用了），旧注册残留的事件直接丢弃
+            int fd = FdRegistry::KeyFd(key);
+            FdRegistry::Slot* slot = fds.find(fd);
+            if(!slot || slot->gen.load(std::memory_order_acquire) != FdRegistry::KeyGen(key)) continue;
+            FdRegistry::fire(slot, events[i].events, [&reactor, fd](Fiber::ptr fiber){
+                LOG_STREAM<<"fd "<<std::to_string(fd)<<" wake fiber "<<std::to_string(fiber->getID())<<DEBUGLOG;
+                if(fiber->notify()) reactor.woken.push_back(std::move(fiber));
+            });
+        }
+        scheduleBatch(reactor.woken);
+        if (!tickled) return;
+        while (ReactorTask* task = reactor.tasks.pop()) {
+            std::unique_ptr<ReactorTask> owner(task);
+            task->fn();
         }
     }
 
-    int epollFd;
+    std::vector<Reactor> reactors; // 多reactor模式下每个工作线程一个，下标和工作线程一致；否则只有事件线程的一个
+    FdRegistry fds;
+    uint32_t busyPollUs_;
+    std::atomic<uint64_t> ctlCalls {0};
     std::thread worker; 
-    std::unordered_map<int,int> EpollRegitry; //避免epoll重复注册
 };
+
+/*
+    单线程的IO协程调度器（SchedulerOption::local）
+    不创建任何线程，调用run()的线程就是唯一的工作线程：收事件、执行定时器、运行协程都在这个线程上，唤醒和切换不经过别的线程；
+    布局和只有一个线程的多reactor模式一样（一个epoll，本线程唤醒的协程直接进自己的队列），注册表不加锁
+    run()之前和在run()的线程上可以addTask；其他线程只能唤醒协程（同步原语、卸载池交回结果），新任务用runInReactor(0, fn)交过来
+    要用多个核时开多个进程，HttpServer的监听套接字带SO_REUSEPORT，由内核把连接分给各进程
+*/
+class LocalScheduler : public LinuxIOScheduler {
+public:
+    LocalScheduler(const SchedulerOption& option = SchedulerOption()):LinuxIOScheduler(Local(option), false){}
+    //--在调用线程上运行，stop()之后返回；不能在别的调度器的工作线程上调用，也不能同时在两个线程上运行
+    //  返回后这个线程不再属于调度器，还没结束的协程留在调度器里，析构时丢弃
+    void run() {
+        if (t_scheduler || running_.exchange(true)) {
+            throw std::runtime_error("LocalScheduler::run on a scheduler thread or already running");
+        }
+        workerLoop(workers[0].get());
+        t_scheduler = nullptr;
+        t_worker = nullptr;
+        Fiber::SetHooks(Fiber::Hooks());
+        running_.store(false);
+    }
+    //--让run()返回，可以在任意线程或者协程里调用，正在运行的协程挂起后生效；停止之后再run()会直接返回
+    void stop() {
+        stop_.store(true);
+        unpark(workers[0].get());
+    }
+
+protected:
+    // 停止并等run()返回
+    void stopThreads() override {
+        stop();
+        while (running_.load()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        stopWorkers();
+    }
+    // 注册表只能由运行的线程访问，交给它去取消；没有在运行时直接取消
+    size_t cancelAll() override {
+        if (!running_.load()) return LinuxIOScheduler::cancelAll();
+        auto done = std::make_shared<std::promise<size_t>>();
+        std::future<size_t> count = done->get_future();
+        runInReactor(0, [this, done]{ done->set_value(LinuxIOScheduler::cancelAll()); });
+        // 运行的线程卡住了就算了，之后停不下来的协程都会被丢掉
+        if (count.wait_for(std::chrono::seconds(1)) != std::future_status::ready) return 0;
+        return count.get();
+    }
+
+private:
+    static SchedulerOption Local(SchedulerOption option) {
+        option.local = true;
+        return option;
+    }
+    std::atomic<bool> running_ {false};
+};
+
+/*
+    io_uring的IO协程调度器
+    每个工作线程一个环，总是多reactor的布局：协程固定在一个线程上，它提交的请求在这个线程的环上完成，
+    环的提交和收割都只在所属线程进行，不需要加锁
+    套接字的读写、accept、connect直接提交给内核，完成后唤醒协程，不再先等就绪、醒来再调一次系统调用；
+    填好的请求先攒着，线程空闲停下来、每GLOBAL_INTERVAL次调度收一次事件或者攒够SUBMIT_BATCH条时才一次enter交给内核，
+    完成的条目也是一次收割完
+    读写过的fd注册成固定文件（下标就是fd），之后的请求内核不用再查fd表、增减文件引用；fd关闭前必须rmEvent注销
+    监听fd用multishot accept，提交一次一直接受连接，还没被取走的连接排在本线程的队列里
+    addEvent用一次性的poll实现，给还需要就绪通知的地方（共享栈协程、TLS等）用
+*/
+class UringIOScheduler : public IOScheduler {
+public:
+    UringIOScheduler(const SchedulerOption& option = SchedulerOption());
+    ~UringIOScheduler();
+    //--内核是否支持需要的功能，只检查一次
+    static bool Supported();
+
+    void addEvent(int fd, uint32_t events) override;
+    // fd关闭前调用：取消fd上还在进行的请求（等待方会被唤醒），注销固定文件
+    void rmEvent(int fd) override;
+
+    bool completionIO() override;
+    ssize_t ioRead(int fd, void* buf, size_t len) override;
+    ssize_t ioWrite(int fd, const void* buf, size_t len) override;
+    int ioAccept(int fd, sockaddr* addr, socklen_t* len) override;
+    int ioConnect(int fd, const sockaddr* addr, socklen_t len) override;
+
+protected:
+    void tickle() override { wake(reactors[0]); }
+    void clearInterest(Fiber* fiber) override;
+    // 工作线程空闲时阻塞在自己的环上，同时把攒着的请求交给内核
+    void park(Worker* w, int timeoutMs) override;
+    void unpark(Worker* w) override { wake(reactors[w->index]); }
+
+private:
+    static const unsigned RING_ENTRIES = 256;
+    static const unsigned SUBMIT_BATCH = 32;
+    static const size_t MAX_FILES = 65536;
+    // user_data的低两位区分完成的是什么；0是不需要处理的（取消请求自己的完成）
+    static const uint64_t TAG_OP = 0, TAG_POLL = 1, TAG_ACCEPT = 2, TAG_MASK = 3;
+    static const uint64_t WAKE_ID = 3;
+    // 每个fd在每个环上的状态：注册成了固定文件、有过poll，低位是进行中的请求数
+    static const uint32_t FD_FIXED = 1u << 31, FD_POLLED = 1u << 30, FD_COUNT = FD_POLLED - 1;
+
+    // 一次读写类的请求，放在发起的协程栈上，协程等到它完成才返回
+    struct Op {
+        Fiber* fiber;
+        int fd;
+        int res = 0;
+        bool done = false;
+    };
+    // 一个监听fd上的multishot accept
+    struct AcceptStream {
+        int fd;
+        std::deque<int> ready;   // 已经接受、还没取走的连接
+        Fiber* waiter = nullptr; // 在ioAccept里等的协程
+        bool armed = false;
+        bool closed = false;     // 被rmEvent取消了，fd号之后可能被复用
+        int error = 0;
+    };
+    struct Reactor {
+        std::unique_ptr<Uring> ring;
+        int wakeFd = -1;
+        uint64_t wakeBuf = 0;
+        bool wakeArmed = false;
+        size_t inflight = 0; // 之后还会有完成条目的请求数
+        std::unique_ptr<std::atomic<uint32_t>[]> files; // 按fd下标
+        std::unordered_map<int, std::unique_ptr<AcceptStream>> accepts;
+    };
+
+    static SchedulerOption Pinned(SchedulerOption option){
+        option.multiReactor = true;
+        return option;
+    }
+    Reactor& currentReactor();
+    std::atomic<uint32_t>* fileState(Reactor& reactor, int fd){
+        return fd >= 0 && static_cast<size_t>(fd) < fileCount ? &reactor.files[fd] : nullptr;
+    }
+    //--取一个提交条目并填好opcode和fd，fixed为true时用固定文件
+    io_uring_sqe* prepare(Reactor& reactor, uint8_t opcode, int fd, bool fixed);
+    //--填好了一条，攒够一批就提交
+    void submitted(Reactor& reactor);
+    void flush(Reactor& reactor);
+    //--挂起到请求完成，被打断时取消它并等内核交回结果
+    ssize_t await(Reactor& reactor, Op& op);
+    void cancel(Reactor& reactor, uint64_t userData);
+    void reap(Reactor& reactor, bool draining);
+    //--处理一个完成条目，draining时调度器在析构，只释放资源不唤醒
+    void complete(Reactor& reactor, const io_uring_cqe* cqe, bool draining);
+    static void wake(Reactor& reactor);
+
+    std::vector<Reactor> reactors; // 下标和工作线程一致
+    size_t fileCount = 0;          // 每个环的fd状态表和固定文件表的大小
+    bool fixedFiles = true;
+};
+
+UringIOScheduler::UringIOScheduler(const SchedulerOption& option):IOScheduler(Pinned(option)){
+    rlimit limit;
+    fileCount = MAX_FILES;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < fileCount) fileCount = limit.rlim_cur;
+    reactors.resize(workers.size());
+    for(auto& reactor : reactors){
+        reactor.ring.reset(new Uring(RING_ENTRIES));
+        // 读它的请求一直挂在环上，其他线程写它来打断等待；不能设非阻塞，否则读会直接返回EAGAIN
+        reactor.wakeFd = eventfd(0, EFD_CLOEXEC);
+        if(reactor.wakeFd == -1){
+            throw std::runtime_error("Failed to create eventfd");
+        }
+        reactor.files.reset(new std::atomic<uint32_t>[fileCount]);
+        for(size_t i=0;i<fileCount;i++) reactor.files[i].store(0, std::memory_order_relaxed);
+        if(fixedFiles && reactor.ring->registerFiles(fileCount) < 0){
+            LOG_STREAM<<"io_uring register files failed, use plain fds"<<INFOLOG;
+            fixedFiles = false;
+        }
+    }
+    startWorkers();
+}
+
+UringIOScheduler::~UringIOScheduler(){
+    stopWorkers();
+    // 工作线程都停了，取消环上剩下的请求，收割完释放它们持有的协程引用和连接
+    for(auto& reactor : reactors){
+        reactor.ring->enter(0, 0);
+        reactor.ring->syncCancel(-1, IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL);
+        for(int i=0;i<100 && reactor.inflight>0;i++){
+            reactor.ring->enter(1, 10);
+            reap(reactor, true);
+        }
+        for(auto& stream : reactor.accepts){
+            for(int fd : stream.second->ready) close(fd);
+        }
+        reactor.ring.reset();
+        close(reactor.wakeFd);
+    }
+}
+
+// 等待的超时（5.11）、完成条目不丢（5.5）、同步取消（6.0，同时保证有multishot accept）
+bool UringIOScheduler::Supported(){
+    static const bool supported = [](){
+        try{
+            Uring ring(8);
+            unsigned need = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP | IORING_FEAT_SUBMIT_STABLE;
+            if((ring.features() & need) != need){
+                LOG_STREAM<<"io_uring lacks required features"<<INFOLOG;
+                return false;
+            }
+            if(ring.syncCancel(ring.fd(), IORING_ASYNC_CANCEL_FD) != -ENOENT){
+                LOG_STREAM<<"io_uring lacks sync cancel"<<INFOLOG;
+                return false;
+            }
+            return true;
+        }catch(const std::exception& e){
+            LOG_STREAM<<"io_uring unavailable: "<<e.what()<<INFOLOG;
+            return false;
+        }
+    }();
+    return supported;
+}
+
+UringIOScheduler::Reactor& UringIOScheduler::currentReactor(){
+    if(t_scheduler != this || !t_worker){
+        throw std::runtime_error("io_uring requests must be made in a fiber of this scheduler");
+    }
+    return reactors[t_worker->index];
+}
+
+// 共享栈协程挂起后栈会被别的协程覆盖，不能把栈上的缓冲区交给内核
+bool UringIOScheduler::completionIO(){
+    return t_scheduler == this && t_worker && Fiber::InFiber()
+        && Fiber::GetThis()->getStackMode() != StackMode::SHARED;
+}
+
+io_uring_sqe* UringIOScheduler::prepare(Reactor& reactor, uint8_t opcode, int fd, bool fixed){
+    bool useFixed = false;
+    std::atomic<uint32_t>* state = fixed && fixedFiles ? fileState(reactor, fd) : nullptr;
+    if(state){
+        uint32_t s = state->load(std::memory_order_relaxed);
+        if(!(s & FD_FIXED) && reactor.ring->updateFile(fd, fd) == 0){
+            s = state->fetch_or(FD_FIXED, std::memory_order_relaxed) | FD_FIXED;
+        }
+        useFixed = s & FD_FIXED;
+    }
+    io_uring_sqe* sqe = reactor.ring->getSqe();
+    for(int i=0;!sqe;i++){
+        if(i == 3) throw std::runtime_error("io_uring submission queue stays full");
+        flush(reactor); // 队列满了先交给内核
+        sqe = reactor.ring->getSqe();
+    }
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    if(useFixed) sqe->flags |= IOSQE_FIXED_FILE;
+    reactor.inflight++;
+    return sqe;
+}
+
+void UringIOScheduler::submitted(Reactor& reactor){
+    if(reactor.ring->pending() >= SUBMIT_BATCH) flush(reactor);
+}
+
+void UringIOScheduler::flush(Reactor& reactor){
+    int r = reactor.ring->enter(0, 0);
+    if(r == -EBUSY || r == -EAGAIN){
+        // 完成队列积压，先收割再提交
+        reap(reactor, false);
+        r = reactor.ring->enter(0, 0);
+    }
+    if(r < 0 && r != -EINTR) LOG_STREAM<<"io_uring submit error "<<std::to_string(-r)<<ERRORLOG;
+}
+
+void UringIOScheduler::cancel(Reactor& reactor, uint64_t userData){
+    io_uring_sqe* sqe = prepare(reactor, IORING_OP_ASYNC_CANCEL, -1, false);
+    sqe->addr = userData;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    submitted(reactor);
+}
+
+ssize_t UringIOScheduler::await(Reactor& reactor, Op& op){
+    if(auto state = fileState(reactor, op.fd)) state->fetch_add(1, std::memory_order_relaxed);
+    submitted(reactor);
+    bool interrupted = false;
+    while(!op.done){
+        if(interrupted) suspend();
+        else if(!waitUntil(std::chrono::steady_clock::time_point::max()) && !op.done){
+            // 缓冲区可能在协程栈上，取消之后也要等内核交回结果才能返回
+            interrupted = true;
+            cancel(reactor, reinterpret_cast<uint64_t>(&op));
+        }
+    }
+    // 取消之前已经完成的照常返回，读到的数据不会丢
+    if(op.res >= 0) return op.res;
+    if(interrupted){
+        int reason = Fiber::GetThis()->interrupted();
+        errno = reason ? reason : ETIMEDOUT;
+    }
+    else errno = -op.res;
+    return -1;
+}
+
+ssize_t UringIOScheduler::ioRead(int fd, void* buf, size_t len){
+    Reactor& reactor = currentReactor();
+    Op op{Fiber::GetThis().get(), fd};
+    io_uring_sqe* sqe = prepare(reactor, IORING_OP_RECV, fd, true);
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = static_cast<uint32_t>(std::min<size_t>(len, UINT32_MAX));
+    sqe->user_data = reinterpret_cast<uint64_t>(&op);
+    return await(reactor, op);
+}
+
+ssize_t UringIOScheduler::ioWrite(int fd, const void* buf, size_t len){
+    Reactor& reactor = currentReactor();
+    Op op{Fiber::GetThis().get(), fd};
+    io_uring_sqe* sqe = prepare(reactor, IORING_OP_SEND, fd, true);
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = static_cast<uint32_t>(std::min<size_t>(len, UINT32_MAX));
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = reinterpret_cast<uint64_t>(&op);
+    return await(reactor, op);
+}
+
+int UringIOScheduler::ioConnect(int fd, const sockaddr* addr, socklen_t len){
+    Reactor& reactor = currentReactor();
+    Op op{Fiber::GetThis().get(), fd};
+    io_uring_sqe* sqe = prepare(reactor, IORING_OP_CONNECT, fd, true);
+    sqe->addr = reinterpret_cast<uint64_t>(addr);
+    sqe->off = len;
+    sqe->user_data = reinterpret_cast<uint64_t>(&op);
+    return static_cast<int>(await(reactor, op));
+}
+
+// multishot accept没有对端地址，取到连接后用getpeername补上
+int UringIOScheduler::ioAccept(int fd, sockaddr* addr, socklen_t* len){
+    Reactor& reactor = currentReactor();
+    auto& slot = reactor.accepts[fd];
+    if(!slot){
+        slot.reset(new AcceptStream());
+        slot->fd = fd;
+    }
+    AcceptStream* stream = slot.get();
+    while(true){
+        if(!stream->ready.empty()){
+            int client = stream->ready.front();
+            stream->ready.pop_front();
+            if(addr && len && getpeername(client, addr, len) == -1) *len = 0;
+            return client;
+        }
+        if(stream->error){
+            errno = stream->error;
+            stream->error = 0;
+            if(stream->closed) reactor.accepts.erase(fd);
+            return -1;
+        }
+        if(!stream->armed){
+            io_uring_sqe* sqe = prepare(reactor, IORING_OP_ACCEPT, fd, true);
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->user_data = reinterpret_cast<uint64_t>(stream) | TAG_ACCEPT;
+            if(auto state = fileState(reactor, fd)) state->fetch_add(1, std::memory_order_relaxed);
+            stream->armed = true;
+            submitted(reactor);
+        }
+        stream->waiter = Fiber::GetThis().get();
+        if(!waitUntil(std::chrono::steady_clock::time_point::max())){
+            // 不用取消，之后到的连接留在队列里给下一次accept
+            stream->waiter = nullptr;
+            int reason = Fiber::GetThis()->interrupted();
+            errno = reason ? reason : ETIMEDOUT;
+            return -1;
+        }
+        stream->waiter = nullptr;
+    }
+}
+
+// poll是一次性的，登记时已经就绪会马上完成，不会丢掉登记之前来的事件
+void UringIOScheduler::addEvent(int fd, uint32_t events){
+    if(!Fiber::InFiber()){
+        throw std::runtime_error("addEvent must be called in a fiber");
+    }
+    Reactor& reactor = currentReactor();
+    Fiber::ptr self = Fiber::GetThis();
+    self->setWaitFd(fd);
+    io_uring_sqe* sqe = prepare(reactor, IORING_OP_POLL_ADD, fd, false);
+    sqe->poll32_events = (events & ~(EPOLLET | EPOLLONESHOT | EPOLLEXCLUSIVE)) | FdRegistry::ALWAYS;
+    sqe->user_data = reinterpret_cast<uint64_t>(self.release()) | TAG_POLL;
+    if(auto state = fileState(reactor, fd)) state->fetch_or(FD_POLLED, std::memory_order_relaxed);
+    submitted(reactor);
+}
+
+// 被打断的等待撤掉poll，之后它的完成不会再唤醒协程
+void UringIOScheduler::clearInterest(Fiber* fiber){
+    if(fiber->getWaitFd() == -1) return;
+    fiber->setWaitFd(-1);
+    cancel(currentReactor(), reinterpret_cast<uint64_t>(fiber) | TAG_POLL);
+}
+
+// 可以在任意线程调用：同步取消和注销固定文件都是register类的系统调用，内核自己加锁
+void UringIOScheduler::rmEvent(int fd){
+    for(auto& reactor : reactors){
+        std::atomic<uint32_t>* state = fileState(reactor, fd);
+        // 表外的fd不知道有没有请求，都取消一遍
+        uint32_t s = state ? state->fetch_and(FD_COUNT, std::memory_order_acq_rel) : FD_POLLED;
+        if(s & (FD_COUNT | FD_POLLED)){
+            // 还有请求（监听fd的multishot accept、其他协程的等待），它们以ECANCELED完成，由所属线程收割并唤醒等待方
+            int r = reactor.ring->syncCancel(fd, IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL);
+            if(r == -EBADF && (s & FD_FIXED)){
+                reactor.ring->syncCancel(fd, IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_FD_FIXED | IORING_ASYNC_CANCEL_ALL);
+            }
+        }
+        if(s & FD_FIXED) reactor.ring->updateFile(fd, -1);
+    }
+}
+
+void UringIOScheduler::park(Worker* w, int timeoutMs){
+    Reactor& reactor = reactors[w->index];
+    if(!reactor.wakeArmed){
+        io_uring_sqe* sqe = prepare(reactor, IORING_OP_READ, reactor.wakeFd, false);
+        sqe->addr = reinterpret_cast<uint64_t>(&reactor.wakeBuf);
+        sqe->len = sizeof(reactor.wakeBuf);
+        sqe->user_data = WAKE_ID;
+        reactor.wakeArmed = true;
+    }
+    Uring& ring = *reactor.ring;
+    if(timeoutMs != 0 || ring.pending() || ring.needEnter()){
+        int r = ring.enter(timeoutMs != 0 ? 1 : 0, timeoutMs);
+        if(r < 0 && r != -ETIME && r != -EINTR && r != -EBUSY){
+            LOG_STREAM<<"io_uring_enter error "<<std::to_string(-r)<<ERRORLOG;
+        }
+    }
+    reap(reactor, false);
+}
+
+void UringIOScheduler::reap(Reactor& reactor, bool draining){
+    reactor.ring->reap([&](const io_uring_cqe* cqe){ complete(reactor, cqe, draining); });
+}
+
+void UringIOScheduler::complete(Reactor& reactor, const io_uring_cqe* cqe, bool draining){
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+    if(!more) reactor.inflight--;
+    uint64_t data = cqe->user_data;
+    if(data == 0) return;
+    if(data == WAKE_ID){
+        reactor.wakeArmed = false; // 下次park前重新挂上
+        return;
+    }
+    switch(data & TAG_MASK){
+    case TAG_OP: {
+        Op* op = reinterpret_cast<Op*>(data);
+        if(auto state = fileState(reactor, op->fd)) state->fetch_sub(1, std::memory_order_relaxed);
+        op->res = cqe->res;
+        op->done = true;
+        if(!draining) wakeup(Fiber::ptr(op->fiber));
+        break;
+    }
+    case TAG_POLL: {
+        Fiber::ptr fiber = Fiber::ptr::Adopt(reinterpret_cast<Fiber*>(data & ~TAG_MASK));
+        // 等待已经被撤掉（clearInterest）或者已经被别的完成唤醒过
+        if(draining || fiber->getWaitFd() == -1) break;
+        fiber->setWaitFd(-1);
+        wakeup(std::move(fiber));
+        break;
+    }
+    case TAG_ACCEPT: {
+        AcceptStream* stream = reinterpret_cast<AcceptStream*>(data & ~TAG_MASK);
+        if(cqe->res >= 0){
+            if(draining) close(cqe->res);
+            else stream->ready.push_back(cqe->res);
+        }
+        else if(cqe->res != -ECANCELED) stream->error = -cqe->res;
+        if(!more){
+            stream->armed = false;
+            if(auto state = fileState(reactor, stream->fd)) state->fetch_sub(1, std::memory_order_relaxed);
+            if(cqe->res == -ECANCELED && !draining){
+                // 监听fd要关闭了，没取走的连接关掉
+                for(int fd : stream->ready) close(fd);
+                stream->ready.clear();
+                stream->closed = true;
+                if(!stream->waiter){
+                    reactor.accepts.erase(stream->fd);
+                    return;
+                }
+                stream->error = EBADF;
+            }
+        }
+        // waiter由等待的协程自己清掉，它还在等时流不会被删
+        if(stream->waiter && !draining) wakeup(Fiber::ptr(stream->waiter));
+        break;
+    }
+    }
+}
+
+void UringIOScheduler::wake(Reactor& reactor){
+    uint64_t one = 1;
+    ssize_t n = write(reactor.wakeFd, &one, sizeof(one));
+    (void)n;
+}
 #endif
 
 #ifdef _WIN32
@@ -343,4 +2145,15 @@ private:
     #define FiberScheduler LinuxIOScheduler
 #endif
 
+std::shared_ptr<IOScheduler> IOScheduler::getIOScheduler(const SchedulerOption& option){
+#ifndef _WIN32
+    if(option.local) return std::make_shared<LocalScheduler>(option);
+    if(option.ioUring){
+        if(UringIOScheduler::Supported()) return std::make_shared<UringIOScheduler>(option);
+        LOG_STREAM<<"io_uring not supported, fall back to epoll"<<INFOLOG;
+    }
+#endif
+    return std::make_shared<FiberScheduler>(option);
+}
+
 #endif
\ No newline at end of file
@@ -48,8 +48,8 @@ public:
     };
     static SocketInitializer globalInitializer;
 
-    // 创建非阻塞的Socket
-    static std::shared_ptr<SocketWrapper> Create(Type type, const std::string& addr, uint16_t port = 0) {
+    // 创建非阻塞的Socket，reusePort为true时绑定前设置SO_REUSEPORT，多个进程可以监听同一个端口
+    static std::shared_ptr<SocketWrapper> Create(Type type, const std::string& addr, uint16_t port = 0, bool reusePort = false) {
         const int domain = GetDomain(addr);
         int socktype = (type == Type::TCP) ? SOCK_STREAM : SOCK_DGRAM;
         int protocol = (type == Type::Unix) ? 0 : (type == Type::TCP ? IPPROTO_TCP : IPPROTO_UDP);
@@ -77,6 +77,7 @@ public:
         }
 
         auto rs = std::make_shared<SocketWrapper>(fd, type, domain);
+        if (reusePort) rs->setReusePort(true);
         rs->bind(addr,port);
         rs->ip_ = addr;
         rs->port_ = port;
@@ -89,10 +90,11 @@ public:
     ~SocketWrapper() {
 
         if (fd_ != -1) {
-            CLOSE_SOCKET(fd_);
+            // 先注销再关闭，关闭之后fd可能马上被别的连接复用
             if(globalScheduler!=nullptr){
                 globalScheduler->rmEvent(fd_);
             }
+            CLOSE_SOCKET(fd_);
         }
     }
 
@@ -142,9 +144,27 @@ public:
         }
         sockaddr_storage client_addr{};
         socklen_t client_addr_len = sizeof(client_addr);
-        int client_fd;
-        while(true){ 
+        int client_fd = -1;
+        #ifndef _WIN32
+        // io_uring：监听fd上挂着multishot accept，直接取已经接受的连接
+        if(globalScheduler && globalScheduler->completionIO()){
+            client_fd = globalScheduler->ioAccept(fd_, reinterpret_cast<sockaddr*>(&client_addr), &client_addr_len);
+            if(client_fd == -1){
+                if(errno == ETIMEDOUT || errno == ECANCELED){
+                    return interrupted<std::shared_ptr<SocketWrapper>>("accept",nullptr);
+                }
+                LOG_STREAM<<"Accept failed: "<<std::strerror(errno)<<ERRORLOG;
+                throw std::runtime_error("Accept failed");
+            }
+        }
+        #endif
+        while(client_fd == -1){ 
+            #ifdef _WIN32
             client_fd = ::accept(fd_, reinterpret_cast<sockaddr*>(&client_addr), &client_addr_len);
+            #else
+            // 新连接不继承监听套接字的O_NONBLOCK，阻塞的读会卡住整个工作线程，空闲连接也就取消不了
+            client_fd = ::accept4(fd_, reinterpret_cast<sockaddr*>(&client_addr), &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            #endif
             if (client_fd == -1) {
                 auto error_n = errno;
                 if(error_n == EAGAIN){ // wait
@@ -152,9 +172,9 @@ public:
                     if(globalScheduler){
                         globalScheduler->addEvent(fd_,EPOLLIN|EPOLLET);
                     }
-                    //接收调度,等待可以时会返回
-                    if(globalScheduler){
-                        globalScheduler->wait();
+                    //接收调度,等待可以时会返回；到了截止时间或被取消时返回空，errno为ETIMEDOUT/ECANCELED
+                    if(globalScheduler && !globalScheduler->wait()){
+                        return interrupted<std::shared_ptr<SocketWrapper>>("accept",nullptr);
                     }
 
                 }else{                 // error
@@ -196,11 +216,11 @@ public:
             if (!resolveAddress(remote, port, ss)) return false;
 
             #ifdef _WIN32
-            const int ret = connect(fd_, reinterpret_cast<sockaddr*>(&ss), 
+            const int ret = ::connect(fd_, reinterpret_cast<sockaddr*>(&ss), 
                                 (domain_ == AF_INET6) ? sizeof(sockaddr_in6) : 
                                 sizeof(sockaddr_in));
             #else
-            const int ret = connect(fd_, reinterpret_cast<sockaddr*>(&ss), 
+            const int ret = ::connect(fd_, reinterpret_cast<sockaddr*>(&ss), 
                                 (domain_ == AF_UNIX) ? sizeof(sockaddr_un) : 
                                 (domain_ == AF_INET6) ? sizeof(sockaddr_in6) : 
                                 sizeof(sockaddr_in));
@@ -227,6 +247,46 @@ public:
         });
     }
 
+    #ifndef _WIN32
+    // 在协程里连接，等待时只挂起协程；失败返回false，errno为原因
+    bool connect(const std::string& remote, uint16_t port) {
+        sockaddr_storage ss{};
+        if (!resolveAddress(remote, port, ss)) {
+            errno = EINVAL;
+            return false;
+        }
+        const socklen_t len = (domain_ == AF_UNIX) ? sizeof(sockaddr_un) :
+                            (domain_ == AF_INET6) ? sizeof(sockaddr_in6) :
+                            sizeof(sockaddr_in);
+        // io_uring：连接直接提交给内核
+        if (globalScheduler && globalScheduler->completionIO()) {
+            if (globalScheduler->ioConnect(fd_, reinterpret_cast<sockaddr*>(&ss), len) == 0) return true;
+            if (errno == ETIMEDOUT || errno == ECANCELED) return interrupted<bool>("connect", false);
+            return false;
+        }
+        if (::connect(fd_, reinterpret_cast<sockaddr*>(&ss), len) == 0) return true;
+        if (errno != EINPROGRESS) return false;
+        // 非阻塞连接，等到可写后取结果
+        if (globalScheduler && Fiber::InFiber()) {
+            globalScheduler->addEvent(fd_, EPOLLOUT | EPOLLERR | EPOLLHUP);
+            if (!globalScheduler->wait()) return interrupted<bool>("connect", false);
+        } else {
+            fd_set writefds;
+            FD_ZERO(&writefds);
+            FD_SET(fd_, &writefds);
+            select(fd_ + 1, nullptr, &writefds, nullptr, nullptr);
+        }
+        int err = 0;
+        socklen_t errLen = sizeof(err);
+        if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &errLen) == -1) return false;
+        if (err) {
+            errno = err;
+            return false;
+        }
+        return true;
+    }
+    #endif
+
     // 读时直接切到下一协程，等待数据准备完毕后返回
 
     #ifdef _WIN32
@@ -285,6 +345,15 @@ public:
         if(fd_ == -1){
             return -1;
         }
+        // io_uring：直接提交读，完成时返回
+        if(globalScheduler && globalScheduler->completionIO()){
+            ssize_t r = globalScheduler->ioRead(fd_, buf, len);
+            if(r == -1){
+                if(errno == ETIMEDOUT || errno == ECANCELED) return interrupted<ssize_t>("read",-1);
+                LOG_STREAM<<"Fiber "<<std::to_string(Fiber::GetThis()->getID())<<" soccket read failed: "<< errno <<ERRORLOG;
+            }
+            return r;
+        }
         //非阻塞读
         int r;
         while(true){
@@ -296,9 +365,9 @@ public:
                     if(globalScheduler){
                         globalScheduler->addEvent(fd_,EPOLLIN|EPOLLERR|EPOLLHUP);
                     }
-                    //接收调度,等待可以时会返回
-                    if(globalScheduler){
-                        globalScheduler->wait();
+                    //接收调度,等待可以时会返回；到了截止时间或被取消时返回-1，errno为ETIMEDOUT/ECANCELED
+                    if(globalScheduler && !globalScheduler->wait()){
+                        return interrupted<ssize_t>("read",-1);
                     }
                     continue;
                 }
@@ -339,9 +408,23 @@ public:
         if(fd_ == -1){
             return -1;
         }
+        // io_uring：提交写，没写完的部分接着提交
+        if(globalScheduler && globalScheduler->completionIO()){
+            size_t done = 0;
+            while(done < len){
+                ssize_t r = globalScheduler->ioWrite(fd_, buf + done, len - done);
+                if(r == -1){
+                    if(errno == ETIMEDOUT || errno == ECANCELED) return interrupted<size_t>("write",-1);
+                    LOG_STREAM<<"soccket write failed: "<< errno <<ERRORLOG;
+                    return -1;
+                }
+                done += r;
+            }
+            return 0;
+        }
         // 非阻塞的读
         while(totol>0){
-            int r = ::write(fd_, buf, len);
+            int r = ::write(fd_, buf + (len - totol), totol); // 接着上次写到的位置
             auto error_n = errno;
             if(r==-1){                 // can not write
                 if(error_n == EAGAIN){ // wait
@@ -349,9 +432,9 @@ public:
                     if(globalScheduler){
                         globalScheduler->addEvent(fd_,EPOLLOUT|EPOLLERR|EPOLLHUP);
                     }
-                    //接收调度,等待可以时会返回
-                    if(globalScheduler){
-                        globalScheduler->wait();
+                    //接收调度,等待可以时会返回；到了截止时间或被取消时返回-1，errno为ETIMEDOUT/ECANCELED
+                    if(globalScheduler && !globalScheduler->wait()){
+                        return interrupted<size_t>("write",-1);
                     }
                     continue;
                 }
@@ -389,6 +472,19 @@ public:
                   reinterpret_cast<const char*>(&optval), sizeof(optval));
         #endif
     }
+    // 允许多个套接字绑定同一个端口，连接由内核按四元组的哈希分给各个监听者；需要在bind之前设置
+    void setReusePort(bool on) {
+        #ifdef SO_REUSEPORT
+        int optval = on ? 1 : 0;
+        if (setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT,
+                  reinterpret_cast<const char*>(&optval), sizeof(optval)) == -1) {
+            LOG_STREAM<<"SO_REUSEPORT failed: "<<std::to_string(errno)<<ERRORLOG;
+        }
+        #else
+        (void)on;
+        LOG_STREAM<<"SO_REUSEPORT not supported on this platform"<<ERRORLOG;
+        #endif
+    }
     // 是否禁用naggle算法
     void setTcpNoDelay(bool on) {
         if (type_ == Type::TCP) {
@@ -399,6 +495,16 @@ public:
     }
 
 protected:
+    //等待被打断，设置errno并返回失败值
+    template<typename R>
+    R interrupted(const char* op,R fail){
+        int reason = Fiber::GetThis()->interrupted();
+        if(!reason) reason = ETIMEDOUT;
+        LOG_STREAM<<"Fiber "<<std::to_string(Fiber::GetThis()->getID())<<" socket "<<op<<" interrupted: "<<std::strerror(reason)<<DEBUGLOG;
+        errno = reason; // 写日志可能改掉errno，最后再设
+        return fail;
+    }
+
     //判断地址类型
     static int GetDomain(const std::string& addr) {
         if (addr.find("unix://") == 0) return AF_UNIX;
@@ -73,9 +73,9 @@ std::shared_ptr<SSLSocketWrapper> SSLSocketWrapper::accept(){
                 if(globalScheduler){
                     globalScheduler->addEvent(fd_,EPOLLIN|EPOLLET);
                 }
-                //接收调度,等待可以时会返回
-                if(globalScheduler){
-                    globalScheduler->wait();
+                //接收调度,等待可以时会返回；到了截止时间或被取消时返回空
+                if(globalScheduler && !globalScheduler->wait()){
+                    return interrupted<std::shared_ptr<SSLSocketWrapper>>("ssl accept",nullptr);
                 }
 
             }else{                 // error
@@ -161,9 +161,9 @@ size_t SSLSocketWrapper::read(char* buf,size_t len){
                 if(globalScheduler){
                     globalScheduler->addEvent(fd_,EPOLLIN|EPOLLERR|EPOLLHUP);
                 }
-                //接收调度,等待可以时会返回
-                if(globalScheduler){
-                    globalScheduler->wait();
+                //接收调度,等待可以时会返回；到了截止时间或被取消时返回-1
+                if(globalScheduler && !globalScheduler->wait()){
+                    return interrupted<size_t>("ssl read",-1);
                 }
                 continue;
             }
@@ -192,9 +192,9 @@ size_t SSLSocketWrapper::write(char* buf,size_t len){
                 if(globalScheduler){
                     globalScheduler->addEvent(fd_,EPOLLOUT|EPOLLERR|EPOLLHUP);
                 }
-                //接收调度,等待可以时会返回
-                if(globalScheduler){
-                    globalScheduler->wait();
+                //接收调度,等待可以时会返回；到了截止时间或被取消时返回-1
+                if(globalScheduler && !globalScheduler->wait()){
+                    return interrupted<size_t>("ssl write",-1);
                 }
                 continue;
             }
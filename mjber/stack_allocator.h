@@ -0,0 +1,417 @@
+#ifndef STACK_ALLOCATOR
+#define STACK_ALLOCATOR
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <stdexcept>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <cstring>
+#include <sstream>
+#include <cstdlib>
+#ifdef __GNUG__
+    #include <cxxabi.h>
+#endif
+
+#include "logger.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+    #define MJBER_ASAN
+#elif defined(__has_feature)
+    #if __has_feature(address_sanitizer)
+        #define MJBER_ASAN
+    #endif
+#endif
+#ifdef MJBER_ASAN
+    #include <sanitizer/asan_interface.h>
+    #define MJBER_NO_ASAN __attribute__((no_sanitize_address))
+#else
+    #define MJBER_NO_ASAN
+#endif
+
+/*
+    协程栈分配器
+    每个栈是一段独立mmap的区域，低地址放一个PROT_NONE的保护页，栈溢出时直接段错误而不是悄悄写坏堆
+        | guard(PROT_NONE) |          usable stack           |
+        ^ region                                              ^ top
+    映射时使用MAP_NORESERVE，物理页只在第一次触碰时才提交（懒提交），空闲连接只占用实际用到的那几页
+
+    每个线程维护自己的空闲池（按大小分组），分配和归还都不需要加锁
+    归还时先madvise把物理页还给内核，只保留靠近栈顶的一页，再放入池中等待复用
+    池满时直接munmap
+*/
+
+// 一段可用的协程栈
+struct FiberStack {
+    char* base = nullptr;   // 可用区域的低地址（保护页之上）
+    size_t size = 0;        // 可用区域大小
+    char* top() const { return base + size; }
+    explicit operator bool() const { return base != nullptr; }
+};
+
+class StackAllocator {
+public:
+    // 分配一个至少size字节的栈，大小向上取整到页
+    static FiberStack Alloc(size_t size);
+    // 归还到当前线程的池
+    static void Free(FiberStack& stack);
+
+    static size_t PageSize();
+    // 每个线程每种大小最多缓存的栈数量
+    static void SetPoolLimit(size_t limit) { s_pool_limit = limit; }
+
+    // 统计
+    static size_t MappedBytes() { return s_mapped_bytes.load(std::memory_order_relaxed); } // 已映射的虚拟空间
+    static size_t StacksInUse() { return s_in_use.load(std::memory_order_relaxed); }       // 正在被协程使用的栈
+    static size_t StacksCached() { return s_cached.load(std::memory_order_relaxed); }      // 各线程池中缓存的栈
+
+private:
+    static FiberStack MapStack(size_t size);
+    static void UnmapStack(FiberStack& stack);
+    static void ReleasePages(FiberStack& stack);
+
+    // 线程本地的空闲池，线程退出时释放全部缓存
+    struct LocalPool {
+        std::map<size_t, std::vector<FiberStack>> free_stacks;
+        ~LocalPool();
+    };
+    static LocalPool& GetLocalPool();
+
+    static size_t s_pool_limit;
+    static std::atomic<size_t> s_mapped_bytes;
+    static std::atomic<size_t> s_in_use;
+    static std::atomic<size_t> s_cached;
+};
+
+size_t StackAllocator::s_pool_limit = 64;
+std::atomic<size_t> StackAllocator::s_mapped_bytes {0};
+std::atomic<size_t> StackAllocator::s_in_use {0};
+std::atomic<size_t> StackAllocator::s_cached {0};
+
+// 线程局部池是否已经析构
+// 主协程等thread_local对象可能在池析构之后才析构，此时直接unmap
+static thread_local bool t_stack_pool_dead = false;
+
+size_t StackAllocator::PageSize() {
+    static size_t page_size = [](){
+    #ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return static_cast<size_t>(info.dwPageSize);
+    #else
+        long r = sysconf(_SC_PAGESIZE);
+        return r > 0 ? static_cast<size_t>(r) : static_cast<size_t>(4096);
+    #endif
+    }();
+    return page_size;
+}
+
+StackAllocator::LocalPool& StackAllocator::GetLocalPool() {
+    static thread_local LocalPool pool;
+    return pool;
+}
+
+StackAllocator::LocalPool::~LocalPool() {
+    t_stack_pool_dead = true;
+    for (auto& bucket : free_stacks) {
+        for (auto& stack : bucket.second) {
+            StackAllocator::UnmapStack(stack);
+            s_cached.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+FiberStack StackAllocator::Alloc(size_t size) {
+    const size_t page = PageSize();
+    size = (size + page - 1) / page * page;
+
+    FiberStack stack;
+    auto& pool = GetLocalPool();
+    auto bucket = pool.free_stacks.find(size);
+    if (bucket != pool.free_stacks.end() && !bucket->second.empty()) {
+        stack = bucket->second.back();
+        bucket->second.pop_back();
+        s_cached.fetch_sub(1, std::memory_order_relaxed);
+    }
+    else {
+        stack = MapStack(size);
+    }
+    s_in_use.fetch_add(1, std::memory_order_relaxed);
+    return stack;
+}
+
+void StackAllocator::Free(FiberStack& stack) {
+    if (!stack) return;
+    s_in_use.fetch_sub(1, std::memory_order_relaxed);
+    if (!t_stack_pool_dead) {
+        auto& bucket = GetLocalPool().free_stacks[stack.size];
+        if (bucket.size() < s_pool_limit) {
+            ReleasePages(stack);
+            bucket.push_back(stack);
+            s_cached.fetch_add(1, std::memory_order_relaxed);
+            stack = FiberStack();
+            return;
+        }
+    }
+    UnmapStack(stack);
+    stack = FiberStack();
+}
+
+/*
+    共享栈
+    SHARED模式的协程不独占栈，而是在一个大的共享栈上运行，挂起时把[rsp, top)之间实际用到的内容拷贝到协程自己的保存区，
+    恢复时再拷回来。栈帧里有指向栈上对象的指针，所以一个协程必须一直回到同一个共享栈的同一地址上运行；
+    协程会在线程池的任意线程上恢复，因此共享栈是进程级的一组，每个协程创建时固定绑定其中一个，
+    同一时刻只能有一个协程占用一个共享栈，占用通过busy标记互斥。
+    在调度器里切入时共享栈被占着就不等，协程交回调度器稍后再运行（见Fiber::acquireStack），线程接着跑别的协程。
+*/
+struct SharedStack {
+    FiberStack stack;
+    std::atomic<bool> busy {false};
+
+    bool tryLock() {
+        return !busy.load(std::memory_order_relaxed) && !busy.exchange(true, std::memory_order_acquire);
+    }
+    // 占用共享栈，被其他线程上的协程占用时自旋等待（占用者挂起时就会释放），只在没有调度器时使用
+    void lock() {
+        while (busy.exchange(true, std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+    void unlock() {
+        busy.store(false, std::memory_order_release);
+    }
+};
+
+class SharedStackPool {
+public:
+    // 共享栈的数量和大小，需要在第一个SHARED协程创建之前设置
+    static void Config(size_t count, size_t size) { s_count = count; s_size = size; }
+    // 轮转分配一个共享栈
+    static SharedStack* Pick() {
+        auto& pool = GetPool();
+        size_t idx = pool.next.fetch_add(1, std::memory_order_relaxed) % pool.stacks.size();
+        return pool.stacks[idx].get();
+    }
+
+private:
+    struct Pool {
+        std::vector<std::unique_ptr<SharedStack>> stacks;
+        std::atomic<size_t> next {0};
+        Pool() {
+            size_t count = s_count;
+            if (count == 0) {
+                count = std::thread::hardware_concurrency() * 2;
+                if (count == 0) count = 2;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                auto shared = std::unique_ptr<SharedStack>(new SharedStack());
+                shared->stack = StackAllocator::Alloc(s_size);
+                stacks.push_back(std::move(shared));
+            }
+        }
+        ~Pool() {
+            for (auto& shared : stacks) {
+                StackAllocator::Free(shared->stack);
+            }
+        }
+    };
+    static Pool& GetPool() {
+        static Pool pool;
+        return pool;
+    }
+    static size_t s_count; // 0表示按CPU数决定
+    static size_t s_size;
+};
+
+size_t SharedStackPool::s_count = 0;
+size_t SharedStackPool::s_size = 8 * 1024 * 1024;
+
+/*
+    协程栈用量统计
+    打开后协程启动前把栈涂满固定的图案，结束时从栈底往上找第一个被改写的字，得到这次运行的最大深度（高水位），
+    按任务入口分别记录，用来决定每类任务该用多大的栈
+    涂栈会让整段栈都提交物理页，只建议在压测或者采样时打开
+    复用的栈只重涂上次用到的部分
+*/
+class StackProfiler {
+public:
+    struct Entry {
+        std::string name;      // 任务入口
+        size_t stack_size = 0; // 最近一次运行时的栈大小
+        size_t samples = 0;    // 统计的运行次数
+        size_t max_used = 0;   // 最大深度
+        size_t total_used = 0; // 用于求平均
+    };
+
+    static void Enable(bool on) { s_enabled.store(on, std::memory_order_relaxed); }
+    static bool Enabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    // 把栈顶往下depth字节涂成图案，其余部分需要已经是图案
+    static void Paint(const FiberStack& stack, size_t depth) {
+        if (depth > stack.size) depth = stack.size;
+        uint64_t* p = reinterpret_cast<uint64_t*>(stack.top() - depth);
+        uint64_t* end = reinterpret_cast<uint64_t*>(stack.top());
+        while (p < end) *p++ = CANARY;
+    }
+    // 返回从栈顶算起被用到的字节数
+    MJBER_NO_ASAN static size_t Measure(const FiberStack& stack) {
+        const uint64_t* p = reinterpret_cast<const uint64_t*>(stack.base);
+        const uint64_t* end = reinterpret_cast<const uint64_t*>(stack.top());
+        while (p < end && *p == CANARY) ++p;
+        return stack.top() - reinterpret_cast<const char*>(p);
+    }
+
+    static void Record(const char* name, size_t used, size_t stack_size);
+    static std::vector<Entry> Snapshot();
+    // 写一份文本报告到日志
+    static void Dump();
+    static void Reset();
+
+private:
+    static const uint64_t CANARY = 0xCDCDCDCDCDCDCDCDull;
+    static std::atomic<bool> s_enabled;
+    static std::mutex s_mutex;
+    static std::map<std::string, Entry> s_entries;
+};
+
+std::atomic<bool> StackProfiler::s_enabled {false};
+std::mutex StackProfiler::s_mutex;
+std::map<std::string, StackProfiler::Entry> StackProfiler::s_entries;
+
+void StackProfiler::Record(const char* name, size_t used, size_t stack_size) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (!name) name = "unknown";
+    auto& entry = s_entries[name];
+    if (entry.name.empty()) {
+        entry.name = name;
+        #ifdef __GNUG__
+        // 默认的名字是函数类型名，还原一下方便看
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+        if (status == 0 && demangled) entry.name = demangled;
+        std::free(demangled);
+        #endif
+    }
+    entry.stack_size = stack_size;
+    entry.samples++;
+    entry.total_used += used;
+    if (used > entry.max_used) entry.max_used = used;
+    // 快用满时及时提示
+    if (used + StackAllocator::PageSize() >= stack_size) {
+        LOG_STREAM<<"fiber stack of "<<entry.name<<" nearly full: "<<std::to_string(used)<<"/"<<std::to_string(stack_size)<<WARNLOG;
+    }
+}
+
+std::vector<StackProfiler::Entry> StackProfiler::Snapshot() {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    std::vector<Entry> res;
+    for (auto& item : s_entries) res.push_back(item.second);
+    return res;
+}
+
+void StackProfiler::Dump() {
+    std::stringstream ss;
+    ss << "fiber stack usage (entry samples avg max stack):";
+    for (auto& entry : Snapshot()) {
+        ss << "\n  " << entry.name << " " << entry.samples << " "
+           << (entry.samples ? entry.total_used / entry.samples : 0) << " "
+           << entry.max_used << " " << entry.stack_size;
+    }
+    std::string report = ss.str();
+    LOG_STREAM<<report<<INFOLOG;
+}
+
+void StackProfiler::Reset() {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_entries.clear();
+}
+
+#ifdef _WIN32
+// windows下保留地址空间，提交可用部分，保护页保持未提交
+FiberStack StackAllocator::MapStack(size_t size) {
+    const size_t page = PageSize();
+    char* region = static_cast<char*>(VirtualAlloc(nullptr, size + page, MEM_RESERVE, PAGE_NOACCESS));
+    if (region == nullptr) {
+        throw std::runtime_error("Failed to reserve fiber stack");
+    }
+    if (VirtualAlloc(region + page, size, MEM_COMMIT, PAGE_READWRITE) == nullptr) {
+        VirtualFree(region, 0, MEM_RELEASE);
+        throw std::runtime_error("Failed to commit fiber stack");
+    }
+    s_mapped_bytes.fetch_add(size + page, std::memory_order_relaxed);
+    FiberStack stack;
+    stack.base = region + page;
+    stack.size = size;
+    return stack;
+}
+
+void StackAllocator::UnmapStack(FiberStack& stack) {
+    VirtualFree(stack.base - PageSize(), 0, MEM_RELEASE);
+    s_mapped_bytes.fetch_sub(stack.size + PageSize(), std::memory_order_relaxed);
+}
+
+void StackAllocator::ReleasePages(FiberStack& stack) {
+    const size_t page = PageSize();
+    if (stack.size > page) {
+        VirtualAlloc(stack.base, stack.size - page, MEM_RESET, PAGE_READWRITE);
+    }
+}
+#else
+FiberStack StackAllocator::MapStack(size_t size) {
+    const size_t page = PageSize();
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    #ifdef MAP_STACK
+    flags |= MAP_STACK;
+    #endif
+    void* region = mmap(nullptr, size + page, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (region == MAP_FAILED) {
+        LOG_STREAM<<"mmap fiber stack failed: "<<errno<<ERRORLOG;
+        throw std::runtime_error("Failed to map fiber stack");
+    }
+    // 最低的一页作为保护页
+    if (mprotect(region, page, PROT_NONE) == -1) {
+        LOG_STREAM<<"mprotect guard page failed: "<<errno<<ERRORLOG;
+        munmap(region, size + page);
+        throw std::runtime_error("Failed to protect fiber stack guard page");
+    }
+    s_mapped_bytes.fetch_add(size + page, std::memory_order_relaxed);
+    FiberStack stack;
+    stack.base = static_cast<char*>(region) + page;
+    stack.size = size;
+    return stack;
+}
+
+void StackAllocator::UnmapStack(FiberStack& stack) {
+    const size_t page = PageSize();
+    munmap(stack.base - page, stack.size + page);
+    s_mapped_bytes.fetch_sub(stack.size + page, std::memory_order_relaxed);
+}
+
+// 把除栈顶一页以外的物理页还给内核，下次复用时按需重新缺页
+// 定义MJBER_STACK_MADV_FREE时使用MADV_FREE，内核在内存紧张时才回收，复用更快但RSS统计不那么直观
+void StackAllocator::ReleasePages(FiberStack& stack) {
+    const size_t page = PageSize();
+    if (stack.size <= page) return;
+    #if defined(MJBER_STACK_MADV_FREE) && defined(MADV_FREE)
+    int advice = MADV_FREE;
+    #else
+    int advice = MADV_DONTNEED;
+    #endif
+    madvise(stack.base, stack.size - page, advice);
+}
+#endif
+
+#endif
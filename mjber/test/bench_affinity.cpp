@@ -0,0 +1,92 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../scheduler.h"
+
+/*
+    唤醒的协程放回上次运行它的线程（SchedulerOption::affinityLimit）的效果
+    每个连接是一对非阻塞的unix socket，两端各一个协程一问一答；服务端每个请求都要读一遍连接自己的状态（STATE_SIZE字节），
+    模拟连接和请求对象，协程换了线程这些数据就要从别的核的缓存搬过来
+    输出吞吐和平均每个请求的迁移次数；缓存缺失要用perf stat -e L2/LLC相关的事件在外面看
+*/
+
+static const long TOTAL_ROUNDS = 200000; // 所有连接加起来的往返次数
+static const size_t STATE_SIZE = 16 << 10;
+
+static std::atomic<long> g_done {0};
+static std::atomic<uint64_t> g_sink {0};
+
+// 读一个字节，没有数据时挂起等可读
+static bool recvByte(IOScheduler* scheduler, int fd) {
+    char c;
+    while (true) {
+        ssize_t n = read(fd, &c, 1);
+        if (n == 1) return true;
+        if (n == 0 || errno != EAGAIN) return false;
+        scheduler->addEvent(fd, EPOLLIN | EPOLLET);
+        scheduler->wait();
+    }
+}
+
+static void client(IOScheduler* scheduler, int fd, long rounds) {
+    for (long i = 0; i < rounds; i++) {
+        if (write(fd, "x", 1) != 1 || !recvByte(scheduler, fd)) break;
+    }
+    scheduler->rmEvent(fd);
+    close(fd);
+    g_done++;
+}
+
+static void server(IOScheduler* scheduler, int fd) {
+    std::vector<uint64_t> state(STATE_SIZE / sizeof(uint64_t), 1);
+    uint64_t sum = 0;
+    while (recvByte(scheduler, fd)) {
+        for (auto& v : state) sum += v++;
+        if (write(fd, "y", 1) != 1) break;
+    }
+    g_sink += sum;
+    scheduler->rmEvent(fd);
+    close(fd);
+    g_done++;
+}
+
+static void run(const char* name, long connections, uint32_t limit) {
+    SchedulerOption option(std::max<size_t>(std::thread::hardware_concurrency(), 2));
+    option.affinityLimit = limit;
+    // 调度器的事件线程不能停，不析构
+    auto scheduler = new LinuxIOScheduler(option);
+    long rounds = TOTAL_ROUNDS / connections;
+    g_done = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (long i = 0; i < connections; i++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) != 0) {
+            std::cout << "socketpair failed, raise ulimit -n" << std::endl;
+            std::_Exit(1);
+        }
+        scheduler->addTask(StackClass::SMALL, server, static_cast<IOScheduler*>(scheduler), sv[1]);
+        scheduler->addTask(StackClass::SMALL, client, static_cast<IOScheduler*>(scheduler), sv[0], rounds);
+    }
+    while (g_done.load() < 2 * connections) std::this_thread::sleep_for(std::chrono::microseconds(200));
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    long total = rounds * connections;
+    std::cout << name << " connections " << connections << ": " << total / sec / 1e3 << " K round trips/s, "
+              << double(scheduler->migrationCount()) / total << " migrations/round trip" << std::endl;
+}
+
+int main() {
+    for (long connections : {16L, 256L}) {
+        for (uint32_t limit : {0u, 4u, 64u}) {
+            std::string name = "affinity limit " + std::to_string(limit);
+            run(name.c_str(), connections, limit);
+        }
+    }
+    // 工作线程还在运行，直接退出
+    std::_Exit(0);
+}
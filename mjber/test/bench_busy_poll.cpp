@@ -0,0 +1,75 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include "../scheduler.h"
+
+/*
+    空闲自旋（SchedulerOption::spinUs）对往返延迟的影响
+    对端是一个普通线程，用阻塞的socket一问一答；服务端是调度器里的协程，每次都要等可读，
+    所以每个请求都要经过一次“线程空闲 -> 事件到来 -> 协程被唤醒”
+    输出往返延迟的p50/p99，以及空闲时自旋等到活和真正停下来的次数
+*/
+
+static const int ROUNDS = 20000;
+
+static void server(IOScheduler* scheduler, int fd) {
+    char c;
+    while (true) {
+        ssize_t n = read(fd, &c, 1);
+        if (n == 1) {
+            if (write(fd, "y", 1) != 1) break;
+            continue;
+        }
+        if (n == 0 || errno != EAGAIN) break;
+        scheduler->addEvent(fd, EPOLLIN | EPOLLET);
+        scheduler->wait();
+    }
+    scheduler->rmEvent(fd);
+    close(fd);
+}
+
+static void run(const char* name, const SchedulerOption& option) {
+    // 调度器的事件线程不能停，不析构
+    auto scheduler = new LinuxIOScheduler(option);
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        std::cout << "socketpair failed" << std::endl;
+        std::_Exit(1);
+    }
+    fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+    scheduler->addTask(server, static_cast<IOScheduler*>(scheduler), sv[1]);
+    std::vector<double> latency;
+    latency.reserve(ROUNDS);
+    char c;
+    for (int i = 0; i < ROUNDS; i++) {
+        auto begin = std::chrono::steady_clock::now();
+        if (write(sv[0], "x", 1) != 1 || read(sv[0], &c, 1) != 1) break;
+        latency.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+    }
+    close(sv[0]);
+    std::sort(latency.begin(), latency.end());
+    std::cout << name << ": p50 " << latency[latency.size() / 2] << " us, p99 " << latency[latency.size() * 99 / 100]
+              << " us, spin hits " << scheduler->spinHitCount() << ", parks " << scheduler->parkCount() << std::endl;
+}
+
+int main() {
+    size_t threads = 2;
+    for (bool multi : {false, true}) {
+        for (uint32_t spin : {0u, 20u, 100u}) {
+            SchedulerOption option(threads);
+            option.multiReactor = multi;
+            option.spinUs = spin;
+            std::string name = std::string(multi ? "multi reactor " : "single reactor") + " spin " + std::to_string(spin) + "us";
+            run(name.c_str(), option);
+        }
+    }
+    // 工作线程还在运行，直接退出
+    std::_Exit(0);
+}
@@ -0,0 +1,97 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include "../channel.h"
+#include "../scheduler.h"
+
+/*
+    通道的吞吐和延迟基准，收发双方都是调度器上的协程
+    1. spsc      一个生产者一个消费者，有界/无界通道
+    2. mpmc      4个生产者4个消费者，有界通道
+    3. pingpong  两个容量为1的通道来回传一个数，测一次往返的延迟
+*/
+
+static const long MESSAGES = 1000000;
+static const long ROUND_TRIPS = 100000;
+
+static std::atomic<int> g_done {0};
+static std::atomic<long> g_sum {0};
+
+static void produce(Channel<long>* ch, long n) {
+    for (long i = 0; i < n; i++) ch->send(i);
+    g_done++;
+}
+
+static void consume(Channel<long>* ch) {
+    long v, sum = 0;
+    while (ch->recv(v)) sum += v;
+    g_sum += sum;
+    g_done++;
+}
+
+static void ping(Channel<long>* to, Channel<long>* from, long n) {
+    long v = 0;
+    for (long i = 0; i < n; i++) {
+        to->send(v);
+        from->recv(v);
+    }
+    g_done++;
+}
+
+static void pong(Channel<long>* from, Channel<long>* to) {
+    long v;
+    while (from->recv(v)) to->send(v + 1);
+    g_done++;
+}
+
+static void waitDone(int target) {
+    while (g_done.load() < target) std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+static double elapsedNs(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static void throughput(IOScheduler& scheduler, const char* name, size_t capacity, int producers, int consumers) {
+    Channel<long> ch(capacity);
+    long perProducer = MESSAGES / producers;
+    g_done = 0;
+    g_sum = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < consumers; i++) scheduler.addTask(consume, &ch);
+    for (int i = 0; i < producers; i++) scheduler.addTask(produce, &ch, perProducer);
+    waitDone(producers);
+    ch.close();
+    waitDone(producers + consumers);
+    double ns = elapsedNs(begin);
+    long total = perProducer * producers;
+    bool ok = g_sum.load() == producers * (perProducer * (perProducer - 1) / 2);
+    std::cout << name << ": " << total / (ns / 1e9) / 1e6 << " M msg/s, "
+              << ns / total << " ns/msg" << (ok ? "" : " (checksum mismatch)") << std::endl;
+}
+
+int main() {
+    auto& scheduler = *new LinuxIOScheduler(4); // 调度器没有停止接口，不析构
+
+    throughput(scheduler, "spsc bounded(1024)", 1024, 1, 1);
+    throughput(scheduler, "spsc unbounded", Channel<long>::UNBOUNDED, 1, 1);
+    throughput(scheduler, "mpmc bounded(1024) 4x4", 1024, 4, 4);
+    throughput(scheduler, "mpmc bounded(16) 4x4", 16, 4, 4);
+
+    {
+        Channel<long> a(1), b(1);
+        g_done = 0;
+        auto begin = std::chrono::steady_clock::now();
+        scheduler.addTask(pong, &a, &b);
+        scheduler.addTask(ping, &a, &b, ROUND_TRIPS);
+        waitDone(1);
+        double ns = elapsedNs(begin);
+        a.close();
+        waitDone(2);
+        std::cout << "pingpong: " << ns / ROUND_TRIPS << " ns/round trip" << std::endl;
+    }
+    // 工作线程还在运行，直接退出，不走全局对象（日志）的析构
+    std::_Exit(0);
+}
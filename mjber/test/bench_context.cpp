@@ -0,0 +1,235 @@
+#include <iostream>
+#include <chrono>
+#include <ucontext.h>
+#include "../context.h"
+#include "../stack_allocator.h"
+
+/*
+    上下文切换的微基准：主执行流和一个协程之间来回切换，统计每次切换的耗时
+    1. legacy   原来的实现：C函数里内联汇编，依赖-O0下的栈帧，保存xmm6-15，每次切换都判断firstIn
+    2. ctx_swap 现在的SysV实现：独立汇编函数，只保存rbx/rbp/r12-r15/rsp/rip + MXCSR/x87控制字
+    3. asm      纯汇编的最小实现：callee-saved压在各自的栈上，只交换rsp，不保存浮点控制状态
+    4. ucontext glibc的swapcontext，会保存信号掩码（一次系统调用）
+*/
+
+static const long ROUNDS = 2000000;
+
+static double nsPerSwitch(std::chrono::steady_clock::time_point begin, long switches){
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / switches;
+}
+
+// 1. 原实现 =======================================================
+struct alignas(16) LegacyContext {
+    void* rip;
+    void* rsp;
+    void* rbx;
+    void* rbp;
+    void* rsi;
+    void* rdi;
+    void* r12;
+    void* r13;
+    void* r14;
+    void* r15;
+    __m128i xmm6;
+    __m128i xmm7;
+    __m128i xmm8;
+    __m128i xmm9;
+    __m128i xmm10;
+    __m128i xmm11;
+    __m128i xmm12;
+    __m128i xmm13;
+    __m128i xmm14;
+    __m128i xmm15;
+    void* ptr;
+    void* funcPtr;
+    void* firstIn;
+};
+
+__attribute__((noinline, optimize("O0", "no-omit-frame-pointer")))
+void legacy_ctx_swap(LegacyContext* /*o_ctx*/,LegacyContext* /*t_ctx*/){
+    asm(
+        // rdi=o_ctx, rsi=t_ctx，参数只在汇编里用
+        
+        // 保存当前上下文到o_ctx-------------------------------------------//
+        "movq 8(%rbp), %rax\n"      // 保存函数返回地址到rax
+        "movq %rax, 0x00(%rdi)\n"      // ctx->rip = return address
+        
+        // 保存原栈指针
+        "leaq 0x10(%rsp), %rax\n"
+        "movq %rax, 0x08(%rdi)\n"      // ctx->rsp
+        
+        // 保存Callee-saved寄存器
+        "movq %rbx, 0x10(%rdi)\n"
+
+        "movq 0(%rbp), %rax\n" //由于函数压入返回地址、rbp
+        "movq %rax, 0x18(%rdi)\n"
+
+        // "movq %rsi, 0x20(%rdi)\n"
+        // "movq %rdi, 0x28(%rdi)\n"
+        "movq %r12, 0x30(%rdi)\n"
+        "movq %r13, 0x38(%rdi)\n"
+        "movq %r14, 0x40(%rdi)\n"
+        "movq %r15, 0x48(%rdi)\n"
+        
+        // 保存XMM6-XMM15
+        "movdqu %xmm6, 0x50(%rdi)\n"
+        "movdqu %xmm7, 0x60(%rdi)\n"
+        "movdqu %xmm8, 0x70(%rdi)\n"
+        "movdqu %xmm9, 0x80(%rdi)\n"
+        "movdqu %xmm10, 0x90(%rdi)\n"
+        "movdqu %xmm11, 0xA0(%rdi)\n"
+        "movdqu %xmm12, 0xB0(%rdi)\n"
+        "movdqu %xmm13, 0xC0(%rdi)\n"
+        "movdqu %xmm14, 0xD0(%rdi)\n"
+        "movdqu %xmm15, 0xE0(%rdi)\n"
+        
+        // 恢复目标上下文t_ctx------------------------------------------//
+        // 恢复XMM寄存器
+        "movdqu 0x50(%rsi), %xmm6\n"
+        "movdqu 0x60(%rsi), %xmm7\n"
+        "movdqu 0x70(%rsi), %xmm8\n"
+        "movdqu 0x80(%rsi), %xmm9\n"
+        "movdqu 0x90(%rsi), %xmm10\n"
+        "movdqu 0xA0(%rsi), %xmm11\n"
+        "movdqu 0xB0(%rsi), %xmm12\n"
+        "movdqu 0xC0(%rsi), %xmm13\n"
+        "movdqu 0xD0(%rsi), %xmm14\n"
+        "movdqu 0xE0(%rsi), %xmm15\n"
+        
+        // 恢复通用寄存器
+        "movq 0x48(%rsi), %r15\n"
+        "movq 0x40(%rsi), %r14\n"
+        "movq 0x38(%rsi), %r13\n"
+        "movq 0x30(%rsi), %r12\n"
+        // "movq 0x28(%rsi), %rdi\n"
+        // "movq 0x20(%rsi), %rsi\n"
+        "movq 0x18(%rsi), %rbp\n"
+        "movq 0x10(%rsi), %rbx\n"
+        
+
+        //恢复执行流----------------------------------------//
+        "movq 0x100(%rsi), %rax\n"
+        "cmpq $1, %rax\n"
+        "jne .Llegacy1\n"// 如果不是第一次进入
+
+        // 第一次进入时，准备工作函数，参数放到rcx
+
+        "movq 0xF0(%rsi), %rdi\n" //准备好参数到rcx
+        "movq $0, 0x100(%rsi)\n" //下次进入不用重新进入函数
+        "movq 0xF8(%rsi), %rax\n"//准备好函数地址
+        "movq 0x08(%rsi), %rsp\n"
+        "jmp *%rax\n" //跳转到工作函数
+
+        // 否则，恢复栈指针和跳转地址
+        ".Llegacy1:\n"
+        "movq 0x08(%rsi), %rsp\n"
+        "movq 0x00(%rsi), %rax\n"
+        "jmp *%rax\n"               // 跳转到保存的rip
+    );
+}
+
+static LegacyContext legacy_main, legacy_co;
+static void legacyEntry(void*){
+    while(true) legacy_ctx_swap(&legacy_co, &legacy_main);
+}
+
+double benchLegacy(FiberStack& stack){
+    legacy_co = LegacyContext();
+    legacy_co.rsp = stack.top() - sizeof(void*);
+    legacy_co.rbp = legacy_co.rsp;
+    legacy_co.funcPtr = reinterpret_cast<void*>(&legacyEntry);
+    legacy_co.firstIn = (void*)1;
+    auto begin = std::chrono::steady_clock::now();
+    for(long i=0;i<ROUNDS;i++) legacy_ctx_swap(&legacy_main, &legacy_co);
+    return nsPerSwitch(begin, ROUNDS*2);
+}
+
+// 2. ctx_swap ===================================================
+static Context sysv_main, sysv_co;
+static void sysvEntry(void*){
+    while(true) ctx_swap(&sysv_co, &sysv_main);
+}
+
+double benchSysV(FiberStack& stack){
+    ctx_make(sysv_co, reinterpret_cast<void*>(&sysvEntry), nullptr, stack.top());
+    auto begin = std::chrono::steady_clock::now();
+    for(long i=0;i<ROUNDS;i++) ctx_swap(&sysv_main, &sysv_co);
+    return nsPerSwitch(begin, ROUNDS*2);
+}
+
+// 3. 纯汇编 =====================================================
+// void asm_swap(void** from_sp, void* to_sp)
+__asm__(
+    ".pushsection .text\n"
+    ".globl asm_swap\n"
+    ".type asm_swap,@function\n"
+    ".p2align 4\n"
+    "asm_swap:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size asm_swap, .-asm_swap\n"
+    ".popsection\n"
+);
+extern "C" void asm_swap(void** from_sp, void* to_sp);
+
+static void* asm_main_sp;
+static void* asm_co_sp;
+static void asmEntry(){
+    while(true) asm_swap(&asm_co_sp, asm_main_sp);
+}
+
+double benchAsm(FiberStack& stack){
+    // 初始栈：6个寄存器 + 入口地址 + 假的返回地址，ret之后rsp满足入口函数的对齐要求
+    void** sp = reinterpret_cast<void**>(reinterpret_cast<uintptr_t>(stack.top()) & ~static_cast<uintptr_t>(15));
+    *--sp = nullptr;
+    *--sp = reinterpret_cast<void*>(&asmEntry);
+    for(int i=0;i<6;i++) *--sp = nullptr;
+    asm_co_sp = sp;
+    auto begin = std::chrono::steady_clock::now();
+    for(long i=0;i<ROUNDS;i++) asm_swap(&asm_main_sp, asm_co_sp);
+    return nsPerSwitch(begin, ROUNDS*2);
+}
+
+// 4. ucontext ===================================================
+static ucontext_t uc_main, uc_co;
+static void ucEntry(){
+    while(true) swapcontext(&uc_co, &uc_main);
+}
+
+double benchUcontext(FiberStack& stack){
+    getcontext(&uc_co);
+    uc_co.uc_stack.ss_sp = stack.base;
+    uc_co.uc_stack.ss_size = stack.size;
+    uc_co.uc_link = nullptr;
+    makecontext(&uc_co, ucEntry, 0);
+    auto begin = std::chrono::steady_clock::now();
+    for(long i=0;i<ROUNDS;i++) swapcontext(&uc_main, &uc_co);
+    return nsPerSwitch(begin, ROUNDS*2);
+}
+
+int main(){
+    FiberStack s1 = StackAllocator::Alloc(64*1024);
+    FiberStack s2 = StackAllocator::Alloc(64*1024);
+    FiberStack s3 = StackAllocator::Alloc(64*1024);
+    FiberStack s4 = StackAllocator::Alloc(64*1024);
+    std::cout<<"switches per variant: "<<ROUNDS*2<<std::endl;
+    std::cout<<"legacy   "<<benchLegacy(s1)<<" ns/switch"<<std::endl;
+    std::cout<<"ctx_swap "<<benchSysV(s2)<<" ns/switch"<<std::endl;
+    std::cout<<"asm      "<<benchAsm(s3)<<" ns/switch"<<std::endl;
+    std::cout<<"ucontext "<<benchUcontext(s4)<<" ns/switch"<<std::endl;
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../socket_wrapper.h"
+
+/*
+    每个请求的系统调用数
+    每个连接是一对unix socket，客户端协程发一个请求、读完响应，服务端协程读请求、写响应，都通过SocketWrapper
+    小响应时写不会阻塞，只等读；大响应超过socket缓冲区，同一个fd上读和写都要等
+    epoll_ctl的次数由调度器计数，读写类的系统调用（read/write，包括eventfd）取/proc/self/io里的syscr/syscw
+    epoll_wait不在统计里
+*/
+
+static const size_t REQUEST_SIZE = 128;
+static const size_t TOTAL_BYTES = 64 << 20; // 所有连接加起来的响应字节数
+
+static std::atomic<long> g_done {0};
+
+static bool readFull(SocketWrapper& socket, char* buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = socket.read(buf + got, len - got);
+        if (n <= 0) return false;
+        got += n;
+    }
+    return true;
+}
+
+static void client(SocketWrapper* socket, long requests, size_t responseSize) {
+    std::string request(REQUEST_SIZE, 'q');
+    std::vector<char> buf(responseSize);
+    for (long i = 0; i < requests; i++) {
+        if (socket->write(request.data(), request.size()) != 0 || !readFull(*socket, buf.data(), responseSize)) break;
+    }
+    g_done++;
+}
+
+static void server(SocketWrapper* socket, long requests, size_t responseSize) {
+    std::string response(responseSize, 'r');
+    char buf[REQUEST_SIZE];
+    for (long i = 0; i < requests; i++) {
+        if (!readFull(*socket, buf, REQUEST_SIZE) || socket->write(response.data(), response.size()) != 0) break;
+    }
+    g_done++;
+}
+
+// 本进程到目前为止读写类系统调用的次数
+static long readWriteCalls() {
+    std::ifstream io("/proc/self/io");
+    std::string key;
+    long value, total = 0;
+    while (io >> key >> value) {
+        if (key == "syscr:" || key == "syscw:") total += value;
+    }
+    return total;
+}
+
+static void run(const std::shared_ptr<LinuxIOScheduler>& scheduler, const char* name, long connections, size_t responseSize) {
+    globalScheduler = scheduler;
+    long requests = std::max<long>(TOTAL_BYTES / responseSize / connections, 1);
+    g_done = 0;
+    std::vector<std::shared_ptr<SocketWrapper>> sockets;
+    for (long i = 0; i < connections; i++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) != 0) {
+            std::cout << "socketpair failed, raise ulimit -n" << std::endl;
+            std::_Exit(1);
+        }
+        sockets.push_back(std::make_shared<SocketWrapper>(sv[0], SocketWrapper::Type::TCP, AF_UNIX));
+        sockets.push_back(std::make_shared<SocketWrapper>(sv[1], SocketWrapper::Type::TCP, AF_UNIX));
+    }
+    uint64_t ctlBefore = scheduler->ctlCount();
+    long rwBefore = readWriteCalls();
+    auto begin = std::chrono::steady_clock::now();
+    for (long i = 0; i < connections; i++) {
+        scheduler->addTask(StackClass::SMALL, server, sockets[2 * i + 1].get(), requests, responseSize);
+        scheduler->addTask(StackClass::SMALL, client, sockets[2 * i].get(), requests, responseSize);
+    }
+    while (g_done.load() < 2 * connections) std::this_thread::sleep_for(std::chrono::microseconds(200));
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    double total = static_cast<double>(requests * connections);
+    double ctl = (scheduler->ctlCount() - ctlBefore) / total;
+    double rw = (readWriteCalls() - rwBefore) / total;
+    std::cout << name << " response " << responseSize / 1024 << "K connections " << connections << ": " << total / sec / 1e3 << " K req/s, "
+              << ctl << " epoll_ctl/req, " << rw << " read+write/req, " << ctl + rw << " total/req" << std::endl;
+    // 连接由这里持有，协程只借用：结束的协程要等最后一个引用释放才析构参数，那时globalScheduler可能已经换成另一个调度器了
+    sockets.clear();
+}
+
+int main() {
+    size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 2);
+    // 调度器的事件线程不能停，不析构
+    auto single = std::make_shared<LinuxIOScheduler>(threads);
+    SchedulerOption option(threads);
+    option.multiReactor = true;
+    auto multi = std::make_shared<LinuxIOScheduler>(option);
+    for (size_t responseSize : {size_t(1) << 10, size_t(256) << 10}) {
+        for (long connections : {1L, 16L, 256L}) {
+            run(single, "single reactor", connections, responseSize);
+            run(multi, "multi reactor ", connections, responseSize);
+        }
+    }
+    // 工作线程还在运行，直接退出
+    std::_Exit(0);
+}
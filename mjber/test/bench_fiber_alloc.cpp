@@ -0,0 +1,87 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <memory>
+#include "../fiber.h"
+#include "../scheduler.h"
+
+/*
+    协程创建/结束的分配基准：循环创建协程并运行到结束，统计每次创建的堆分配次数和耗时
+    1. fiber     直接Fiber::Create + start，结束的协程回到本线程的对象池
+    2. scheduler 经过IOScheduler::addTask，包括注册表、调度和每个协程开始/结束两条日志的开销
+    分配次数通过替换全局operator new统计
+*/
+
+static std::atomic<long> g_allocs {0};
+
+// 数组形式也一起替换，所有分配都走同一对malloc/free
+static void* countedAlloc(size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new(size_t size) { return countedAlloc(size); }
+void* operator new[](size_t size) { return countedAlloc(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+static const long ROUNDS = 200000;
+
+static std::atomic<long> g_done {0};
+
+struct Payload {
+    std::shared_ptr<int> conn; // 模拟worker持有的连接对象
+};
+
+static void task(Payload* payload, std::shared_ptr<int> conn) {
+    payload->conn = conn;
+    g_done.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void report(const char* name, long allocs, std::chrono::steady_clock::time_point begin, long rounds) {
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count() / rounds;
+    std::cout << name << ": " << static_cast<double>(allocs) / rounds << " allocs/spawn, "
+              << ns << " ns/spawn" << std::endl;
+}
+
+int main() {
+    Payload payload;
+    auto conn = std::make_shared<int>(1);
+
+    // 1. 直接创建
+    {
+        for (int i = 0; i < 1000; i++) Fiber::Create(task, &payload, conn)->start(); // 预热对象池和栈池
+        long before = g_allocs.load();
+        auto begin = std::chrono::steady_clock::now();
+        for (long i = 0; i < ROUNDS; i++) {
+            Fiber::Create(task, &payload, conn)->start();
+        }
+        report("fiber", g_allocs.load() - before, begin, ROUNDS);
+    }
+
+    // 2. 经过调度器（调度器没有停止接口，这里不析构）
+    {
+        auto& scheduler = *new LinuxIOScheduler(1);
+        g_done = 0;
+        for (int i = 0; i < 1000; i++) scheduler.addTask(task, &payload, conn);
+        while (g_done.load() < 1000) std::this_thread::yield();
+
+        g_done = 0;
+        long before = g_allocs.load();
+        auto begin = std::chrono::steady_clock::now();
+        for (long i = 0; i < ROUNDS; i++) {
+            scheduler.addTask(task, &payload, conn);
+            // 限制在途的协程数量，避免测到的是就绪队列的增长
+            while (i - g_done.load(std::memory_order_relaxed) > 256) std::this_thread::yield();
+        }
+        while (g_done.load() < ROUNDS) std::this_thread::yield();
+        report("scheduler", g_allocs.load() - before, begin, ROUNDS);
+    }
+    return 0;
+}
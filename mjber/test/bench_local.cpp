@@ -0,0 +1,115 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../scheduler.h"
+
+/*
+    单线程模式（LocalScheduler）和多线程模式的对比
+    每个连接是一对非阻塞的unix socket，两端各一个协程一问一答，输出每秒的往返次数
+    单线程模式没有跨线程的交接：事件、唤醒和协程切换都在一个线程上；多线程模式下事件线程唤醒的协程要经过全局队列交给工作线程
+    多开几个单线程的进程（SO_REUSEPORT）时，把这里单线程的结果乘以进程数，和多线程模式在同样核数下比
+*/
+
+static const long TOTAL_ROUNDS = 200000; // 所有连接加起来的往返次数
+
+static std::atomic<long> g_done {0};
+static long g_target = 0;
+static LocalScheduler* g_local = nullptr;
+
+static bool recvByte(IOScheduler* scheduler, int fd) {
+    char c;
+    while (true) {
+        ssize_t n = read(fd, &c, 1);
+        if (n == 1) return true;
+        if (n == 0 || errno != EAGAIN) return false;
+        scheduler->addEvent(fd, EPOLLIN | EPOLLET);
+        scheduler->wait();
+    }
+}
+
+static void finish(IOScheduler* scheduler, int fd) {
+    scheduler->rmEvent(fd);
+    close(fd);
+    if (++g_done == g_target && g_local) g_local->stop();
+}
+
+static void client(IOScheduler* scheduler, int fd, long rounds) {
+    for (long i = 0; i < rounds; i++) {
+        if (write(fd, "x", 1) != 1 || !recvByte(scheduler, fd)) break;
+    }
+    finish(scheduler, fd);
+}
+
+static void server(IOScheduler* scheduler, int fd) {
+    while (recvByte(scheduler, fd)) {
+        if (write(fd, "y", 1) != 1) break;
+    }
+    finish(scheduler, fd);
+}
+
+static void spawn(IOScheduler* scheduler, long connections, long rounds) {
+    for (long i = 0; i < connections; i++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) != 0) {
+            std::cout << "socketpair failed, raise ulimit -n" << std::endl;
+            std::_Exit(1);
+        }
+        scheduler->addTask(StackClass::SMALL, server, scheduler, sv[1]);
+        scheduler->addTask(StackClass::SMALL, client, scheduler, sv[0], rounds);
+    }
+}
+
+static void report(const std::string& name, long connections, long total, double sec) {
+    std::cout << name << " connections " << connections << ": " << total / sec / 1e3 << " K round trips/s" << std::endl;
+}
+
+static void runLocal(long connections) {
+    LocalScheduler scheduler;
+    long rounds = TOTAL_ROUNDS / connections;
+    g_done = 0;
+    g_target = 2 * connections;
+    g_local = &scheduler;
+    auto begin = std::chrono::steady_clock::now();
+    spawn(&scheduler, connections, rounds);
+    scheduler.run();
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    g_local = nullptr;
+    report("local (1 thread)", connections, rounds * connections, sec);
+}
+
+static void runThreaded(const std::string& name, size_t threads, bool multi, long connections) {
+    SchedulerOption option(threads);
+    option.multiReactor = multi;
+    // 工作窃取模式的事件线程不能停，不析构
+    auto scheduler = new LinuxIOScheduler(option);
+    long rounds = TOTAL_ROUNDS / connections;
+    g_done = 0;
+    g_target = 2 * connections;
+    auto begin = std::chrono::steady_clock::now();
+    spawn(scheduler, connections, rounds);
+    while (g_done.load() < g_target) std::this_thread::sleep_for(std::chrono::microseconds(200));
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    report(name, connections, rounds * connections, sec);
+}
+
+int main() {
+    size_t cores = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::string all = std::to_string(cores) + " threads";
+    for (long connections : {1L, 16L, 256L}) {
+        runLocal(connections);
+        runThreaded("work stealing 1 thread", 1, false, connections);
+        runThreaded("multi reactor 1 thread", 1, true, connections);
+        if (cores == 1) continue;
+        runThreaded("work stealing " + all, cores, false, connections);
+        runThreaded("multi reactor " + all, cores, true, connections);
+    }
+    // 工作线程还在运行，直接退出
+    std::_Exit(0);
+}
@@ -0,0 +1,89 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../scheduler.h"
+
+/*
+    大量并发连接下IO等待和唤醒的吞吐
+    每个连接是一对非阻塞的unix socket，两端各一个协程一问一答，每一轮两边各等一次可读
+    所有连接同时进行，等待登记和事件唤醒都要经过调度器的fd登记表
+    同时看平均每次epoll_wait收到多少事件
+*/
+
+static const long TOTAL_ROUNDS = 200000; // 所有连接加起来的往返次数
+
+static std::atomic<long> g_done {0};
+
+// 读一个字节，没有数据时挂起等可读
+static bool recvByte(IOScheduler* scheduler, int fd) {
+    char c;
+    while (true) {
+        ssize_t n = read(fd, &c, 1);
+        if (n == 1) return true;
+        if (n == 0 || errno != EAGAIN) return false;
+        scheduler->addEvent(fd, EPOLLIN | EPOLLET);
+        scheduler->wait();
+    }
+}
+
+static void client(IOScheduler* scheduler, int fd, long rounds) {
+    for (long i = 0; i < rounds; i++) {
+        if (write(fd, "x", 1) != 1 || !recvByte(scheduler, fd)) break;
+    }
+    scheduler->rmEvent(fd);
+    close(fd);
+    g_done++;
+}
+
+static void server(IOScheduler* scheduler, int fd) {
+    while (recvByte(scheduler, fd)) {
+        if (write(fd, "y", 1) != 1) break;
+    }
+    scheduler->rmEvent(fd);
+    close(fd);
+    g_done++;
+}
+
+static void run(LinuxIOScheduler& scheduler, const char* name, long connections) {
+    long rounds = TOTAL_ROUNDS / connections;
+    g_done = 0;
+    uint64_t waits = scheduler.waitCount();
+    uint64_t events = scheduler.eventCount();
+    auto begin = std::chrono::steady_clock::now();
+    for (long i = 0; i < connections; i++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) != 0) {
+            std::cout << "socketpair failed, raise ulimit -n" << std::endl;
+            std::_Exit(1);
+        }
+        scheduler.addTask(StackClass::SMALL, server, &scheduler, sv[1]);
+        scheduler.addTask(StackClass::SMALL, client, &scheduler, sv[0], rounds);
+    }
+    while (g_done.load() < 2 * connections) std::this_thread::sleep_for(std::chrono::microseconds(200));
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    long total = rounds * connections;
+    waits = scheduler.waitCount() - waits;
+    events = scheduler.eventCount() - events;
+    std::cout << name << " connections " << connections << ": " << total / sec / 1e3 << " K round trips/s, "
+              << sec * 1e9 / total << " ns/round trip, " << (waits ? double(events) / waits : 0.0) << " events/epoll_wait" << std::endl;
+}
+
+int main() {
+    size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 2);
+    // 调度器的事件线程不能停，不析构
+    auto single = new LinuxIOScheduler(threads);
+    SchedulerOption option(threads);
+    option.multiReactor = true;
+    auto multi = new LinuxIOScheduler(option);
+    for (long connections : {16L, 256L, 4096L}) {
+        run(*single, "single reactor", connections);
+        run(*multi, "multi reactor", connections);
+    }
+    // 工作线程还在运行，直接退出，不走全局对象（日志）的析构
+    std::_Exit(0);
+}
@@ -0,0 +1,121 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include "../scheduler.h"
+#include "../thread_pool.h"
+#include "../fiber_sync.h"
+
+/*
+    调度器在1到N个线程上的吞吐，和原来的线程池对比
+    每个任务做一小段计算
+    1. threadpool  主线程创建协程，投递到ThreadPool::enqueue里resume（原来的调度器就是这样启动和恢复协程的）
+    2. external    主线程addTask，协程都从全局队列进入
+    3. fanout      协程里递归addTask，任务放进各线程自己的队列，靠偷取分摊到其他线程
+    4. wake        成对的协程用信号量来回唤醒，走LIFO槽
+*/
+
+static const long WAVE = 10000;  // 同时存在的协程太多会用完mmap的数量限制，分批投递
+static const int WAVES = 20;
+static const int WORK = 200;     // 每个任务的计算量
+static const int FANOUT_DEPTH = 17; // 2^18-1个任务
+static const int PAIRS = 64;
+static const int ROUNDS = 2000;
+
+static std::atomic<long> g_done {0};
+static std::atomic<long> g_sink {0};
+
+static void work() {
+    long x = 0;
+    for (int i = 0; i < WORK; i++) x += i * i ^ x;
+    g_sink.fetch_add(x & 1, std::memory_order_relaxed);
+}
+
+static void task() {
+    work();
+    g_done.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void fanout(IOScheduler* scheduler, int depth) {
+    if (depth > 0) {
+        scheduler->addTask(fanout, scheduler, depth - 1);
+        scheduler->addTask(fanout, scheduler, depth - 1);
+    }
+    task();
+}
+
+static void pinger(FiberSemaphore* mine, FiberSemaphore* other, bool first) {
+    for (int i = 0; i < ROUNDS; i++) {
+        if (!first || i > 0) mine->acquire();
+        work();
+        other->release();
+    }
+    g_done.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void waitDone(long target) {
+    while (g_done.load() < target) std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+static double elapsedSec(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static void report(const char* name, size_t threads, long tasks, double sec) {
+    std::cout << name << " threads " << threads << ": " << tasks / sec / 1e6 << " M tasks/s" << std::endl;
+}
+
+int main() {
+    size_t hw = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::vector<size_t> counts;
+    for (size_t n = 1; n < hw; n *= 2) counts.push_back(n);
+    counts.push_back(hw);
+
+    for (size_t threads : counts) {
+        {
+            ThreadPool pool(threads);
+            g_done = 0;
+            auto begin = std::chrono::steady_clock::now();
+            for (int w = 1; w <= WAVES; w++) {
+                for (long i = 0; i < WAVE; i++) pool.enqueue([](Fiber::ptr fiber) { fiber->resume(); }, Fiber::Create(task));
+                waitDone(w * WAVE);
+            }
+            report("threadpool", threads, WAVES * WAVE, elapsedSec(begin));
+        }
+
+        // 调度器的事件线程不能停，不析构
+        auto scheduler = new LinuxIOScheduler(threads);
+        {
+            g_done = 0;
+            auto begin = std::chrono::steady_clock::now();
+            for (int w = 1; w <= WAVES; w++) {
+                for (long i = 0; i < WAVE; i++) scheduler->addTask(task);
+                waitDone(w * WAVE);
+            }
+            report("external", threads, WAVES * WAVE, elapsedSec(begin));
+        }
+        {
+            long total = (1L << (FANOUT_DEPTH + 1)) - 1;
+            g_done = 0;
+            auto begin = std::chrono::steady_clock::now();
+            scheduler->addTask(fanout, scheduler, FANOUT_DEPTH);
+            waitDone(total);
+            report("fanout", threads, total, elapsedSec(begin));
+        }
+        {
+            std::vector<FiberSemaphore> sems(2 * PAIRS);
+            g_done = 0;
+            auto begin = std::chrono::steady_clock::now();
+            for (int i = 0; i < PAIRS; i++) {
+                scheduler->addTask(pinger, &sems[2 * i], &sems[2 * i + 1], true);
+                scheduler->addTask(pinger, &sems[2 * i + 1], &sems[2 * i], false);
+            }
+            waitDone(2 * PAIRS);
+            report("wake", threads, 2L * PAIRS * ROUNDS, elapsedSec(begin));
+        }
+    }
+    // 工作线程还在运行，直接退出，不走全局对象（日志）的析构
+    std::_Exit(0);
+}
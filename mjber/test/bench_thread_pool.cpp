@@ -0,0 +1,83 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+#include <string>
+#include "../thread_pool.h"
+
+/*
+    线程池交任务的吞吐和分配：ThreadPool::enqueue对比ThreadPool::post
+    1个和N个生产者各交ROUNDS个只做一次计数的任务，输出每秒任务数和每个任务的堆分配次数
+    enqueue每个任务分配packaged_task（shared_ptr）、future的共享状态和std::function；post的任务构造在环形队列的槽位里
+    在途的任务限制在环形队列容量以内，测的是交任务本身而不是队列满了之后的退路
+    分配次数通过替换全局operator new统计
+*/
+
+static std::atomic<long> g_allocs {0};
+
+static void* countedAlloc(size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new(size_t size) { return countedAlloc(size); }
+void* operator new[](size_t size) { return countedAlloc(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+static const long ROUNDS = 400000;
+static const long IN_FLIGHT = 512;
+
+static std::atomic<long> g_done {0};
+
+static void task(long value) {
+    g_done.fetch_add(value, std::memory_order_relaxed);
+}
+
+template <typename Submit>
+static void run(const std::string& name, size_t threads, int producers, Submit submit) {
+    ThreadPool pool(threads);
+    g_done = 0;
+    for (long i = 0; i < 1000; i++) submit(pool); // 预热
+    while (g_done.load() < 1000) std::this_thread::yield();
+
+    g_done = 0;
+    long perProducer = ROUNDS / producers;
+    long total = perProducer * producers;
+    std::atomic<long> sent {0};
+    long before = g_allocs.load();
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> group;
+    for (int p = 0; p < producers; p++) {
+        group.emplace_back([&] {
+            for (long i = 0; i < perProducer; i++) {
+                while (sent.load(std::memory_order_relaxed) - g_done.load(std::memory_order_relaxed) > IN_FLIGHT) {
+                    std::this_thread::yield();
+                }
+                sent.fetch_add(1, std::memory_order_relaxed);
+                submit(pool);
+            }
+        });
+    }
+    for (auto& t : group) t.join();
+    while (g_done.load() < total) std::this_thread::yield();
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    long allocs = g_allocs.load() - before - producers; // 去掉std::thread本身的分配
+    std::cout << name << " (" << producers << " producers): " << total / sec / 1e6 << " M tasks/s, "
+              << static_cast<double>(allocs) / total << " allocs/task" << std::endl;
+}
+
+int main() {
+    size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::cout << "pool threads " << threads << std::endl;
+    for (int producers : {1, 4}) {
+        run("enqueue", threads, producers, [](ThreadPool& pool) { pool.enqueue(task, 1L); });
+        run("post   ", threads, producers, [](ThreadPool& pool) { pool.post(task, 1L); });
+    }
+    std::_Exit(0);
+}
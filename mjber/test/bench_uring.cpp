@@ -0,0 +1,72 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../socket_wrapper.h"
+
+/*
+    套接字读写走epoll（等就绪再读写）和走io_uring（直接提交读写）的对比
+    每个连接是一对unix socket，两端各一个协程通过SocketWrapper一问一答，所有连接同时进行
+    两种调度器都是多reactor的布局、同样的线程数
+*/
+
+static const long TOTAL_ROUNDS = 200000; // 所有连接加起来的往返次数
+
+static std::atomic<long> g_done {0};
+
+static void client(std::shared_ptr<SocketWrapper> socket, long rounds) {
+    char c;
+    for (long i = 0; i < rounds; i++) {
+        if (socket->write("x", 1) != 0 || socket->read(&c, 1) != 1) break;
+    }
+    g_done++;
+}
+
+static void server(std::shared_ptr<SocketWrapper> socket) {
+    char c;
+    while (socket->read(&c, 1) == 1) {
+        if (socket->write("y", 1) != 0) break;
+    }
+    g_done++;
+}
+
+static void run(const char* name, long connections) {
+    long rounds = TOTAL_ROUNDS / connections;
+    g_done = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (long i = 0; i < connections; i++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) != 0) {
+            std::cout << "socketpair failed, raise ulimit -n" << std::endl;
+            std::_Exit(1);
+        }
+        auto a = std::make_shared<SocketWrapper>(sv[0], SocketWrapper::Type::TCP, AF_UNIX);
+        auto b = std::make_shared<SocketWrapper>(sv[1], SocketWrapper::Type::TCP, AF_UNIX);
+        globalScheduler->addTask(StackClass::SMALL, server, b);
+        globalScheduler->addTask(StackClass::SMALL, client, a, rounds);
+    }
+    while (g_done.load() < 2 * connections) std::this_thread::sleep_for(std::chrono::microseconds(200));
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    long total = rounds * connections;
+    std::cout << name << " connections " << connections << ": " << total / sec / 1e3 << " K round trips/s, "
+              << sec * 1e9 / total << " ns/round trip" << std::endl;
+}
+
+int main() {
+    SchedulerOption option(std::max<size_t>(std::thread::hardware_concurrency(), 2));
+    option.multiReactor = true;
+    if (!UringIOScheduler::Supported()) std::cout << "io_uring not supported, only epoll" << std::endl;
+    for (long connections : {16L, 256L, 1024L}) {
+        globalScheduler = std::make_shared<LinuxIOScheduler>(option);
+        run("epoll   ", connections);
+        globalScheduler.reset();
+        if (!UringIOScheduler::Supported()) continue;
+        globalScheduler = std::make_shared<UringIOScheduler>(option);
+        run("io_uring", connections);
+        globalScheduler.reset();
+    }
+    std::_Exit(0);
+}
@@ -0,0 +1,139 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+#include "../channel.h"
+#include "../scheduler.h"
+#include "test_util.h"
+
+// 通道：关闭语义、同一发送方的顺序（无界通道会溢出）、select，协程和普通线程混用；
+// 容量为1的环形队列和通道放满一个之后就是满的，发送方挂起，取出来的顺序不变
+
+static const int PRODUCERS = 4;
+static const long PER_PRODUCER = 5000;
+
+std::atomic<int> done {0};
+std::atomic<int> orderErrors {0};
+std::atomic<long> received {0};
+
+// 高位放发送方编号，低位放序号
+void producer(Channel<long>* ch, long id){
+    for(long i=0;i<PER_PRODUCER;i++) ch->send(id << 32 | i);
+    done++;
+}
+
+void consumer(Channel<long>* ch){
+    std::vector<long> last(PRODUCERS, -1);
+    long v;
+    while(ch->recv(v)){
+        long id = v >> 32, seq = v & 0xffffffff;
+        if(seq <= last[id]) orderErrors++;
+        last[id] = seq;
+        received++;
+    }
+    done++;
+}
+
+std::atomic<long> selectA {0};
+std::atomic<long> selectB {0};
+
+std::atomic<bool> blockedSent {false};
+
+void blockingSender(Channel<int>* ch, int v){
+    ch->send(v);
+    blockedSent = true;
+    done++;
+}
+
+void selector(Channel<int>* a, Channel<int>* b){
+    while(true){
+        int index = Select()
+            .recv(*a, [](int v){ selectA += v; })
+            .recv(*b, [](int v){ selectB += v; })
+            .wait();
+        if(index < 0) break;
+    }
+    done++;
+}
+
+int main(){
+    auto scheduler = new LinuxIOScheduler(4); // 没有停止接口，不析构
+    bool ok = true;
+
+    // 1. 关闭：剩下的元素还能取出来，之后recv和send都返回false
+    {
+        Channel<int> ch(4);
+        ch.send(1);
+        ch.send(2);
+        ch.close();
+        int v = 0;
+        ok &= ch.recv(v) && v == 1;
+        ok &= ch.recv(v) && v == 2;
+        ok &= !ch.recv(v);
+        ok &= !ch.send(3);
+        std::cout<<"close "<<(ok ? "ok" : "fail")<<std::endl;
+    }
+
+    // 2. 单个消费者（普通线程）检查每个发送方的顺序，无界通道的环放不下，会走溢出区
+    for(size_t capacity : {size_t(1), size_t(8), Channel<long>::UNBOUNDED}){
+        Channel<long> ch(capacity);
+        done = 0;
+        received = 0;
+        for(long i=0;i<PRODUCERS;i++) scheduler->addTask(producer, &ch, i);
+        if(capacity == Channel<long>::UNBOUNDED) ok &= waitDone(done, PRODUCERS); // 先全部发完，确保用到溢出区
+        std::thread c(consumer, &ch);
+        ok &= waitDone(done, PRODUCERS);
+        ch.close();
+        c.join();
+        std::cout<<"capacity "<<capacity<<" received "<<received<<" order errors "<<orderErrors<<std::endl;
+        ok &= received == PRODUCERS * PER_PRODUCER && orderErrors == 0;
+    }
+
+    // 3. 容量为1：环形队列本身，和建在它上面的通道
+    {
+        MPMCRing<int> ring(1);
+        int v = 0;
+        bool ringOk = ring.capacity() == 1 && ring.tryPush(1) && !ring.tryPush(2);
+        ringOk &= ring.tryPop(v) && v == 1 && !ring.tryPop(v);
+        for(int i=0;i<100;i++){ // 来回多次，序号绕过两个槽位
+            ringOk &= ring.tryPush(i) && !ring.tryPush(-1) && ring.tryPop(v) && v == i;
+        }
+        ringOk &= ring.emptyApprox();
+
+        Channel<int> ch(1);
+        int one = 1, two = 2;
+        ringOk &= ch.capacity() == 1 && ch.trySend(one) && !ch.trySend(two);
+        done = 0;
+        scheduler->addTask(blockingSender, &ch, 2);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ringOk &= !blockedSent; // 满了，发送方挂起
+        ringOk &= ch.recv(v) && v == 1;
+        ringOk &= waitDone(done, 1) && blockedSent;
+        ringOk &= ch.recv(v) && v == 2 && !ch.tryRecv(v);
+        std::cout<<"capacity 1 "<<(ringOk ? "ok" : "fail")<<std::endl;
+        ok &= ringOk;
+    }
+
+    // 4. select：两个通道都发完并关闭后select返回-1
+    {
+        Channel<int> a(2), b;
+        done = 0;
+        for(int i=0;i<2;i++) scheduler->addTask(selector, &a, &b);
+        for(int i=1;i<=1000;i++){
+            a.send(i);
+            b.send(2 * i);
+        }
+        a.close();
+        b.close();
+        ok &= waitDone(done, 2);
+        std::cout<<"select a "<<selectA<<" b "<<selectB<<std::endl;
+        ok &= selectA == 500500 && selectB == 1001000;
+        ok &= Select().recv(a, [](int){}).tryWait() == -1;
+    }
+
+    std::cout<<(ok ? "PASS" : "FAIL")<<std::endl;
+    // 调度器的工作线程还在运行，直接退出，不走全局对象（日志）的析构
+    std::_Exit(ok ? 0 : 1);
+}
@@ -0,0 +1,35 @@
+#include <iostream>
+#include <cfenv>
+#include <cstdlib>
+#include "../fiber.h"
+
+// 浮点环境跟着协程走：协程里改了舍入方式，切回主执行流后是原来的，再切回协程还是它自己的
+// 只有异常标志不同的时候切换会跳过加载MXCSR，控制位仍然保持
+
+static int wrong = 0;
+
+static void roundUp(){
+    std::fesetround(FE_UPWARD);
+    volatile double x = 1.0;
+    x = x / 3.0; // 置上PE标志
+    Fiber::GetThis()->yield();
+    if(std::fegetround() != FE_UPWARD) wrong++;
+    std::fesetround(FE_DOWNWARD);
+    Fiber::GetThis()->yield();
+    if(std::fegetround() != FE_DOWNWARD) wrong++;
+}
+
+int main(){
+    auto fiber = Fiber::Create(roundUp);
+    fiber->start();
+    if(std::fegetround() != FE_TONEAREST) wrong++;
+    std::feclearexcept(FE_ALL_EXCEPT);
+    fiber->resume();
+    if(std::fegetround() != FE_TONEAREST) wrong++;
+    std::fesetround(FE_TOWARDZERO);
+    fiber->resume();
+    if(std::fegetround() != FE_TOWARDZERO) wrong++;
+    std::cout<<"rounding mode kept per fiber, wrong "<<wrong<<std::endl;
+    std::cout<<(wrong == 0 ? "PASS" : "FAIL")<<std::endl;
+    std::_Exit(wrong == 0 ? 0 : 1);
+}
@@ -0,0 +1,111 @@
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include "../scheduler.h"
+#include "test_util.h"
+
+// 同一个fd上一个协程等读、一个协程等写：两边各自登记，谁的事件来了唤醒谁，后登记的不会把先登记的挤掉
+// 对端晚一点才开始收发，保证读写两个协程都先挂在同一个fd上
+
+static const int THREADS = 4;
+static const int PAIRS = 32;
+static const long BYTES = 256 * 1024;
+
+LinuxIOScheduler* scheduler = nullptr;
+std::atomic<int> done {0};
+std::atomic<int> failed {0};
+
+static void waitFd(int fd, uint32_t events){
+    scheduler->addEvent(fd, events | EPOLLET);
+    scheduler->wait();
+}
+
+// 从fd读BYTES字节
+static void reader(int fd){
+    char buf[4096];
+    long got = 0;
+    while(got < BYTES){
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if(n > 0) got += n;
+        else if(n < 0 && errno == EAGAIN) waitFd(fd, EPOLLIN);
+        else{
+            failed++;
+            break;
+        }
+    }
+    done++;
+}
+
+// 往同一个fd写BYTES字节，发送缓冲区很小，要反复等可写
+static void writer(int fd){
+    char buf[4096] = {0};
+    long sent = 0;
+    while(sent < BYTES){
+        ssize_t n = write(fd, buf, sizeof(buf));
+        if(n > 0) sent += n;
+        else if(n < 0 && errno == EAGAIN) waitFd(fd, EPOLLOUT);
+        else{
+            failed++;
+            break;
+        }
+    }
+    done++;
+}
+
+// 对端：同时收发，没有进展时睡一下
+static void peer(int fd){
+    scheduler->sleepFor(std::chrono::milliseconds(20));
+    char in[4096];
+    char out[4096] = {0};
+    long got = 0, sent = 0;
+    while(got < BYTES || sent < BYTES){
+        bool progress = false;
+        if(got < BYTES){
+            ssize_t n = read(fd, in, sizeof(in));
+            if(n > 0){
+                got += n;
+                progress = true;
+            }
+        }
+        if(sent < BYTES){
+            ssize_t n = write(fd, out, std::min<long>(sizeof(out), BYTES - sent));
+            if(n > 0){
+                sent += n;
+                progress = true;
+            }
+        }
+        if(!progress) scheduler->sleepFor(std::chrono::microseconds(200));
+    }
+    done++;
+}
+
+int main(){
+    bool ok = true;
+    scheduler = new LinuxIOScheduler(SchedulerOption(THREADS));
+    int fds[PAIRS][2];
+    for(int i=0;i<PAIRS;i++){
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]) != 0){
+            std::cout<<"socketpair failed"<<std::endl;
+            std::_Exit(1);
+        }
+        int size = 4096;
+        for(int fd : fds[i]){
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        }
+        scheduler->addTask(reader, fds[i][0]);
+        scheduler->addTask(writer, fds[i][0]);
+        scheduler->addTask(peer, fds[i][1]);
+    }
+    bool finished = waitDone(done, PAIRS * 3, std::chrono::seconds(20));
+    std::cout<<"read and write on one fd: done "<<done<<"/"<<PAIRS * 3<<", failed "<<failed<<std::endl;
+    ok &= finished && failed == 0;
+    std::cout<<(ok ? "PASS" : "FAIL")<<std::endl;
+    std::_Exit(ok ? 0 : 1);
+}
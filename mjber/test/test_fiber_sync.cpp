@@ -0,0 +1,134 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <cstdlib>
+#include "../fiber_sync.h"
+#include "../scheduler.h"
+#include "test_util.h"
+
+// 协程和普通线程混合使用同步原语，结束时检查计数
+
+static const int FIBERS = 64;
+static const int ROUNDS = 200;
+
+FiberMutex mutex;
+long counter = 0;
+
+FiberSemaphore sem(2);
+std::atomic<int> inSem {0};
+std::atomic<int> semViolations {0};
+
+FiberMutex queueMutex;
+FiberConditionVariable queueCond;
+std::deque<int> queue;
+long consumed = 0;
+
+FiberRWMutex rw;
+long rwValue = 0;
+std::atomic<int> rwErrors {0};
+
+std::atomic<int> done {0};
+
+void addWork(int rounds){
+    for(int i=0;i<rounds;i++){
+        std::lock_guard<FiberMutex> lock(mutex);
+        long v = counter;
+        if(i % 16 == 0) IOScheduler::GetThis() ? IOScheduler::GetThis()->yield() : std::this_thread::yield(); // 持锁时让出
+        counter = v + 1;
+    }
+    done++;
+}
+
+void semWork(){
+    for(int i=0;i<ROUNDS;i++){
+        sem.acquire();
+        if(++inSem > 2) semViolations++;
+        if(i % 8 == 0) IOScheduler::GetThis()->yield();
+        inSem--;
+        sem.release();
+    }
+    done++;
+}
+
+void producer(int n){
+    for(int i=0;i<n;i++){
+        {
+            std::lock_guard<FiberMutex> lock(queueMutex);
+            queue.push_back(i);
+        }
+        queueCond.notify_one();
+    }
+    done++;
+}
+
+void consumer(int n){
+    for(int i=0;i<n;i++){
+        std::unique_lock<FiberMutex> lock(queueMutex);
+        queueCond.wait(lock, []{ return !queue.empty(); });
+        queue.pop_front();
+        consumed++;
+    }
+    done++;
+}
+
+void rwWork(int id){
+    for(int i=0;i<ROUNDS;i++){
+        if(id % 4 == 0){
+            FiberRWMutex::WriteLockGuard lock(rw);
+            long v = rwValue;
+            IOScheduler::GetThis()->yield();
+            rwValue = v + 1;
+        }
+        else{
+            FiberRWMutex::ReadLockGuard lock(rw);
+            long v = rwValue;
+            IOScheduler::GetThis()->yield();
+            if(v != rwValue) rwErrors++;
+        }
+    }
+    done++;
+}
+
+int main(){
+    auto scheduler = new LinuxIOScheduler(4); // 没有停止接口，不析构
+    bool ok = true;
+
+    // 1. 互斥锁，外加一个普通线程一起抢
+    done = 0;
+    for(int i=0;i<FIBERS;i++) scheduler->addTask(addWork, ROUNDS);
+    std::thread t(addWork, ROUNDS);
+    t.join();
+    ok &= waitDone(done, FIBERS + 1);
+    std::cout<<"mutex counter "<<counter<<" expect "<<(FIBERS + 1) * ROUNDS<<std::endl;
+    ok &= counter == (FIBERS + 1) * ROUNDS;
+
+    // 2. 信号量
+    done = 0;
+    for(int i=0;i<FIBERS;i++) scheduler->addTask(semWork);
+    ok &= waitDone(done, FIBERS);
+    std::cout<<"semaphore violations "<<semViolations<<std::endl;
+    ok &= semViolations == 0;
+
+    // 3. 条件变量，消费者是协程，生产者既有协程也有普通线程
+    done = 0;
+    for(int i=0;i<8;i++) scheduler->addTask(consumer, 2 * ROUNDS);
+    for(int i=0;i<7;i++) scheduler->addTask(producer, 2 * ROUNDS);
+    std::thread p(producer, 2 * ROUNDS);
+    p.join();
+    ok &= waitDone(done, 16);
+    std::cout<<"condvar consumed "<<consumed<<" expect "<<8 * 2 * ROUNDS<<std::endl;
+    ok &= consumed == 8 * 2 * ROUNDS;
+
+    // 4. 读写锁
+    done = 0;
+    for(int i=0;i<FIBERS;i++) scheduler->addTask(rwWork, i);
+    ok &= waitDone(done, FIBERS);
+    std::cout<<"rwlock value "<<rwValue<<" expect "<<FIBERS / 4 * ROUNDS<<" errors "<<rwErrors<<std::endl;
+    ok &= rwValue == FIBERS / 4 * ROUNDS && rwErrors == 0;
+
+    std::cout<<(ok ? "PASS" : "FAIL")<<std::endl;
+    // 调度器的工作线程还在运行，直接退出，不走全局对象（日志）的析构
+    std::_Exit(ok ? 0 : 1);
+}
@@ -0,0 +1,138 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../scheduler.h"
+#include "../socket_wrapper.h"
+#include "../blocking_pool.h"
+
+// 单线程模式：协程都在调用run()的线程上运行；IO等待、定时器、别的线程唤醒和交任务；stop()之后run()返回；SO_REUSEPORT
+
+static const int PAIRS = 8;
+static const int ROUNDS = 1000;
+
+std::thread::id loopThread;
+std::atomic<int> done {0};
+std::atomic<int> wrong {0};
+LocalScheduler* scheduler = nullptr;
+
+static void check(){
+    if(std::this_thread::get_id() != loopThread || scheduler->currentWorker() != 0) wrong++;
+}
+
+static void finish(int total){
+    check();
+    if(++done == total) scheduler->stop();
+}
+
+static bool recvByte(int fd){
+    char c;
+    while(true){
+        ssize_t n = read(fd, &c, 1);
+        if(n == 1) return true;
+        if(n == 0 || errno != EAGAIN) return false;
+        scheduler->addEvent(fd, EPOLLIN | EPOLLET);
+        scheduler->wait();
+    }
+}
+
+static void client(int fd, int total){
+    for(int i=0;i<ROUNDS;i++){
+        if(write(fd, "x", 1) != 1 || !recvByte(fd)){
+            wrong++;
+            break;
+        }
+    }
+    scheduler->rmEvent(fd);
+    close(fd);
+    finish(total);
+}
+
+static void server(int fd, int total){
+    while(recvByte(fd)){
+        if(write(fd, "y", 1) != 1) break;
+    }
+    scheduler->rmEvent(fd);
+    close(fd);
+    finish(total);
+}
+
+static void sleeper(int total){
+    auto begin = std::chrono::steady_clock::now();
+    scheduler->sleepFor(std::chrono::milliseconds(20));
+    if(std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(20)) wrong++;
+    finish(total);
+}
+
+// 卸载池的线程交回结果时唤醒这个线程上的协程
+static void offloader(int total){
+    auto id = offload([]{ return std::this_thread::get_id(); });
+    if(id == loopThread) wrong++;
+    finish(total);
+}
+
+int main(){
+    bool ok = true;
+    loopThread = std::this_thread::get_id();
+    SchedulerOption option(4); // threads不起作用
+    option.local = true;
+    auto shared = IOScheduler::getIOScheduler(option);
+    scheduler = dynamic_cast<LocalScheduler*>(shared.get());
+    ok &= scheduler != nullptr && scheduler->workerCount() == 1;
+    if(!scheduler){
+        std::cout<<"FAIL"<<std::endl;
+        std::_Exit(1);
+    }
+
+    // 1. 连接上的一问一答、睡眠、卸载，另一个线程在运行中交任务过来
+    int total = 2 * PAIRS + 3;
+    for(int i=0;i<PAIRS;i++){
+        int sv[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) != 0){
+            std::cout<<"socketpair failed"<<std::endl;
+            std::_Exit(1);
+        }
+        scheduler->addTask(StackClass::SMALL, server, sv[1], total);
+        scheduler->addTask(StackClass::SMALL, client, sv[0], total);
+    }
+    scheduler->addTask(sleeper, total);
+    scheduler->addTask(offloader, total);
+    std::thread other([&]{
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        scheduler->runInReactor(0, [&]{ scheduler->addTask(sleeper, total); });
+    });
+    auto begin = std::chrono::steady_clock::now();
+    scheduler->run();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    other.join();
+    std::cout<<"local: done "<<done<<"/"<<total<<" in "<<ms<<" ms, wrong "<<wrong<<std::endl;
+    ok &= done == total && wrong == 0;
+    // run()返回后这个线程不再属于调度器
+    ok &= IOScheduler::GetThis() == nullptr && scheduler->currentWorker() == -1;
+
+    // 2. 停止之后再运行直接返回
+    scheduler->addTask(sleeper, total);
+    scheduler->run();
+    ok &= done == total;
+
+    // 3. 两个监听套接字绑定同一个端口
+    bool shared_port = true;
+    try{
+        auto a = SocketWrapper::Create(SocketWrapper::Type::TCP, "127.0.0.1", 18431, true);
+        auto b = SocketWrapper::Create(SocketWrapper::Type::TCP, "127.0.0.1", 18431, true);
+        a->listen();
+        b->listen();
+    }
+    catch(const std::exception& e){
+        std::cout<<"reuseport: "<<e.what()<<std::endl;
+        shared_port = false;
+    }
+    std::cout<<"reuseport bind twice "<<(shared_port ? "ok" : "failed")<<std::endl;
+    ok &= shared_port;
+
+    std::cout<<(ok ? "PASS" : "FAIL")<<std::endl;
+    std::_Exit(ok ? 0 : 1);
+}
@@ -0,0 +1,107 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <stdexcept>
+#include <cstdlib>
+#include "../blocking_pool.h"
+#include "test_util.h"
+
+// 卸载池：返回值和异常交回协程；阻塞调用不占工作线程，同一线程上的其他协程照常运行；队列满时等空位；空闲线程退出
+
+static const int BLOCKERS = 8;
+
+std::atomic<int> done {0};
+std::atomic<int> wrong {0};
+std::atomic<bool> stopTicker {false};
+std::atomic<long> ticks {0};
+
+void values(BlockingPool* pool){
+    if(pool->offload([]{ return std::string("hello"); }) != "hello") wrong++;
+    int x = 0;
+    pool->offload([&]{ x = 42; });
+    if(x != 42) wrong++;
+    try{
+        pool->offload([]()->int{ throw std::runtime_error("boom"); });
+        wrong++;
+    }
+    catch(const std::runtime_error& e){
+        if(std::string(e.what()) != "boom") wrong++;
+    }
+    done++;
+}
+
+// 在池里睡50ms，模拟慢查询
+void blocker(BlockingPool* pool){
+    auto id = pool->offload([]{
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        return std::this_thread::get_id();
+    });
+    if(id == std::this_thread::get_id()) wrong++;
+    done++;
+}
+
+void ticker(IOScheduler* scheduler){
+    while(!stopTicker.load()){
+        ticks++;
+        scheduler->sleepFor(std::chrono::milliseconds(1));
+    }
+}
+
+int main(){
+    bool ok = true;
+    // 只有一个工作线程，阻塞在工作线程上的话其他协程都停住
+    auto scheduler = new LinuxIOScheduler(SchedulerOption(1));
+    IOScheduler* base = scheduler;
+
+    // 1. 返回值、引用捕获和异常
+    {
+        BlockingPool pool;
+        scheduler->addTask(values, &pool);
+        ok &= waitDone(done, 1);
+        ok &= wrong == 0;
+        std::cout<<"values wrong "<<wrong<<std::endl;
+    }
+
+    // 2. 8个50ms的阻塞调用并行执行，期间同一线程上的协程照常运行
+    {
+        BlockingPool pool;
+        done = 0;
+        scheduler->addTask(ticker, base);
+        auto begin = std::chrono::steady_clock::now();
+        for(int i=0;i<BLOCKERS;i++) scheduler->addTask(blocker, &pool);
+        ok &= waitDone(done, BLOCKERS);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        stopTicker = true;
+        auto s = pool.stats();
+        std::cout<<"blockers "<<BLOCKERS<<" took "<<ms<<" ms, ticks "<<ticks<<", peak threads "<<s.peakThreads
+                 <<", completed "<<s.completed<<std::endl;
+        ok &= ms < 50.0 * BLOCKERS / 2 && ticks > 10 && s.completed == BLOCKERS && s.peakThreads > 1;
+    }
+
+    // 3. 队列上限：一个线程、两个空位，后面的协程等空位
+    {
+        BlockingPool::Option option;
+        option.maxThreads = 1;
+        option.queueCapacity = 2;
+        option.idleTimeout = std::chrono::milliseconds(50);
+        BlockingPool pool(option);
+        done = 0;
+        for(int i=0;i<BLOCKERS;i++) scheduler->addTask(blocker, &pool);
+        ok &= waitDone(done, BLOCKERS);
+        auto s = pool.stats();
+        std::cout<<"bounded: full waits "<<s.fullWaits<<", peak threads "<<s.peakThreads<<std::endl;
+        ok &= s.fullWaits > 0 && s.peakThreads == 1 && s.completed == BLOCKERS;
+        // 4. 空闲的线程超时退出
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        ok &= pool.stats().threads == 0;
+    }
+
+    // 5. 不在协程里直接执行
+    ok &= offload([]{ return std::this_thread::get_id(); }) == std::this_thread::get_id();
+    ok &= wrong == 0;
+
+    std::cout<<(ok ? "PASS" : "FAIL")<<std::endl;
+    std::_Exit(ok ? 0 : 1);
+}
@@ -0,0 +1,171 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <cstdlib>
+#include <stdexcept>
+#include "../scheduler.h"
+#include "test_util.h"
+
+// 指定线程运行：addTaskOn新建的协程、wakeupOn唤醒的协程在指定的工作线程上运行，runInReactor交的任务在reactor的线程上执行
+// 工作窃取和多reactor两种模式都测；工作窃取模式下指定只管一次
+// 开启affinityLimit时，被其他线程唤醒的协程回到上次运行它的线程
+
+static const int THREADS = 4;
+static const int TASKS = 1000;
+static const int ROUNDS = 2000;
+
+std::atomic<int> done {0};
+std::atomic<int> misplaced {0};
+
+void onWorker(IOScheduler* scheduler, int expected){
+    if(scheduler->currentWorker() != expected) misplaced++;
+    done++;
+}
+
+// 每一轮把自己交给主线程，由主线程用wakeupOn唤醒到round % THREADS号线程上
+std::mutex parkedMutex;
+Fiber::ptr parked;
+std::atomic<int> parkedRound {-1};
+
+void wanderer(IOScheduler* scheduler, bool pinned){
+    for(int r=0;r<ROUNDS;r++){
+        {
+            std::lock_guard<std::mutex> lock(parkedMutex);
+            parked = Fiber::GetThis();
+            parkedRound.store(r);
+        }
+        scheduler->suspend();
+        if(scheduler->currentWorker() != r % THREADS) misplaced++;
+        // 工作窃取模式下指定只管这一次
+        if(!pinned && Fiber::GetThis()->getWorker() != -1) misplaced++;
+    }
+    done++;
+}
+
+// 每一轮挂起，由主线程用wakeup唤醒，之后应该还在同一个线程上
+void sticky(IOScheduler* scheduler){
+    int home = -1;
+    for(int r=0;r<ROUNDS;r++){
+        {
+            std::lock_guard<std::mutex> lock(parkedMutex);
+            parked = Fiber::GetThis();
+            parkedRound.store(r);
+        }
+        scheduler->suspend();
+        if(home >= 0 && scheduler->currentWorker() != home) misplaced++;
+        home = scheduler->currentWorker();
+    }
+    done++;
+}
+
+static bool run(LinuxIOScheduler* scheduler, bool pinned){
+    bool ok = true;
+    const char* name = pinned ? "multi reactor" : "work stealing";
+
+    // 1. 新建的协程落在指定线程上
+    done = 0;
+    misplaced = 0;
+    for(int i=0;i<TASKS;i++){
+        scheduler->addTaskOn(i % THREADS, onWorker, static_cast<IOScheduler*>(scheduler), i % THREADS);
+    }
+    ok &= waitDone(done, TASKS);
+    std::cout<<name<<" addTaskOn misplaced "<<misplaced<<std::endl;
+    ok &= misplaced == 0;
+
+    // 2. 挂起的协程在指定线程上继续，包括协程还没完全切出就被唤醒的情况
+    done = 0;
+    misplaced = 0;
+    scheduler->addTask(wanderer, static_cast<IOScheduler*>(scheduler), pinned);
+    for(int r=0;r<ROUNDS;r++){
+        Fiber::ptr fiber;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while(!fiber){
+            if(std::chrono::steady_clock::now() > deadline) return false;
+            std::lock_guard<std::mutex> lock(parkedMutex);
+            if(parked && parkedRound.load() == r) fiber = std::move(parked);
+        }
+        scheduler->wakeupOn(r % THREADS, std::move(fiber));
+    }
+    ok &= waitDone(done, 1);
+    std::cout<<name<<" wakeupOn misplaced "<<misplaced<<std::endl;
+    ok &= misplaced == 0;
+
+    // 3. 任务在reactor的线程上执行：默认是事件线程，不是工作线程；多reactor模式下是对应的工作线程
+    done = 0;
+    misplaced = 0;
+    size_t reactors = scheduler->reactorCount();
+    ok &= reactors == (pinned ? THREADS : 1);
+    std::thread posters[2];
+    for(auto& poster : posters){
+        poster = std::thread([&](){
+            for(int i=0;i<TASKS;i++){
+                size_t index = i % reactors;
+                scheduler->runInReactor(index, [scheduler, index, pinned](){
+                    int expected = pinned ? static_cast<int>(index) : -1;
+                    if(scheduler->currentWorker() != expected) misplaced++;
+                    done++;
+                });
+            }
+        });
+    }
+    for(auto& poster : posters) poster.join();
+    ok &= waitDone(done, 2 * TASKS);
+    std::cout<<name<<" runInReactor misplaced "<<misplaced<<std::endl;
+    ok &= misplaced == 0;
+
+    // 4. 下标超出范围
+    bool thrown = false;
+    try{
+        scheduler->addTaskOn(THREADS, onWorker, static_cast<IOScheduler*>(scheduler), 0);
+    }
+    catch(const std::runtime_error&){
+        thrown = true;
+    }
+    ok &= thrown;
+    return ok;
+}
+
+static bool runSticky(){
+    SchedulerOption option(THREADS);
+    option.affinityLimit = 64;
+    // 工作窃取模式的事件线程不能停，不析构
+    auto scheduler = new LinuxIOScheduler(option);
+    done = 0;
+    misplaced = 0;
+    parked = nullptr;
+    parkedRound = -1;
+    scheduler->addTask(sticky, static_cast<IOScheduler*>(scheduler));
+    for(int r=0;r<ROUNDS;r++){
+        Fiber::ptr fiber;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while(!fiber){
+            if(std::chrono::steady_clock::now() > deadline) return false;
+            std::lock_guard<std::mutex> lock(parkedMutex);
+            if(parked && parkedRound.load() == r) fiber = std::move(parked);
+        }
+        scheduler->wakeup(std::move(fiber));
+    }
+    bool ok = waitDone(done, 1);
+    std::cout<<"affinity misplaced "<<misplaced<<" migrations "<<scheduler->migrationCount()<<std::endl;
+    return ok && misplaced == 0 && scheduler->migrationCount() == 0;
+}
+
+int main(){
+    bool ok = true;
+    // 工作窃取模式的事件线程不能停，不析构
+    auto stealing = new LinuxIOScheduler(SchedulerOption(THREADS));
+    ok &= run(stealing, false);
+
+    SchedulerOption option(THREADS);
+    option.multiReactor = true;
+    auto pinned = new LinuxIOScheduler(option);
+    ok &= run(pinned, true);
+    delete pinned;
+
+    ok &= runSticky();
+
+    std::cout<<(ok ? "PASS" : "FAIL")<<std::endl;
+    std::_Exit(ok ? 0 : 1);
+}
@@ -0,0 +1,74 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <cstdlib>
+#include "../scheduler.h"
+
+// 优先级：一个工作线程，三级协程同时积压时按权重（默认8:4:1）轮流运行，低优先级的不会被饿死
+
+static const int HIGH_TASKS = 80;
+static const int NORMAL_TASKS = 40;
+static const int LOW_TASKS = 10;
+static const int TOTAL = HIGH_TASKS + NORMAL_TASKS + LOW_TASKS;
+
+std::atomic<bool> go {false};
+std::mutex orderMutex;
+std::vector<FiberPriority> order;
+
+// 占住唯一的工作线程，等所有协程都放进去再放开
+void blocker(){
+    while(!go.load()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+void record(){
+    std::lock_guard<std::mutex> lock(orderMutex);
+    order.push_back(Fiber::GetThis()->getPriority());
+}
+
+static bool run(bool multi){
+    SchedulerOption option(1);
+    option.multiReactor = multi;
+    // 工作窃取模式的事件线程不能停，不析构
+    auto scheduler = new LinuxIOScheduler(option);
+    go = false;
+    order.clear();
+    scheduler->addTask(blocker);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    // 低优先级的最先放进去
+    for(int i=0;i<LOW_TASKS;i++) scheduler->addTask(FiberPriority::LOW, record);
+    for(int i=0;i<NORMAL_TASKS;i++) scheduler->addTask(record);
+    for(int i=0;i<HIGH_TASKS;i++) scheduler->addTask(FiberPriority::HIGH, record);
+    go = true;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while(true){
+        {
+            std::lock_guard<std::mutex> lock(orderMutex);
+            if(order.size() == TOTAL) break;
+        }
+        if(std::chrono::steady_clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // 前26个（两轮权重）里应该大约是16个HIGH、8个NORMAL、2个LOW
+    int counts[3] = {0, 0, 0};
+    int firstLow = -1;
+    for(int i=0;i<TOTAL;i++){
+        int level = static_cast<int>(order[i]);
+        if(i < 26) counts[level]++;
+        if(level == static_cast<int>(FiberPriority::LOW) && firstLow < 0) firstLow = i;
+    }
+    std::cout<<(multi ? "multi reactor" : "work stealing")<<": first 26 high "<<counts[0]<<" normal "<<counts[1]
+             <<" low "<<counts[2]<<", first low at "<<firstLow<<std::endl;
+    if(multi) delete scheduler;
+    return counts[0] >= 14 && counts[1] >= 6 && counts[2] >= 1 && firstLow < 14;
+}
+
+int main(){
+    bool ok = true;
+    ok &= run(false);
+    ok &= run(true);
+    std::cout<<(ok ? "PASS" : "FAIL")<<std::endl;
+    std::_Exit(ok ? 0 : 1);
+}
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <mutex>
+#include <set>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include "../scheduler.h"
+#include "../channel.h"
+#include "test_util.h"
+
+// 多reactor模式：协程轮流分到各工作线程，之后等IO、睡眠、被其他线程唤醒都回到同一个线程；最后能正常析构
+
+static const int THREADS = 4;
+static const int PIPES = 64;
+static const int MESSAGES = 200;
+
+std::atomic<int> done {0};
+std::atomic<int> migrations {0};
+std::mutex threadsMutex;
+std::set<std::thread::id> threadsSeen;
+
+static void checkThread(std::thread::id home){
+    if(std::this_thread::get_id() != home) migrations++;
+}
+
+static std::thread::id recordThread(){
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    threadsSeen.insert(std::this_thread::get_id());
+    return std::this_thread::get_id();
+}
+
+// 从管道读MESSAGES个字节，每读一次都要等对端写
+void reader(IOScheduler* scheduler, int fd){
+    auto home = recordThread();
+    int got = 0;
+    while(got < MESSAGES){
+        char buf[64];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if(n > 0){
+            got += n;
+            continue;
+        }
+        scheduler->addEvent(fd, EPOLLIN | EPOLLET);
+        scheduler->wait();
+        checkThread(home);
+    }
+    scheduler->rmEvent(fd);
+    close(fd);
+    done++;
+}
+
+void writer(int fd){
+    auto home = recordThread();
+    for(int i=0;i<MESSAGES;i++){
+        if(write(fd, "x", 1) != 1) break;
+        Fiber::sleepFor(std::chrono::microseconds(200));
+        checkThread(home);
+    }
+    close(fd);
+    done++;
+}
+
+// 两个协程分在不同线程上，通过通道来回唤醒
+void pingpong(Channel<int>* in, Channel<int>* out, int rounds){
+    auto home = std::this_thread::get_id();
+    int v = 0;
+    for(int i=0;i<rounds;i++){
+        if(!in->recv(v)) break;
+        checkThread(home);
+        out->send(v + 1);
+    }
+    done++;
+}
+
+int main(){
+    SchedulerOption option(THREADS);
+    option.multiReactor = true;
+    auto scheduler = new LinuxIOScheduler(option);
+    bool ok = true;
+
+    // 1. 管道读写，读方的fd注册在它自己线程的epoll上
+    for(int i=0;i<PIPES;i++){
+        int p[2];
+        if(pipe2(p, O_NONBLOCK | O_CLOEXEC) != 0) return 1;
+        scheduler->addTask(reader, scheduler, p[0]);
+        scheduler->addTask(writer, p[1]);
+    }
+    ok &= waitDone(done, 2 * PIPES);
+    std::cout<<"pipes "<<PIPES<<" threads used "<<threadsSeen.size()<<" migrations "<<migrations<<std::endl;
+    ok &= threadsSeen.size() == THREADS && migrations == 0;
+
+    // 2. 跨线程唤醒，协程相邻创建，分在不同线程上
+    {
+        Channel<int> a(1), b(1);
+        done = 0;
+        scheduler->addTask(pingpong, &a, &b, 10000);
+        scheduler->addTask(pingpong, &b, &a, 10000);
+        a.send(0);
+        ok &= waitDone(done, 2);
+        int v = 0;
+        ok &= a.recv(v) && v == 20000;
+        std::cout<<"pingpong result "<<v<<" migrations "<<migrations<<std::endl;
+        ok &= migrations == 0;
+    }
+
+    // 3. 多reactor模式没有单独的事件线程，可以停止并析构
+    delete scheduler;
+    std::cout<<(ok ? "PASS" : "FAIL")<<std::endl;
+    std::_Exit(ok ? 0 : 1);
+}
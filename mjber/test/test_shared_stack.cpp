@@ -0,0 +1,61 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <cstdlib>
+#include "../scheduler.h"
+#include "test_util.h"
+
+// 共享栈：很多SHARED协程挤在两个共享栈上，在几个线程之间来回迁移（每轮指定下一次在哪个线程上运行）、睡眠，
+// 栈上的局部变量和指向它们的指针在挂起、迁移之后都保持不变；共享栈被占着时线程不空等，协程排回队列
+
+static const int THREADS = 4;
+static const int FIBERS = 64;
+static const int ROUNDS = 40;
+static const int LOCALS = 256;
+
+LinuxIOScheduler* scheduler = nullptr;
+std::atomic<int> done {0};
+std::atomic<int> corrupted {0};
+std::atomic<int> migrated {0}; // 在不止一个线程上运行过的协程数
+
+static void worker(int id){
+    if(Fiber::GetThis()->getStackMode() != StackMode::SHARED) corrupted++;
+    long locals[LOCALS];
+    for(int i=0;i<LOCALS;i++) locals[i] = id * 100000L + i;
+    long* self = locals; // 栈上的指针，恢复时共享栈必须回到同一地址
+    std::set<int> workers;
+    for(int r=0;r<ROUNDS;r++){
+        workers.insert(scheduler->currentWorker());
+        Fiber::GetThis()->setWorker((id + r) % THREADS);
+        if(r % 8 == 7) scheduler->sleepFor(std::chrono::milliseconds(1));
+        else scheduler->yield();
+        if(self != locals) corrupted++;
+        for(int i=0;i<LOCALS;i++){
+            if(self[i] != id * 100000L + i){
+                corrupted++;
+                break;
+            }
+        }
+    }
+    if(workers.size() > 1) migrated++;
+    done++;
+}
+
+int main(){
+    bool ok = true;
+    SharedStackPool::Config(2, 256 * 1024);
+    scheduler = new LinuxIOScheduler(SchedulerOption(THREADS));
+    FiberOption option;
+    option.stack_mode = StackMode::SHARED;
+    auto begin = std::chrono::steady_clock::now();
+    for(int i=0;i<FIBERS;i++) scheduler->addTask(option, worker, i);
+    waitDone(done, FIBERS);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    std::cout<<"shared stack: done "<<done<<"/"<<FIBERS<<" in "<<ms<<" ms, corrupted "<<corrupted
+             <<", migrated "<<migrated<<", requeued on busy stack "<<scheduler->sharedBusyCount()<<std::endl;
+    ok &= done == FIBERS && corrupted == 0 && migrated == FIBERS;
+    std::cout<<(ok ? "PASS" : "FAIL")<<std::endl;
+    std::_Exit(ok ? 0 : 1);
+}
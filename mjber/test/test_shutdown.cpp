@@ -0,0 +1,174 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../http_server.h"
+
+// 停止：调度器等协程结束、到期取消剩下的、丢掉停不下来的，然后join所有线程，之后可以析构；
+// HttpServer停止时空闲连接断开，正在处理的请求写完，到期的被取消，setup()返回
+
+std::atomic<int> wrong {0};
+
+void shortTask(IOScheduler* scheduler){
+    scheduler->sleepFor(std::chrono::milliseconds(20));
+}
+
+// 等一个永远不会来的事件，被取消时返回
+void reader(IOScheduler* scheduler, int fd){
+    char c;
+    while(read(fd, &c, 1) == -1 && errno == EAGAIN){
+        scheduler->addEvent(fd, EPOLLIN);
+        if(!scheduler->wait()){
+            if(Fiber::GetThis()->interrupted() != ECANCELED) wrong++;
+            break;
+        }
+    }
+    scheduler->rmEvent(fd);
+}
+
+// 不理会打断
+void stubborn(IOScheduler* scheduler){
+    while(true) scheduler->suspend();
+}
+
+static bool checkScheduler(const char* name, IOScheduler* scheduler, std::thread* loop){
+    int sv[2][2];
+    for(auto& pair : sv){
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair) != 0) return false;
+    }
+    for(int i=0;i<5;i++) scheduler->addTask(shortTask, scheduler);
+    for(auto& pair : sv) scheduler->addTask(reader, scheduler, pair[0]);
+    scheduler->addTask(stubborn, scheduler);
+    auto begin = std::chrono::steady_clock::now();
+    auto report = scheduler->shutdown(begin + std::chrono::milliseconds(200), std::chrono::milliseconds(100));
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    if(loop) loop->join();
+    std::cout<<name<<": finished "<<report.finished<<" cancelled "<<report.cancelled<<" abandoned "<<report.abandoned
+             <<" in "<<ms<<" ms, live "<<scheduler->liveCount()<<std::endl;
+    for(auto& pair : sv){
+        close(pair[0]);
+        close(pair[1]);
+    }
+    return report.finished == 5 && report.cancelled == 3 && report.abandoned == 1 && scheduler->liveCount() == 0 && ms < 1000;
+}
+
+static int connectTo(uint16_t port){
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0){
+        close(fd);
+        return -1;
+    }
+    timeval tv{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+static void sendGet(int fd, const std::string& path){
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: test\r\n\r\n";
+    if(write(fd, request.data(), request.size()) != static_cast<ssize_t>(request.size())) wrong++;
+}
+
+// 读到连接关闭，返回收到的内容
+static std::string readAll(int fd){
+    std::string data;
+    char buf[4096];
+    ssize_t n;
+    while((n = read(fd, buf, sizeof(buf))) > 0) data.append(buf, n);
+    return data;
+}
+
+static std::shared_ptr<HttpResponse> reply(const std::string& body){
+    auto res = std::make_shared<HttpResponse>();
+    res->m_code = 200;
+    res->m_version = "HTTP/1.1";
+    res->m_reason = "OK";
+    res->m_body = body;
+    res->addHeader("Content-Length", std::to_string(body.size()));
+    return res;
+}
+
+static bool checkServer(){
+    const uint16_t port = static_cast<uint16_t>(20000 + getpid() % 20000);
+    SchedulerOption option(2);
+    HttpServer server("127.0.0.1", port, option);
+    RouteRules rules;
+    rules.emplace_back("/slow", [](std::shared_ptr<HttpRequest>){
+        globalScheduler->sleepFor(std::chrono::milliseconds(100));
+        return reply("slow");
+    });
+    rules.emplace_back("/stuck", [](std::shared_ptr<HttpRequest>){
+        globalScheduler->sleepFor(std::chrono::seconds(10));
+        return reply("stuck");
+    });
+    server.setRoute(rules);
+    std::atomic<bool> returned {false};
+    std::thread serving([&]{
+        server.setup();
+        returned = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    int idle = connectTo(port);
+    int slow = connectTo(port);
+    int stuck = connectTo(port);
+    if(idle < 0 || slow < 0 || stuck < 0) return false;
+    sendGet(slow, "/slow");
+    sendGet(stuck, "/stuck");
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+
+    auto begin = std::chrono::steady_clock::now();
+    auto report = server.shutdown(std::chrono::milliseconds(300));
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    serving.join();
+    std::string idleData = readAll(idle);
+    std::string slowData = readAll(slow);
+    std::string stuckData = readAll(stuck);
+    int late = connectTo(port);
+    std::cout<<"http server: drained "<<report.drained<<" aborted "<<report.aborted<<" in "<<ms<<" ms"
+             <<", slow got "<<slowData.size()<<" bytes, stuck got "<<stuckData.size()<<" bytes"
+             <<", new connection "<<(late < 0 ? "refused" : "accepted")<<std::endl;
+    close(idle);
+    close(slow);
+    close(stuck);
+    if(late >= 0) close(late);
+    return returned && report.drained == 1 && report.aborted == 1 && idleData.empty()
+        && slowData.find("200 OK") != std::string::npos && slowData.find("slow") != std::string::npos
+        && stuckData.empty() && late < 0 && ms < 1000;
+}
+
+int main(){
+    bool ok = true;
+    {
+        SchedulerOption option(2);
+        auto scheduler = new LinuxIOScheduler(option);
+        ok &= checkScheduler("work stealing", scheduler, nullptr);
+        delete scheduler;
+    }
+    {
+        SchedulerOption option(2);
+        option.multiReactor = true;
+        auto scheduler = new LinuxIOScheduler(option);
+        ok &= checkScheduler("multi reactor", scheduler, nullptr);
+        delete scheduler;
+    }
+    {
+        auto scheduler = new LocalScheduler();
+        std::thread loop([scheduler]{ scheduler->run(); });
+        ok &= checkScheduler("local", scheduler, &loop);
+        delete scheduler;
+    }
+    ok &= checkServer();
+    ok &= wrong == 0;
+    std::cout<<(ok ? "PASS" : "FAIL")<<std::endl;
+    std::_Exit(ok ? 0 : 1);
+}
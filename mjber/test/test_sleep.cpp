@@ -0,0 +1,127 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include "../scheduler.h"
+#include "../fiber_sync.h"
+#include "../channel.h"
+#include "test_util.h"
+
+// 协程睡眠和带超时的等待：大量协程在少量线程上同时睡眠，检查醒来的时间；等待fd超时和在超时前就绪；
+// 截止时间和取消打断各种挂起点
+
+using Clock = std::chrono::steady_clock;
+
+static const int SLEEPERS = 1000;
+
+std::atomic<int> done {0};
+std::atomic<int> early {0};
+std::atomic<long> maxLateMs {0};
+
+void sleeper(int ms){
+    auto begin = Clock::now();
+    Fiber::sleepFor(std::chrono::milliseconds(ms));
+    auto slept = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - begin).count();
+    if(slept < ms) early++;
+    long late = slept - ms;
+    long cur = maxLateMs.load();
+    while(late > cur && !maxLateMs.compare_exchange_weak(cur, late)) {}
+    done++;
+}
+
+std::atomic<int> timedOut {0};
+std::atomic<int> woken {0};
+
+void waitPipe(IOScheduler* scheduler, int fd, int timeoutMs){
+    scheduler->addEvent(fd, EPOLLIN | EPOLLET);
+    char c = 0;
+    while(read(fd, &c, 1) != 1){
+        if(!scheduler->waitFor(std::chrono::milliseconds(timeoutMs))){
+            timedOut++;
+            break;
+        }
+    }
+    if(c == 'x') woken++;
+    done++;
+}
+
+std::atomic<int> deadlineErrors {0};
+
+// 截止时间打断IO等待、锁等待和睡眠
+void deadlineWork(IOScheduler* scheduler, int fd, FiberMutex* mutex){
+    auto self = Fiber::GetThis();
+    self->setDeadline(Clock::now() + std::chrono::milliseconds(30));
+    scheduler->addEvent(fd, EPOLLIN | EPOLLET);
+    if(scheduler->wait() || self->interrupted() != ETIMEDOUT) deadlineErrors++;
+    if(mutex->try_lock_for(std::chrono::seconds(5))) deadlineErrors++;
+    auto begin = Clock::now();
+    Fiber::sleepFor(std::chrono::seconds(5));
+    if(Clock::now() - begin > std::chrono::seconds(1)) deadlineErrors++;
+    done++;
+}
+
+std::atomic<bool> tokenReady {false};
+CancelToken token;
+
+// 阻塞在通道上，被另一个线程取消
+void cancelWork(IOScheduler* scheduler, Channel<int>* ch){
+    token = scheduler->cancelToken();
+    tokenReady = true;
+    int v;
+    if(ch->recv(v) || Fiber::GetThis()->interrupted() != ECANCELED) deadlineErrors++;
+    if(Select().recv(*ch, [](int){}).wait() != Select::INTERRUPTED) deadlineErrors++;
+    done++;
+}
+
+int main(){
+    auto scheduler = new LinuxIOScheduler(2); // 没有停止接口，不析构
+    bool ok = true;
+
+    // 1. 两个工作线程上同时睡1000个协程，总耗时应该接近最长的睡眠时间
+    auto begin = Clock::now();
+    for(int i=0;i<SLEEPERS;i++) scheduler->addTask(sleeper, 10 + i % 100);
+    ok &= waitDone(done, SLEEPERS);
+    auto total = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - begin).count();
+    std::cout<<"sleepers "<<SLEEPERS<<" total "<<total<<"ms early "<<early<<" max late "<<maxLateMs<<"ms"<<std::endl;
+    ok &= early == 0 && total < 2000;
+
+    // 2. 等待管道：一个超时，一个在超时前被写入
+    int fds[2][2];
+    for(auto& p : fds){
+        if(pipe2(p, O_NONBLOCK) != 0) return 1;
+    }
+    done = 0;
+    scheduler->addTask(waitPipe, scheduler, fds[0][0], 50);
+    scheduler->addTask(waitPipe, scheduler, fds[1][0], 5000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if(write(fds[1][1], "x", 1) != 1) return 1;
+    ok &= waitDone(done, 2);
+    std::cout<<"timed out "<<timedOut<<" woken "<<woken<<std::endl;
+    ok &= timedOut == 1 && woken == 1;
+
+    // 3. 截止时间和取消
+    {
+        int p[2];
+        if(pipe2(p, O_NONBLOCK) != 0) return 1;
+        FiberMutex mutex;
+        Channel<int> ch(1);
+        mutex.lock();
+        done = 0;
+        scheduler->addTask(deadlineWork, scheduler, p[0], &mutex);
+        scheduler->addTask(cancelWork, scheduler, &ch);
+        while(!tokenReady) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        token.cancel();
+        ok &= waitDone(done, 2);
+        mutex.unlock();
+        std::cout<<"deadline/cancel errors "<<deadlineErrors<<std::endl;
+        ok &= deadlineErrors == 0;
+    }
+
+    std::cout<<(ok ? "PASS" : "FAIL")<<std::endl;
+    // 调度器的工作线程还在运行，直接退出，不走全局对象（日志）的析构
+    std::_Exit(ok ? 0 : 1);
+}
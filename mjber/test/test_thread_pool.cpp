@@ -0,0 +1,142 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <array>
+#include <cstdlib>
+#include <stdexcept>
+#include "../thread_pool.h"
+#include "test_util.h"
+
+// ThreadPool::post：多个线程同时交任务都会执行一次；队列满了退回加锁队列；大的捕获放在堆上；只能移动的参数；
+// 池里的线程自己post；stopWork前交的任务都执行完，之后post抛异常；enqueue照常工作；
+// 和stopWork同时post的任务要么抛异常要么执行，不会丢；环形队列容量为1时多出来的任务走加锁队列，每个只执行一次
+
+static const int PRODUCERS = 4;
+static const int TASKS = 20000;
+
+std::atomic<long> done {0};
+std::atomic<long> sum {0};
+
+static void add(long value){
+    sum.fetch_add(value, std::memory_order_relaxed);
+    done.fetch_add(1, std::memory_order_relaxed);
+}
+
+int main(){
+    bool ok = true;
+
+    // 1. 多个生产者，容量很小，大部分时候队列是满的
+    {
+        ThreadPool pool(4, 8);
+        done = 0;
+        sum = 0;
+        std::vector<std::thread> producers;
+        for(int p=0;p<PRODUCERS;p++){
+            producers.emplace_back([&pool]{
+                for(int i=1;i<=TASKS;i++) pool.post(add, static_cast<long>(i));
+            });
+        }
+        for(auto& t : producers) t.join();
+        long expected = static_cast<long>(TASKS) * (TASKS + 1) / 2 * PRODUCERS;
+        bool finished = waitDone(done, static_cast<long>(TASKS) * PRODUCERS);
+        std::cout<<"producers: done "<<done<<", sum "<<(sum == expected ? "ok" : "wrong")<<std::endl;
+        ok &= finished && sum == expected;
+    }
+
+    // 2. 超过缓冲区的捕获、只能移动的参数、池里的线程再post
+    {
+        ThreadPool pool(2);
+        done = 0;
+        sum = 0;
+        std::array<long, 32> big;
+        big.fill(1);
+        pool.post([big]{ long s = 0; for(long v : big) s += v; add(s); });
+        pool.post([](std::unique_ptr<long>& p){ add(*p); }, std::make_unique<long>(100));
+        pool.post([&pool]{ pool.post(add, 1000L); add(0); });
+        bool finished = waitDone(done, 4);
+        std::cout<<"captures: done "<<done<<", sum "<<sum<<std::endl;
+        ok &= finished && sum == 32 + 100 + 1000;
+    }
+
+    // 3. 停止：已经交的任务执行完，之后post抛异常；enqueue和post混用
+    {
+        done = 0;
+        sum = 0;
+        bool threw = false;
+        {
+            ThreadPool pool(2, 16);
+            auto future = pool.enqueue([]{ return 7; });
+            for(int i=0;i<100;i++){
+                pool.post([]{
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    add(1);
+                });
+            }
+            ok &= future.get() == 7;
+            pool.stopWork();
+            try{
+                pool.post(add, 1L);
+            }
+            catch(const std::runtime_error&){
+                threw = true;
+            }
+        }
+        std::cout<<"stop: done "<<done<<", post after stop "<<(threw ? "threw" : "accepted")<<std::endl;
+        ok &= done == 100 && threw;
+    }
+
+    // 4. 环形队列容量为1：线程被第一个任务占住，之后交的任务一个放环里，其余走加锁队列
+    {
+        const int COUNT = 16;
+        std::array<std::atomic<int>, COUNT> runs {};
+        std::atomic<bool> release {false};
+        done = 0;
+        {
+            ThreadPool pool(1, 1);
+            pool.post([&release]{ while(!release) std::this_thread::yield(); });
+            for(int i=0;i<COUNT;i++) pool.post([&runs, i]{ runs[i]++; add(0); });
+            release = true;
+            ok &= waitDone(done, COUNT);
+        }
+        int once = 0;
+        for(auto& r : runs) once += r == 1;
+        std::cout<<"ring capacity 1: done "<<done<<", ran exactly once "<<once<<"/"<<COUNT<<std::endl;
+        ok &= done == COUNT && once == COUNT;
+    }
+
+    // 5. post和stopWork同时进行：没抛异常的任务都要执行
+    {
+        const int ROUNDS = 200;
+        long accepted = 0;
+        done = 0;
+        for(int r=0;r<ROUNDS;r++){
+            std::atomic<bool> started {false};
+            long count = 0;
+            {
+                ThreadPool pool(2, r % 2 ? 4 : 1024); // 小容量时走加锁队列
+                std::thread producer([&]{
+                    try{
+                        while(true){
+                            pool.post(add, 1L);
+                            count++;
+                            started = true;
+                        }
+                    }
+                    catch(const std::runtime_error&){}
+                });
+                while(!started) std::this_thread::yield();
+                pool.stopWork();
+                producer.join();
+            }
+            accepted += count;
+        }
+        std::cout<<"post racing stop: accepted "<<accepted<<", done "<<done<<std::endl;
+        ok &= done == accepted;
+    }
+
+    std::cout<<(ok ? "PASS" : "FAIL")<<std::endl;
+    std::_Exit(ok ? 0 : 1);
+}
@@ -0,0 +1,86 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+#include <sched.h>
+#include "../scheduler.h"
+#include "test_util.h"
+
+// 线程绑定：CPU列表的解析；工作线程绑定到指定的CPU/节点上运行；同一节点上的线程轮流分配；节点不存在时构造失败
+
+static const int THREADS = 4;
+
+std::atomic<int> done {0};
+std::atomic<int> wrong {0};
+
+// 在指定的线程上运行，检查所在的CPU和轮到的同节点线程
+void check(IOScheduler* scheduler, int cpu){
+    if(cpu >= 0 && sched_getcpu() != cpu) wrong++;
+    for(int i=0;i<2*THREADS;i++){
+        int next = scheduler->nextNodeWorker();
+        if(next < 0 || scheduler->workerNode(next) != scheduler->workerNode(scheduler->currentWorker())) wrong++;
+    }
+    done++;
+}
+
+int main(){
+    bool ok = true;
+
+    // 1. 解析
+    auto cpus = CpuTopology::ParseList("0-2,5,7-8");
+    ok &= cpus == std::vector<int>({0, 1, 2, 5, 7, 8});
+    ok &= CpuTopology::ParseList("").empty();
+
+    // 2. 全部绑定到CPU 0（沙箱里可能只有这一个），所有线程在同一个节点上
+    int node = CpuTopology::NodeOf(0);
+    std::cout<<"nodes "<<CpuTopology::Nodes().size()<<" cpu 0 on node "<<node<<std::endl;
+    ok &= node >= 0 && !CpuTopology::NodeCpus(node).empty();
+    for(bool multi : {false, true}){
+        SchedulerOption option(THREADS);
+        option.multiReactor = multi;
+        option.cpus = {0};
+        // 工作窃取模式的事件线程不能停，不析构
+        auto scheduler = new LinuxIOScheduler(option);
+        done = 0;
+        for(int i=0;i<THREADS;i++){
+            ok &= scheduler->workerNode(i) == node;
+            scheduler->addTaskOn(i, check, static_cast<IOScheduler*>(scheduler), 0);
+        }
+        ok &= waitDone(done, THREADS);
+        // 不在工作线程上
+        ok &= scheduler->nextNodeWorker() == -1;
+        std::cout<<(multi ? "multi reactor" : "work stealing")<<" pinned to cpu 0, wrong "<<wrong<<std::endl;
+    }
+
+    // 3. 按节点绑定
+    {
+        SchedulerOption option(THREADS);
+        option.numaNodes = {node};
+        auto scheduler = new LinuxIOScheduler(option);
+        done = 0;
+        for(int i=0;i<THREADS;i++){
+            ok &= scheduler->workerNode(i) == node;
+            scheduler->addTaskOn(i, check, static_cast<IOScheduler*>(scheduler), -1);
+        }
+        ok &= waitDone(done, THREADS);
+        std::cout<<"numa node "<<node<<", wrong "<<wrong<<std::endl;
+    }
+    ok &= wrong == 0;
+
+    // 4. 节点不存在
+    bool thrown = false;
+    try{
+        SchedulerOption option(THREADS);
+        option.numaNodes = {4095};
+        LinuxIOScheduler scheduler(option);
+    }
+    catch(const std::runtime_error&){
+        thrown = true;
+    }
+    ok &= thrown;
+
+    std::cout<<(ok ? "PASS" : "FAIL")<<std::endl;
+    std::_Exit(ok ? 0 : 1);
+}
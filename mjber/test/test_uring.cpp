@@ -0,0 +1,185 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../socket_wrapper.h"
+#include "test_util.h"
+
+// io_uring调度器：套接字的accept、connect、读写直接走环；等待被截止时间/取消打断后数据不丢；
+// rmEvent唤醒poll等待的协程、取消监听fd上的multishot accept；共享栈协程退回就绪通知；最后能正常析构
+// 内核不支持io_uring时检查退回了epoll
+
+static const int CLIENTS = 32;
+static const int ROUNDS = 50;
+
+std::atomic<int> done {0};
+std::atomic<int> accepted {0};
+std::atomic<int> failures {0};
+
+static void fail(const std::string& what){
+    std::cout<<"FAIL: "<<what<<std::endl;
+    failures++;
+}
+
+// 找一个空闲端口
+static uint16_t freePort(){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+void echo(std::shared_ptr<SocketWrapper> socket){
+    char buf[256];
+    while(true){
+        ssize_t n = socket->read(buf, sizeof(buf));
+        if(n <= 0) break;
+        if(socket->write(buf, n) != 0) break;
+    }
+    done++;
+}
+
+void accepter(std::shared_ptr<SocketWrapper> server, int count){
+    for(int i=0;i<count;i++){
+        auto client = server->accept();
+        if(!client){
+            fail("accept");
+            break;
+        }
+        if(client->getIP() != "127.0.0.1") fail("peer address " + client->getIP());
+        accepted++;
+        globalScheduler->addTask(echo, client);
+    }
+    done++;
+}
+
+void client(uint16_t port, int id){
+    auto socket = SocketWrapper::Create(SocketWrapper::Type::TCP, "127.0.0.1", 0);
+    if(!socket->connect("127.0.0.1", port)){
+        fail("connect " + std::string(std::strerror(errno)));
+        done++;
+        return;
+    }
+    for(int i=0;i<ROUNDS;i++){
+        std::string msg = "client " + std::to_string(id) + " round " + std::to_string(i);
+        socket->write(msg.c_str(), msg.size());
+        std::string got;
+        char buf[256];
+        while(got.size() < msg.size()){
+            ssize_t n = socket->read(buf, sizeof(buf));
+            if(n <= 0) break;
+            got.append(buf, n);
+        }
+        if(got != msg){
+            fail("echo mismatch: " + got);
+            break;
+        }
+    }
+    done++;
+}
+
+// 等待超时返回ETIMEDOUT，之后到的数据还能读到
+std::atomic<int> stage {0};
+void timedReader(IOScheduler* scheduler, int fd){
+    char buf[16];
+    Fiber::GetThis()->setDeadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(50));
+    ssize_t n = scheduler->ioRead(fd, buf, sizeof(buf));
+    if(n != -1 || errno != ETIMEDOUT) fail("read should time out");
+    Fiber::GetThis()->clearDeadline();
+    stage = 1;
+    n = scheduler->ioRead(fd, buf, sizeof(buf));
+    if(n != 4 || std::memcmp(buf, "late", 4) != 0) fail("data after timeout lost");
+    done++;
+}
+
+// 取消令牌打断读
+CancelToken token;
+std::atomic<bool> tokenReady {false};
+void cancelledReader(IOScheduler* scheduler, int fd){
+    token = scheduler->cancelToken();
+    tokenReady = true;
+    char buf[16];
+    ssize_t n = scheduler->ioRead(fd, buf, sizeof(buf));
+    if(n != -1 || errno != ECANCELED) fail("read should be cancelled");
+    done++;
+}
+
+// rmEvent唤醒poll等待
+std::atomic<bool> polling {false};
+void poller(IOScheduler* scheduler, int fd){
+    scheduler->addEvent(fd, EPOLLIN | EPOLLET);
+    polling = true;
+    if(!scheduler->wait()) fail("poll wait interrupted");
+    done++;
+}
+
+int main(){
+    SchedulerOption option(4);
+    option.ioUring = true;
+    globalScheduler = IOScheduler::getIOScheduler(option);
+    IOScheduler* scheduler = globalScheduler.get();
+    bool uring = dynamic_cast<UringIOScheduler*>(scheduler) != nullptr;
+    if(uring != UringIOScheduler::Supported()) fail("backend selection");
+    std::cout<<"backend "<<(uring ? "io_uring" : "epoll")<<std::endl;
+
+    // 1. 回显：accept、connect、读写，共享栈的客户端走就绪通知
+    uint16_t port = freePort();
+    auto server = SocketWrapper::Create(SocketWrapper::Type::TCP, "127.0.0.1", port);
+    server->listen();
+    scheduler->addTask(accepter, server, CLIENTS);
+    for(int i=0;i<CLIENTS;i++){
+        FiberOption fo;
+        if(i % 4 == 0) fo.stack_mode = StackMode::SHARED;
+        scheduler->addTask(fo, client, port, i);
+    }
+    if(!waitDone(done, 1 + 2 * CLIENTS)) fail("echo timeout");
+    std::cout<<"accepted "<<accepted<<" clients"<<std::endl;
+    if(accepted != CLIENTS) fail("accept count");
+
+    if(uring){
+        // 2. 超时之后的数据
+        int sv[2];
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv);
+        done = 0;
+        scheduler->addTask(timedReader, scheduler, sv[0]);
+        if(!waitFor([](){ return stage.load() == 1; })) fail("timed read stuck");
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        if(write(sv[1], "late", 4) != 4) fail("write");
+        if(!waitDone(done, 1)) fail("timed reader timeout");
+
+        // 3. 取消
+        done = 0;
+        scheduler->addTask(cancelledReader, scheduler, sv[0]);
+        if(!waitFor([](){ return tokenReady.load(); })) fail("token");
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        token.cancel();
+        if(!waitDone(done, 1)) fail("cancelled reader timeout");
+
+        // 4. 其他线程rmEvent唤醒poll等待
+        done = 0;
+        scheduler->addTask(poller, scheduler, sv[0]);
+        if(!waitFor([](){ return polling.load(); })) fail("poller");
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        scheduler->rmEvent(sv[0]);
+        if(!waitDone(done, 1)) fail("rmEvent did not wake poller");
+        close(sv[0]);
+        close(sv[1]);
+    }
+
+    // 5. 关闭监听fd取消multishot accept，之后析构调度器
+    server.reset();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    globalScheduler.reset();
+    std::cout<<(failures == 0 ? "PASS" : "FAIL")<<std::endl;
+    std::_Exit(failures == 0 ? 0 : 1);
+}
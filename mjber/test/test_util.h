@@ -0,0 +1,34 @@
+#ifndef TEST_UTIL
+#define TEST_UTIL
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+/*
+    测试共用的等待：主线程轮询，等协程或者池里的线程把活干完
+    超时返回false，由测试自己报错；poll是两次检查之间睡多久
+*/
+
+//--等到ready()返回true
+template <typename F>
+bool waitFor(F ready,
+             std::chrono::milliseconds timeout = std::chrono::seconds(30),
+             std::chrono::microseconds poll = std::chrono::milliseconds(1)){
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while(!ready()){
+        if(std::chrono::steady_clock::now() > deadline) return false;
+        std::this_thread::sleep_for(poll);
+    }
+    return true;
+}
+
+//--等到计数达到target
+template <typename T, typename U>
+bool waitDone(const std::atomic<T>& counter, U target,
+              std::chrono::milliseconds timeout = std::chrono::seconds(30),
+              std::chrono::microseconds poll = std::chrono::milliseconds(1)){
+    return waitFor([&counter, target]{ return counter.load() >= target; }, timeout, poll);
+}
+
+#endif
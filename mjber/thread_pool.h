@@ -9,10 +9,17 @@
 #include <future>
 #include <functional>
 #include <stdexcept>
+#include <atomic>
+
+#include "mpmc_ring.h"
+#include "inline_task.h"
 
 class ThreadPool {
 public:
-    ThreadPool(size_t threads);
+    static const size_t POST_INLINE_SIZE = 64;     // post的任务连同参数不超过这个大小时不分配
+    static const size_t DEFAULT_RING_CAPACITY = 1024;
+
+    ThreadPool(size_t threads, size_t ringCapacity = DEFAULT_RING_CAPACITY);
     ~ThreadPool();
     void stopWork();
 
@@ -23,17 +30,34 @@ public:
     auto enqueue(F&& f, Args&&... args) 
         -> std::future<typename std::result_of<F(Args...)>::type>;
 
+    //--只执行不取结果的任务，不创建future
+    //--任务直接构造在无锁环形队列的槽位里，捕获不超过POST_INLINE_SIZE时不碰堆；队列满了退回到enqueue用的加锁队列
+    //--stopWork之后调用抛异常；和stopWork同时调用时任务要么抛异常，要么一定会执行（线程都退出了就由调用方自己执行）
+    template<class F, class... Args>
+    void post(F&& f, Args&&... args);
+
 
 private:
+    using PostTask = InlineTask<POST_INLINE_SIZE>;
+
+    // 有任务时取出并执行，没有时返回false
+    bool runOne();
+    // 交了任务之后叫醒一个等待的线程
+    void notifyOne();
+
     // 工作线程集合
     std::vector<std::thread> workers;
     // 任务队列
     std::queue<std::function<void()>> tasks;
     
+    // post的任务，容量为1也可以，放不下的走tasks
+    MPMCRing<PostTask> ring;
+    std::atomic<size_t> sleeping {0}; // 在condition上等待的线程数，为0时post不用碰锁
+
     // 同步相关
     std::mutex queue_mutex;
     std::condition_variable condition;
-    bool stop;
+    std::atomic<bool> stop;
 };
 
 // 添加任务
@@ -59,24 +83,77 @@ auto ThreadPool::enqueue(F&& f, Args&&... args)
     return res;
 }
 
+template <typename F, typename... Args>
+void ThreadPool::post(F&& f, Args&&... args) {
+    if (stop.load(std::memory_order_relaxed)) {
+        throw std::runtime_error("post on stopped ThreadPool");
+    }
+    PostTask task;
+    task.emplace(std::forward<F>(f), std::forward<Args>(args)...);
+    if (!ring.tryPush(task)) {
+        // 满了不等待：池里的线程自己post时等空位会死锁
+        auto overflow = std::make_shared<PostTask>(std::move(task));
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        // 加锁后再看一次，stop和线程退出前的检查都在锁里，这里放进去的一定会被执行
+        if (stop) {
+            throw std::runtime_error("post on stopped ThreadPool");
+        }
+        tasks.emplace([overflow]() { (*overflow)(); });
+        lock.unlock();
+        notifyOne();
+        return;
+    }
+    // 开头检查之后stopWork了，线程可能已经看到队列是空的退出了，没人取这个任务，由调用方执行剩下的
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (stop.load(std::memory_order_relaxed)) {
+        while (runOne()) {}
+        return;
+    }
+    notifyOne();
+}
+
+// 和等待前登记sleeping之后的检查配对：要么这里看到有线程在等，要么它看到新任务
+void ThreadPool::notifyOne() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed) == 0) return;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+    }
+    condition.notify_one();
+}
+
+bool ThreadPool::runOne() {
+    PostTask posted;
+    if (ring.tryPop(posted)) {
+        posted();
+        return true;
+    }
+    std::function<void()> task;
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (tasks.empty()) return false;
+        task = std::move(tasks.front());
+        tasks.pop();
+    }
+    task();
+    return true;
+}
+
 // 线程池构造函数
 // 每个线程都等待任务，需要一个互斥量
-ThreadPool::ThreadPool(size_t threadCount) : stop(false) {
+// 先取post的无锁队列，再取加锁的队列，都空了才去等；停止时两边的任务都执行完才退出
+ThreadPool::ThreadPool(size_t threadCount, size_t ringCapacity) : ring(ringCapacity), stop(false) {
     for (size_t i = 0; i < threadCount; ++i) {
         workers.emplace_back([this] {
             while (true) {
-                std::function<void()> task;
-                {
-                    std::unique_lock<std::mutex> lock(queue_mutex);
-                    condition.wait(lock, [this] { return stop ||!tasks.empty();});
-                    if (stop && tasks.empty()) {
-                        return;
-                    }
-                    task = std::move(tasks.front());
-                    tasks.pop();
+                if (runOne()) continue;
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                sleeping.fetch_add(1);
+                condition.wait(lock, [this] { return stop || !tasks.empty() || !ring.emptyApprox(); });
+                sleeping.fetch_sub(1);
+                if (stop && tasks.empty() && ring.emptyApprox()) {
+                    return;
                 }
-                
-                task();
             }
         });
     }
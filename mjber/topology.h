@@ -0,0 +1,96 @@
+#ifndef TOPOLOGY
+#define TOPOLOGY
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cerrno>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "logger.h"
+
+/*
+    CPU和NUMA节点的拓扑，给调度器绑定线程用
+    节点的CPU从/sys/devices/system/node/node<N>/cpulist读，不依赖libnuma；没有这个目录（非NUMA内核）时所有CPU算节点0
+    内存不单独按节点分配：线程绑定到节点之后，内核按首次访问把它缺页的内存放在本节点上，
+    协程栈归还时会把物理页还给内核、下次运行时重新缺页，连接的缓冲区在处理它的协程里分配，也就都落在本节点
+*/
+class CpuTopology {
+public:
+    //--在线的节点
+    static std::vector<int> Nodes();
+    //--节点上的CPU，节点不存在时返回空
+    static std::vector<int> NodeCpus(int node);
+    //--CPU所在的节点，查不到时返回-1
+    static int NodeOf(int cpu);
+    //--把调用线程绑定到这些CPU上，cpus为空时不做任何事；失败时记日志并返回false
+    static bool PinSelf(const std::vector<int>& cpus);
+    //--解析"0-3,8,10-11"这样的CPU列表
+    static std::vector<int> ParseList(const std::string& list);
+};
+
+std::vector<int> CpuTopology::ParseList(const std::string& list) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+        std::string range = list.substr(pos, end - pos);
+        pos = end + 1;
+        if (range.empty() || range.find_first_not_of("0123456789-\n ") != std::string::npos) continue;
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+std::vector<int> CpuTopology::NodeCpus(int node) {
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (file >> list) return ParseList(list);
+    if (node != 0) return {};
+    // 非NUMA的内核没有节点目录，所有在线的CPU都算节点0
+    std::ifstream online("/sys/devices/system/cpu/online");
+    if (online >> list) return ParseList(list);
+    return {};
+}
+
+std::vector<int> CpuTopology::Nodes() {
+    std::ifstream file("/sys/devices/system/node/online");
+    std::string list;
+    if (file >> list) return ParseList(list);
+    return {0};
+}
+
+int CpuTopology::NodeOf(int cpu) {
+    for (int node : Nodes()) {
+        for (int c : NodeCpus(node)) {
+            if (c == cpu) return node;
+        }
+    }
+    return -1;
+}
+
+bool CpuTopology::PinSelf(const std::vector<int>& cpus) {
+    if (cpus.empty()) return true;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) == 0) return true;
+    LOG_STREAM<<"sched_setaffinity failed "<<std::to_string(errno)<<ERRORLOG;
+    return false;
+#else
+    LOG_STREAM<<"thread affinity not supported on this platform"<<ERRORLOG;
+    return false;
+#endif
+}
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef URING
+#define URING
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+    io_uring的最小封装，直接用系统调用，不依赖liburing
+    提交队列和完成队列只由一个线程使用（调度器里是环所属的工作线程）；register类的系统调用内核自己加锁，可以在任意线程调用
+    提交：getSqe取到的条目填好后先留在队列里，enter时一次交给内核
+    收割：reap处理完所有已经完成的条目后再一次推进head
+*/
+class Uring {
+public:
+    // 内核不支持或者被禁止时抛出异常
+    explicit Uring(unsigned entries);
+    ~Uring();
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    int fd() const { return m_fd; }
+    unsigned features() const { return m_features; }
+    //--取一个清零的提交条目，队列满时返回空
+    io_uring_sqe* getSqe();
+    //--填好但还没交给内核的条目数
+    unsigned pending() const { return m_sqTail - m_sqSubmitted; }
+    //--内核要求进入一次：COOP_TASKRUN下有完成回调等着在本线程运行，或者完成队列溢出
+    bool needEnter() const {
+        return __atomic_load_n(m_sqFlags, __ATOMIC_RELAXED) & (IORING_SQ_TASKRUN | IORING_SQ_CQ_OVERFLOW);
+    }
+    //--提交所有条目；waitNr>0时等到至少这么多条完成，timeoutMs<0表示一直等
+    //  返回交给内核的条数，失败返回-errno（超时是-ETIME）
+    int enter(unsigned waitNr, int timeoutMs);
+    //--处理所有已完成的条目，返回处理的条数
+    template<typename F>
+    unsigned reap(F&& f);
+
+    //--注册稀疏的固定文件表，之后用updateFile按下标填入
+    int registerFiles(unsigned count);
+    //--把fd放进固定文件表的index位置，fd为-1表示清空；成功返回0
+    int updateFile(unsigned index, int fd);
+    //--同步取消fd上的所有请求，flags是IORING_ASYNC_CANCEL_*；没有匹配的请求返回-ENOENT
+    int syncCancel(int fd, unsigned flags);
+
+private:
+    static int Setup(unsigned entries, io_uring_params* p) {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+    }
+    int Register(unsigned opcode, const void* arg, unsigned nr) {
+        int r = static_cast<int>(syscall(__NR_io_uring_register, m_fd, opcode, arg, nr));
+        return r < 0 ? -errno : r;
+    }
+
+    int m_fd = -1;
+    unsigned m_features = 0;
+    void* m_ringPtr = MAP_FAILED;
+    size_t m_ringSize = 0;
+    io_uring_sqe* m_sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t m_sqesSize = 0;
+    // 提交队列
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTailPtr = nullptr;
+    unsigned* m_sqFlags = nullptr;
+    unsigned* m_sqArray = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    unsigned m_sqTail = 0;      // 本地的tail，enter时写回
+    unsigned m_sqSubmitted = 0; // 已经交给内核的位置
+    // 完成队列
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+};
+
+Uring::Uring(unsigned entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // 完成回调只在线程进入内核时运行，不用IPI打断正在跑协程的线程；旧内核不认识这些标志时去掉再试
+    p.flags = IORING_SETUP_CLAMP | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+    m_fd = Setup(entries, &p);
+    if (m_fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CLAMP;
+        m_fd = Setup(entries, &p);
+    }
+    if (m_fd < 0) {
+        throw std::runtime_error(std::string("io_uring_setup failed: ") + std::strerror(errno));
+    }
+    m_features = p.features;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(m_fd);
+        throw std::runtime_error("io_uring without IORING_FEAT_SINGLE_MMAP");
+    }
+    // 提交队列和完成队列在同一块映射里
+    size_t sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    m_ringSize = sqSize > cqSize ? sqSize : cqSize;
+    m_ringPtr = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    if (m_ringPtr != MAP_FAILED) {
+        m_sqes = static_cast<io_uring_sqe*>(mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES));
+    }
+    if (m_ringPtr == MAP_FAILED || m_sqes == MAP_FAILED) {
+        int err = errno;
+        if (m_ringPtr != MAP_FAILED) munmap(m_ringPtr, m_ringSize);
+        close(m_fd);
+        throw std::runtime_error(std::string("io_uring mmap failed: ") + std::strerror(err));
+    }
+    char* base = static_cast<char*>(m_ringPtr);
+    m_sqHead = reinterpret_cast<unsigned*>(base + p.sq_off.head);
+    m_sqTailPtr = reinterpret_cast<unsigned*>(base + p.sq_off.tail);
+    m_sqFlags = reinterpret_cast<unsigned*>(base + p.sq_off.flags);
+    m_sqArray = reinterpret_cast<unsigned*>(base + p.sq_off.array);
+    m_sqMask = *reinterpret_cast<unsigned*>(base + p.sq_off.ring_mask);
+    m_sqEntries = p.sq_entries;
+    m_sqTail = m_sqSubmitted = *m_sqTailPtr;
+    m_cqHead = reinterpret_cast<unsigned*>(base + p.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned*>(base + p.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned*>(base + p.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe*>(base + p.cq_off.cqes);
+}
+
+Uring::~Uring() {
+    munmap(m_sqes, m_sqesSize);
+    munmap(m_ringPtr, m_ringSize);
+    close(m_fd);
+}
+
+io_uring_sqe* Uring::getSqe() {
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (m_sqTail - head >= m_sqEntries) return nullptr;
+    unsigned index = m_sqTail & m_sqMask;
+    io_uring_sqe* sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqArray[index] = index;
+    ++m_sqTail;
+    return sqe;
+}
+
+int Uring::enter(unsigned waitNr, int timeoutMs) {
+    unsigned submit = m_sqTail - m_sqSubmitted;
+    __atomic_store_n(m_sqTailPtr, m_sqTail, __ATOMIC_RELEASE);
+    unsigned flags = 0;
+    io_uring_getevents_arg arg;
+    __kernel_timespec ts;
+    const void* argp = nullptr;
+    size_t argSize = 0;
+    if (waitNr > 0 || needEnter()) flags |= IORING_ENTER_GETEVENTS;
+    if (waitNr > 0 && timeoutMs >= 0) {
+        memset(&arg, 0, sizeof(arg));
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        argp = &arg;
+        argSize = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    int r = static_cast<int>(syscall(__NR_io_uring_enter, m_fd, submit, waitNr, flags, argp, argSize));
+    if (r < 0) return -errno;
+    m_sqSubmitted += static_cast<unsigned>(r);
+    return r;
+}
+
+template<typename F>
+unsigned Uring::reap(F&& f) {
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    unsigned count = tail - head;
+    for (; head != tail; ++head) f(&m_cqes[head & m_cqMask]);
+    if (count) __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+int Uring::registerFiles(unsigned count) {
+    io_uring_rsrc_register reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.nr = count;
+    reg.flags = IORING_RSRC_REGISTER_SPARSE;
+    int r = Register(IORING_REGISTER_FILES2, &reg, sizeof(reg));
+    return r < 0 ? r : 0;
+}
+
+int Uring::updateFile(unsigned index, int fd) {
+    io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = index;
+    update.fds = reinterpret_cast<uint64_t>(&fd);
+    int r = Register(IORING_REGISTER_FILES_UPDATE, &update, 1);
+    return r < 0 ? r : 0;
+}
+
+int Uring::syncCancel(int fd, unsigned flags) {
+    io_uring_sync_cancel_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.fd = fd;
+    reg.flags = flags;
+    reg.timeout.tv_sec = -1; // 一直等到取消完成
+    reg.timeout.tv_nsec = -1;
+    int r = Register(IORING_REGISTER_SYNC_CANCEL, &reg, 1);
+    return r < 0 ? r : 0;
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef WORK_STEALING_DEQUE
+#define WORK_STEALING_DEQUE
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+    Chase-Lev工作窃取双端队列（按Lê等人给出的C11内存序版本实现）
+    只有所属线程能在底部push/pop（后进先出，刚放进去的数据还在缓存里），其他线程从顶部steal（先进先出）
+    底部的操作只有队列里剩最后一个元素时才需要一次CAS，和偷取方竞争
+    环形数组满了就翻倍，旧数组可能还有偷取方在读，留到析构时再释放
+    T需要能放进std::atomic，一般是指针
+*/
+template <typename T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity = 256) {
+        size_t cap = 1;
+        while (cap < capacity) cap <<= 1;
+        m_array.store(new Array(cap), std::memory_order_relaxed);
+    }
+    ~WorkStealingDeque() {
+        delete m_array.load(std::memory_order_relaxed);
+        for (Array* a : m_retired) delete a;
+    }
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // 只能由所属线程调用
+    void push(T item) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        Array* a = m_array.load(std::memory_order_relaxed);
+        if (b - t > static_cast<int64_t>(a->capacity) - 1) {
+            a = grow(a, t, b);
+        }
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // 只能由所属线程调用
+    bool pop(T& out) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = m_array.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        if (t > b) {
+            m_bottom.store(b + 1, std::memory_order_relaxed); // 空的
+            return false;
+        }
+        T item = a->get(b);
+        if (t == b) {
+            // 最后一个元素，和偷取方抢
+            bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            if (!won) return false;
+        }
+        out = item;
+        return true;
+    }
+
+    // 任意线程调用，失败可能是空了也可能是和别人抢输了
+    bool steal(T& out) {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b) return false;
+        Array* a = m_array.load(std::memory_order_acquire);
+        T item = a->get(t);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return false;
+        }
+        out = item;
+        return true;
+    }
+
+    // 近似值，给偷取方挑选目标和空闲判断用
+    bool emptyApprox() const {
+        return m_top.load(std::memory_order_acquire) >= m_bottom.load(std::memory_order_acquire);
+    }
+    size_t sizeApprox() const {
+        int64_t n = m_bottom.load(std::memory_order_acquire) - m_top.load(std::memory_order_acquire);
+        return n > 0 ? static_cast<size_t>(n) : 0;
+    }
+
+private:
+    struct Array {
+        explicit Array(size_t cap):capacity(cap),mask(cap - 1),slots(new std::atomic<T>[cap]){}
+        ~Array() { delete[] slots; }
+        T get(int64_t i) const { return slots[i & mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, T item) { slots[i & mask].store(item, std::memory_order_relaxed); }
+        size_t capacity;
+        size_t mask;
+        std::atomic<T>* slots;
+    };
+
+    Array* grow(Array* old, int64_t t, int64_t b) {
+        Array* a = new Array(old->capacity * 2);
+        for (int64_t i = t; i < b; ++i) a->put(i, old->get(i));
+        m_retired.push_back(old);
+        m_array.store(a, std::memory_order_release);
+        return a;
+    }
+
+    alignas(64) std::atomic<int64_t> m_top {0};
+    alignas(64) std::atomic<int64_t> m_bottom {0};
+    std::atomic<Array*> m_array;
+    std::vector<Array*> m_retired; // 只有所属线程会动
+};
+
+#endif
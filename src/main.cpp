@@ -1,14 +1,24 @@
 #include <iostream>
 #include <fstream>
 #include <filesystem>
+#include <thread>
+#include <csignal>
+#include <pthread.h>
 
 #include "../mjber/http_server.h"
 #include "../mjber/logger.h"
 #include "../mjber/utils.h"
+#include "../mjber/blocking_pool.h"
+
+// 读整个文件，会阻塞，在协程里通过offload调用
+std::string readFile(const std::string& path){
+    std::ifstream page(path,std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(page)), std::istreambuf_iterator<char>());
+}
+
 //默认路由
 std::shared_ptr<HttpResponse> getIndex(std::shared_ptr<HttpRequest>){
-    std::fstream page("../public/index.html");
-    std::string content((std::istreambuf_iterator<char>(page)), std::istreambuf_iterator<char>());
+    std::string content = offload([]{ return readFile("../public/index.html"); });
     std::shared_ptr<HttpResponse> res = std::make_shared<HttpResponse>();
     res->m_code = 200;
     res->m_version = "HTTP/1.1";
@@ -27,7 +37,7 @@ std::shared_ptr<HttpResponse> getPublic(std::shared_ptr<HttpRequest> request){
     path = "../public" + request->url.substr(request->url.find("public")+6);
     LOG_STREAM<<"request for public file: "<<path<<INFOLOG;
     
-    if (!fileExists(path)){
+    if (!offload([&]{ return fileExists(path); })){
 
         LOG_STREAM<<"Failed to open file: "<<path<<ERRORLOG;
         std::shared_ptr<HttpResponse> res = std::make_shared<HttpResponse>();
@@ -38,8 +48,9 @@ std::shared_ptr<HttpResponse> getPublic(std::shared_ptr<HttpRequest> request){
     }
     else{
         LOG_STREAM<<"response to public file: "<<path<<INFOLOG;
-        std::ifstream page(path,std::ios::binary);
-        std::string content((std::istreambuf_iterator<char>(page)), std::istreambuf_iterator<char>());
+        std::string content = offload([&]{ return readFile(path); });
+        // 大文件的传输降低优先级，不挡住其他短请求
+        if(content.size() > 64 * 1024 && Fiber::InFiber()) Fiber::GetThis()->setPriority(FiberPriority::LOW);
         std::shared_ptr<HttpResponse> res = std::make_shared<HttpResponse>();
         res->m_code = 200;
         res->m_version = "HTTP/1.1";
@@ -59,6 +70,12 @@ int main(){
 
     LOG_ADD_CONSOLE_APPENDER();
     LOG_ADD_FILE_APPENDER("LOG.log");
+    // SIGINT/SIGTERM只由等信号的线程接收，之后创建的线程都继承这个屏蔽
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
     auto server = HttpServer("0.0.0.0",8000,4);
     
     RouteRule rule = std::make_pair<std::string,RouteHandler>("/public/*",getPublic);
@@ -66,6 +83,15 @@ int main(){
     server.setRoute(rules);
     
     server.setDefaultHandler(getIndex);
+    server.setRequestTimeout(std::chrono::seconds(30));
+    // 收到信号后优雅停止，正在处理的请求最多再等10秒
+    std::thread([&server, signals](){
+        int sig = 0;
+        sigwait(&signals, &sig);
+        LOG_STREAM<<"signal "<<std::to_string(sig)<<", shutting down"<<INFOLOG;
+        auto report = server.shutdown(std::chrono::seconds(10));
+        LOG_STREAM<<"drained "<<std::to_string(report.drained)<<" requests, aborted "<<std::to_string(report.aborted)<<INFOLOG;
+    }).detach();
     server.setup();
 
 